@@ -73,7 +73,7 @@ function(add_86x64 tgt_name 86x64_NAME)
 
   # transform 32-bit archive to 64-bit archive
   add_custom_command(OUTPUT ${86x64_TRANSFORM}
-    COMMAND macho-tool transform ${86x64_REBASE} ${86x64_TRANSFORM}
+    COMMAND macho-tool transform --direct-calls --peephole --rsb-calls --printf-plans ${86x64_REBASE} ${86x64_TRANSFORM}
     DEPENDS macho-tool ${86x64_REBASE}
     )
 
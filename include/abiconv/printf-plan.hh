@@ -0,0 +1,177 @@
+#pragma once
+
+/* Precompiled printf argument-conversion plans.
+ *
+ * A plan lists, for each argument consumed by a printf format string, how to widen it from the
+ * i386 stack layout to the x86_64 one. macho-tool precompiles the plans of constant format
+ * strings into the PRINTF_PLAN_SECTNAME section of the translated binary; the vararg wrappers
+ * in libabiconv look them up by format address and only compile plans at runtime for formats
+ * that are not in the table.
+ *
+ * Section layout (all little-endian uint32_t):
+ *    count
+ *    count x {format vmaddr (unslid), offset of plan from section start}, sorted by vmaddr
+ *    plans: one length byte followed by that many printf_plan_op bytes
+ */
+
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#define PRINTF_PLAN_SEGNAME  "__TEXT"
+#define PRINTF_PLAN_SECTNAME "__printf_plan"
+
+#define PRINTF_PLAN_MAX_OPS 255
+
+struct printf_plan_entry {
+   uint32_t format; /*!< format string vmaddr */
+   uint32_t plan;   /*!< offset of plan from section start */
+};
+
+/* argument conversions, named by 32-bit type -> 64-bit type */
+enum printf_plan_op: uint8_t {
+   PRINTF_PLAN_INT,    /*!< int32_t -> int32_t */
+   PRINTF_PLAN_INT8,   /*!< int8_t -> int8_t */
+   PRINTF_PLAN_SCHAR,  /*!< signed char -> signed char */
+   PRINTF_PLAN_UCHAR,  /*!< uint8_t -> uint8_t */
+   PRINTF_PLAN_SHORT,  /*!< int16_t -> int16_t */
+   PRINTF_PLAN_USHORT, /*!< uint16_t -> uint16_t */
+   PRINTF_PLAN_LONG,   /*!< int32_t -> int64_t */
+   PRINTF_PLAN_ULONG,  /*!< uint32_t -> uint64_t (also pointers) */
+   PRINTF_PLAN_LLONG,  /*!< int64_t -> int64_t */
+   PRINTF_PLAN_DOUBLE, /*!< double -> double */
+};
+
+namespace printf_plan {
+
+   enum class modifier {NONE, H, HH, L, LL, J, T, Z, LD};
+
+   inline modifier parse_modifier(const char *& format) {
+      /* longest match first */
+      static const struct { const char *str; modifier mod; } mods[] =
+         {{"hh", modifier::HH}, {"ll", modifier::LL}, {"h", modifier::H}, {"l", modifier::L},
+          {"j", modifier::J}, {"t", modifier::T}, {"z", modifier::Z}, {"L", modifier::LD}};
+      for (const auto& mod : mods) {
+         const std::size_t len = strlen(mod.str);
+         if (strncmp(mod.str, format, len) == 0) {
+            format += len;
+            return mod.mod;
+         }
+      }
+      return modifier::NONE;
+   }
+
+   /* Returns the conversion of one directive's argument, or -1 if unsupported. */
+   inline int directive_op(char type, modifier mod) {
+      switch (type) {
+      case 'd':
+      case 'i':
+         switch (mod) {
+         case modifier::NONE: return PRINTF_PLAN_INT;
+         case modifier::HH:   return PRINTF_PLAN_SCHAR;
+         case modifier::H:    return PRINTF_PLAN_SHORT;
+         case modifier::L:
+         case modifier::T:    return PRINTF_PLAN_LONG;
+         case modifier::LL:
+         case modifier::J:    return PRINTF_PLAN_LLONG;
+         case modifier::Z:    return PRINTF_PLAN_LONG;
+         default:             return -1;
+         }
+         
+      case 'o':
+      case 'u':
+      case 'x':
+      case 'X':
+         switch (mod) {
+         case modifier::NONE: return PRINTF_PLAN_INT;
+         case modifier::HH:   return PRINTF_PLAN_UCHAR;
+         case modifier::H:    return PRINTF_PLAN_USHORT;
+         case modifier::L:
+         case modifier::T:
+         case modifier::Z:    return PRINTF_PLAN_ULONG;
+         case modifier::LL:
+         case modifier::J:    return PRINTF_PLAN_LLONG;
+         default:             return -1;
+         }
+
+      case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+         switch (mod) {
+         case modifier::NONE:
+         case modifier::L:    return PRINTF_PLAN_DOUBLE;
+         case modifier::LD:   return -1; /* long double: 12 bytes on the i386 stack, 16 on x86_64 */
+         default:             return -1;
+         }
+
+      case 'c':
+         return (mod == modifier::NONE) ? PRINTF_PLAN_INT : -1;
+
+      case 's':
+      case 'p':
+         return (mod == modifier::NONE) ? PRINTF_PLAN_ULONG : -1;
+
+      default:
+         return -1;
+      }
+   }
+
+   /**
+    * Compiles a printf format string into a plan.
+    * @param ops output conversions, of capacity PRINTF_PLAN_MAX_OPS
+    * @return number of conversions, or -1 if the format is invalid or unsupported
+    */
+   inline int compile(const char *format, uint8_t *ops) {
+      int nops = 0;
+      const auto emit = [&] (int op) {
+         if (op < 0 || nops == PRINTF_PLAN_MAX_OPS) {
+            return false;
+         }
+         ops[nops++] = op;
+         return true;
+      };
+      
+      for (char c; (c = *format++); ) {
+         if (c != '%') {
+            continue;
+         }
+         if (*format == '%') {
+            ++format;
+            continue;
+         }
+
+         /* flags */
+         while (strchr("#0- +'", *format) && *format) {
+            ++format;
+         }
+
+         /* minimum field width */
+         if (*format == '*') {
+            ++format;
+            if (!emit(PRINTF_PLAN_INT)) { return -1; }
+         }
+         while (isdigit(*format)) {
+            ++format;
+         }
+
+         /* precision */
+         if (*format == '.') {
+            ++format;
+            if (*format == '*') {
+               ++format;
+               if (!emit(PRINTF_PLAN_INT)) { return -1; }
+            }
+            while (isdigit(*format)) {
+               ++format;
+            }
+         }
+
+         const modifier mod = parse_modifier(format);
+         if (*format == '\0' || !emit(directive_op(*format++, mod))) {
+            return -1;
+         }
+      }
+      
+      return nops;
+   }
+
+}
@@ -20,6 +20,12 @@ int sizeof_type_archcmp(CXType type);
 
 size_t alignof_type(CXType type, arch a);
 
+/**
+ * Whether a type has the same size and internal layout on i386 and x86_64, i.e. whether it can
+ * be converted by a plain memory copy.
+ */
+bool same_layout(CXType type);
+
 /**
  * Emit code to convert values between architectures at runtime.
  */
@@ -63,6 +69,7 @@ public:
                                MemoryLocation dst);
    void convert_pointer(std::ostream& os, CXType pointee, const Location& src, const Location& dst);
    void convert_record(std::ostream& os, CXType record, MemoryLocation src, MemoryLocation dst);
+   void copy_block(std::ostream& os, MemoryLocation src, MemoryLocation dst, size_t size);
    
    conversion(bool allocate, arch from_arch, arch to_arch, const MemoryLocation& data,
               unsigned& label, const Symbols& ignore_structs):
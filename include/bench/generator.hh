@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace Bench {
+
+   /* Relative weights of the kinds of instructions in generated function bodies. */
+   struct InstructionMix {
+      unsigned alu = 8;    /*!< register arithmetic and moves */
+      unsigned mem = 4;    /*!< frame and absolute __data loads/stores, data address immediates */
+      unsigned branch = 2; /*!< short and near conditional branches, short jumps */
+      unsigned call = 1;   /*!< calls to other generated functions */
+      unsigned pic = 1;    /*!< `call 0; pop eax' thunks followed by a thunk-relative load */
+
+      /** Parse a comma-separated list of `<kind>=<weight>', e.g. `alu=4,call=0'. */
+      void parse(const std::string& s);
+      unsigned total() const { return alu + mem + branch + call + pic; }
+   };
+
+   struct GeneratorOptions {
+      std::size_t functions = 1000;
+      std::size_t insts = 32;       /*!< mean body sequences per function, mostly 1 instruction */
+      InstructionMix mix;
+      std::size_t data_size = 0x10000; /*!< bytes of __data */
+      std::size_t symbols = 1000;   /*!< other functions that get a local symbol */
+      std::size_t exports = 16;     /*!< exported functions, including _main (at most 255) */
+      std::size_t imports = 16;     /*!< undefined symbols that binds refer to */
+      unsigned rebase_density = 10; /*!< percentage of __data pointer slots that are rebased */
+      unsigned bind_density = 5;    /*!< percentage of __data pointer slots that are bound */
+      std::size_t islands = 0;      /*!< data-in-code islands in __text */
+      std::size_t island_size = 16;
+      uint32_t seed = 0;
+
+      /** Check the options are consistent, throwing std::string otherwise. */
+      void validate() const;
+   };
+
+   /* Totals of what was generated. */
+   struct GeneratorResult {
+      std::size_t insts = 0;
+      std::size_t rebases = 0;
+      std::size_t binds = 0;
+      std::size_t size = 0; /*!< bytes in the raw image */
+   };
+
+   /**
+    * Write a synthetic i386 MH_EXECUTE to _path_. There is no way to assemble an Archive from
+    * scratch, so the image is laid out by hand with Image and the mach-o structures: __PAGEZERO,
+    * __TEXT with __text, __DATA with __data, __LINKEDIT, LC_DYLD_INFO_ONLY (rebases, binds and
+    * an export trie), LC_SYMTAB, LC_DYSYMTAB, LC_LOAD_DYLINKER, LC_MAIN, LC_LOAD_DYLIB,
+    * LC_FUNCTION_STARTS and LC_DATA_IN_CODE. Generation is deterministic for a given seed.
+    * The code is well-formed but isn't meant to run. The raw image is only as tidy as this writer;
+    * parse and re-emit it to normalize it.
+    */
+   GeneratorResult generate(const GeneratorOptions& opts, const char *path);
+
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+
+#include "types.hh"
+
+namespace MachO {
+
+   struct CodeAlignment {
+      unsigned function_align = 0; /*!< log2 alignment of function entries (0 = don't align) */
+      unsigned loop_align = 0;     /*!< log2 alignment of loop heads (0 = don't align) */
+      std::size_t max_padding = 10; /*!< maximum number of NOP bytes per aligned blob */
+   };
+
+   /**
+    * Inserts NOP padding in __text before function entries (from LC_FUNCTION_STARTS) and loop
+    * heads (targets of backward branches), so they start on the requested boundaries.
+    * Padding is sized during Build, so this may run before the final layout.
+    * @return number of padding blobs inserted
+    */
+   template <Bits bits>
+   std::size_t align_code(Archive<bits>& archive, const CodeAlignment& opts);
+
+}
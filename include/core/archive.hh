@@ -1,5 +1,7 @@
 #pragma once
 
+#include <optional>
+#include <unordered_set>
 #include <vector>
 #include <sstream>
 #include <mach-o/loader.h>
@@ -72,9 +74,37 @@ namespace MachO {
 
       virtual std::size_t Build(std::size_t offset) override;
 
+      std::size_t short_branches = 0;   /*!< branches left in rel8 form by the last build */
+      std::size_t relaxed_branches = 0; /*!< branches widened to rel32 by the last build */
+
       virtual void Emit(Image& img) const override;
       virtual ~Archive() override;
 
+      /** What Relayout() changed, i.e. what Emit(Image&, const Dirty&) has to write again. */
+      struct Dirty {
+         std::unordered_set<const Section<b> *> sections; /*!< sections whose content to emit */
+         std::unordered_set<const LoadCommand<b> *> tables; /*!< rebuilt __LINKEDIT commands */
+         std::vector<FileRange> stale; /*!< where relaid content used to be */
+         std::size_t size = 0; /*!< file size */
+      };
+
+      /**
+       * Incremental alternative to Build() after edits to section content (see Section::dirty),
+       * starting from the current layout, i.e. that of the parsed image or of the last build.
+       * Dirty sections are laid out again, and so are the sections behind them in the same
+       * segment, which shift by the size deltas of the sections in front of them. __LINKEDIT
+       * tables are only rebuilt if they encode addresses or have shifted themselves.
+       * @return what has to be emitted again, or std::nullopt if the edits don't fit into the
+       *         current segments and a full Build() is needed
+       */
+      std::optional<Dirty> Relayout();
+
+      /**
+       * Emit the headers and what _dirty_ lists into _img_, which holds the image as it was laid
+       * out before Relayout().
+       */
+      void Emit(Image& img, const Dirty& dirty) const;
+
       template <typename... Args>
       void Insert(const SectionLocation<b>& loc, Args&&... args) {
          loc.segment->Insert(loc, args...);
@@ -92,6 +122,9 @@ namespace MachO {
       }
 
       void insert(SectionBlob<b> *blob, const Location& loc, Relation rel);
+
+      /** Insert many blobs, walking each section they fall into once (see Section::insert). */
+      void insert(const std::vector<Insertion<b>>& blobs);
       void remove_commands(uint32_t cmd);
       
       template <template <Bits> class Blob>
@@ -109,6 +142,9 @@ namespace MachO {
    private:
       std::size_t total_size;
 
+      void Build_once(std::size_t offset);
+      std::size_t relax_branches();
+
       Archive(const Image& img, std::size_t offset);
       Archive(const Archive<opposite<b>>& other, TransformEnv<opposite<b>>& env);
       
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include "types.hh"
+#include "section.hh"
+
+namespace MachO {
+
+   /**
+    * Control-flow graph of a range of a code section.
+    * Edges come from Instruction::brdisp and fallthrough. Blobs that aren't instructions and
+    * occupy space (data-in-code regions, stub helper entries) end fallthrough. Placeholders belong
+    * to the block of the instruction they precede, so branch targets resolve through them.
+    * Calls don't end blocks; transfers whose target isn't in the graph (returns, indirect branches,
+    * tail calls to other functions) set Block::exit.
+    */
+   template <Bits bits>
+   class CFG {
+   public:
+      using Content = typename Section<bits>::Content;
+      struct Loop;
+
+      struct Block {
+         std::size_t id; /*!< index in CFG::blocks, in address order */
+         std::vector<Instruction<bits> *> insts;
+         std::vector<Block *> succs;
+         std::vector<Block *> preds;
+         bool exit = false;  /*!< may transfer control out of the graph */
+         Block *idom = nullptr; /*!< immediate dominator (nullptr for entry blocks) */
+         Loop *loop = nullptr; /*!< innermost loop containing this block */
+
+         Instruction<bits> *last() const { return insts.back(); }
+         unsigned loop_depth() const;
+      };
+
+      struct Loop {
+         Block *header;
+         Loop *parent = nullptr;
+         std::vector<Block *> blocks; /*!< all blocks in the loop, including nested loops */
+         unsigned depth = 1;
+
+         bool contains(const Block *block) const;
+      };
+
+      using Blocks = std::vector<std::unique_ptr<Block>>;
+      using Loops = std::vector<std::unique_ptr<Loop>>;
+
+      Blocks blocks;
+      Loops loops; /*!< outermost loops first */
+      Section<bits> *section;
+
+      /**
+       * Build the graph of the blobs in [begin, end) of _section_.
+       * Dominators and loops are computed as well.
+       */
+      CFG(Section<bits> *section, typename Content::iterator begin,
+          typename Content::iterator end);
+      CFG(Section<bits> *section): CFG(section, section->content.begin(), section->content.end()) {}
+
+      /**
+       * Build one graph per function of the archive's __text section, splitting at the entries
+       * of the function starts command. Functions are independent, so they are built concurrently.
+       * @param jobs number of worker threads (0 selects the hardware concurrency)
+       */
+      static std::vector<std::unique_ptr<CFG<bits>>> Functions(Archive<bits>& archive,
+                                                                unsigned jobs = 0);
+
+      /** Block containing _blob_ (an instruction or a placeholder in front of one), or nullptr. */
+      Block *block(const SectionBlob<bits> *blob) const;
+
+      /** Whether every path from an entry to _b_ passes through _a_. */
+      bool dominates(const Block *a, const Block *b) const;
+
+      /**
+       * Record that _inst_ was inserted into the section immediately before _pos_, which must
+       * already be in the graph. _inst_ joins the block in front of the instruction _pos_ labels.
+       * Only straight-line instructions can be added this way; control transfers, and insertions
+       * in front of a branch target (which only run on fallthrough), change the block structure
+       * and require rebuilding the graph.
+       */
+      void insert(const SectionBlob<bits> *pos, Instruction<bits> *inst);
+
+   private:
+      std::unordered_map<const SectionBlob<bits> *, Block *> labels;
+      /*! instruction each placeholder labels */
+      std::unordered_map<const SectionBlob<bits> *, Instruction<bits> *> placeholders;
+
+      void compute_dominators();
+      void compute_loops();
+   };
+
+   /** Effect of one instruction in a backward dataflow problem over bit masks. */
+   struct Transfer {
+      uint32_t gen = 0;  /*!< bits used by the instruction */
+      uint32_t kill = 0; /*!< bits the instruction unconditionally defines */
+      /*! mask after the instruction, overriding its successors (e.g. for calls and returns) */
+      std::optional<uint32_t> out;
+   };
+
+   /**
+    * Backward "may" dataflow (e.g. liveness) over the instructions of _cfg_, iterated to a
+    * fixpoint. Successors are joined by union; blocks that leave the graph (Block::exit) add
+    * _exit_.
+    * @param transfer effect of an instruction; called once per instruction
+    * @param store receives each instruction and the mask after it
+    */
+   template <Bits bits>
+   void backward_dataflow(const CFG<bits>& cfg, uint32_t exit,
+                          const std::function<Transfer (const Instruction<bits>&)>& transfer,
+                          const std::function<void (Instruction<bits>&, uint32_t)>& store);
+
+}
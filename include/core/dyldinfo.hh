@@ -3,6 +3,10 @@
 #include <mach-o/loader.h>
 #include <vector>
 #include <list>
+#include <string>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "lc.hh"
 #include "segment.hh"
@@ -93,6 +97,8 @@ namespace MachO {
       using ptr_t = select_type<bits, uint32_t, uint64_t>;
       using Bindees = std::list<BindNode<bits, lazy> *>;
 
+      using Index = std::unordered_multimap<std::string, BindNode<bits, lazy> *>;
+
       Bindees bindees;
 
       std::size_t size() const;
@@ -108,15 +114,51 @@ namespace MachO {
 
       void Build(BuildEnv<bits>& env);
 
-      typename Bindees::iterator find(const std::string& sym) {
-         return std::find_if(begin(), end(), [&] (auto node) { return node->sym == sym; });
+      /* Bind nodes for symbol _sym_, optionally restricted to those bound to _dylib_. */
+      std::vector<BindNode<bits, lazy> *> find(const std::string& sym,
+                                               const DylibCommand<bits> *dylib = nullptr) const;
+
+      /* Edits through the following functions keep the symbol index in sync.
+       * Call reindex() after modifying a node's `sym' directly. */
+      void rename(BindNode<bits, lazy> *node, const std::string& sym);
+
+      /** Rename every node for which _fn_ returns a new symbol name.
+       * @param fn callable with signature std::optional<std::string>(const BindNode&)
+       * @return number of renamed nodes
+       */
+      template <typename Fn>
+      std::size_t rename_if(Fn fn) {
+         std::size_t count = 0;
+         for (BindNode<bits, lazy> *node : bindees) {
+            std::optional<std::string> sym = fn(*node);
+            if (sym && *sym != node->sym) {
+               node->sym = std::move(*sym);
+               ++count;
+            }
+         }
+         if (count > 0) {
+            reindex();
+         }
+         return count;
       }
+
+      /** Rebind all nodes for the symbols in _syms_ to _dylib_, prepending _prefix_ to their
+       * symbol names.
+       * @return number of rebound nodes
+       */
+      std::size_t rebind(const std::unordered_set<std::string>& syms,
+                         const DylibCommand<bits> *dylib, const std::string& prefix = "");
+
+      void reindex();
+
       typename Bindees::iterator begin() { return bindees.begin(); }
       typename Bindees::iterator end() { return bindees.end(); }
 
       void print(std::ostream& os) const;
 
    private:
+      Index index; /*!< symbol name to bind nodes */
+
       BindInfo(const Image& img, std::size_t offset, std::size_t size, ParseEnv<bits>& env);
       BindInfo(const BindInfo<opposite<bits>, lazy>& other, TransformEnv<opposite<bits>>& env);
       
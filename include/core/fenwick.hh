@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include <sys/types.h>
+
+namespace MachO {
+
+   /**
+    * Fenwick (binary indexed) tree over indices [0, size): point updates and prefix sums in
+    * O(log size). Used to track how far edits have shifted the blobs of a laid-out section.
+    */
+   class Fenwick {
+   public:
+      Fenwick(std::size_t size): tree(size + 1, 0) {}
+
+      void add(std::size_t index, ssize_t delta) {
+         for (++index; index < tree.size(); index += index & -index) {
+            tree[index] += delta;
+         }
+      }
+
+      /** Sum of the values at indices [0, end). */
+      ssize_t prefix(std::size_t end) const {
+         ssize_t sum = 0;
+         for (; end > 0; end -= end & -end) {
+            sum += tree[end];
+         }
+         return sum;
+      }
+
+      /** Sum of the values at indices [begin, end). */
+      ssize_t range(std::size_t begin, std::size_t end) const { return prefix(end) - prefix(begin); }
+
+   private:
+      std::vector<ssize_t> tree;
+   };
+
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+
+#include "types.hh"
+
+namespace MachO {
+
+   /* Mask of the arithmetic status flags (OF, SF, ZF, AF, PF, CF) in xed_flag_set_t::flat. */
+   uint32_t status_flags();
+
+   /**
+    * Backward liveness analysis of the status flags over all instructions in an archive.
+    * Stores the set of flags that may be live after each instruction in Instruction::live_flags.
+    * Control transfers that leave the analyzed code (indirect branches, unresolved targets)
+    * conservatively keep all flags live.
+    * @param abi assume flags are dead at function entry and after returns, as per the i386
+    *            calling convention
+    */
+   template <Bits bits>
+   void analyze_flags_liveness(Archive<bits>& archive, bool abi = true);
+
+}
@@ -33,6 +33,9 @@ namespace MachO {
       
       void memset(std::size_t offset, int c, std::size_t bytes);
 
+      /** Set the file size to _size_, dropping anything past it. */
+      void truncate(std::size_t size);
+
       Image(const Image&) = delete;
       
    private:
@@ -25,10 +25,25 @@ namespace MachO {
       const SectionBlob<bits> *brdisp = nullptr;  /*!< branch displacement pointee */
 
       RelocBlob<bits> *reloc = nullptr; /*!< relocation pointee (owned) */
+      uint32_t live_flags = ~0U; /*!< status flags that may be live after this instruction */
+      uint32_t live_regs = ~0U;  /*!< guest registers that may be live after this instruction */
       
       virtual std::size_t size() const override { return instbuf.size(); }
       virtual void Emit(Image& img, std::size_t offset) const override;
       virtual void Build(BuildEnv<bits>& env) override;
+
+      /** Whether this is a relative branch with an 8-bit displacement. */
+      bool short_branch() const;
+
+      /**
+       * Widens a short branch to its rel32 form if its target no longer fits in 8 bits.
+       * Requires locations from a completed build.
+       * @return whether the instruction grew
+       */
+      bool relax();
+
+      /** Widens a short branch to its rel32 form regardless of its current layout. */
+      void widen();
       
       static Instruction<bits> *Parse(const Image& img, const Location& loc, ParseEnv<bits>& env,
                                       bool add_to_map = true) {
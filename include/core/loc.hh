@@ -43,6 +43,12 @@ namespace MachO {
 
    std::ostream& operator<<(std::ostream& os, const Location& loc);
 
+   /** Bytes [offset, offset + size) of a file. */
+   struct FileRange {
+      std::size_t offset;
+      std::size_t size;
+   };
+
    template <Bits bits> class Segment;
    template <Bits bits> class Section;
    
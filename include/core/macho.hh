@@ -11,6 +11,14 @@ namespace MachO {
 
    void init();
 
+   /* Options that apply to every subsequent MachO::Parse(). */
+   struct ParseOptions {
+      /*! Decode __text by recursive descent from known code addresses instead of a linear sweep;
+       *  bytes that aren't reached are parsed as data. */
+      bool recursive_descent = false;
+   };
+   extern ParseOptions parse_options;
+
    class MachO {
    public:
       virtual uint32_t magic() const = 0;
@@ -35,6 +35,12 @@ namespace MachO {
 
       inline opcode_t lea_rsp_mem_rsp_4() { return {0x48, 0x8D, 0x64, 0x24, 0x04}; }
 
+      /* sub rsp, 4 (clobbers flags) */
+      inline opcode_t sub_rsp_4() { return {0x48, 0x83, 0xec, 0x04}; }
+
+      /* add rsp, 4 (clobbers flags) */
+      inline opcode_t add_rsp_4() { return {0x48, 0x83, 0xc4, 0x04}; }
+
       opcode_t lea_r32_mem_rip_disp32(xed_reg_enum_t r32);
 
       /* jmp [rip+disp32] */
@@ -52,6 +58,18 @@ namespace MachO {
       /* mov r32, [rsp] */
       opcode_t mov_r32_mem_rsp(xed_reg_enum_t r32);
 
+      /* mov [rsp], r64 */
+      opcode_t mov_mem_rsp_r64(xed_reg_enum_t r64);
+
+      /* call rel32 */
+      inline opcode_t call_rel32() { return {0xe8, 0x00, 0x00, 0x00, 0x00}; }
+
+      /* ret */
+      inline opcode_t ret() { return {0xc3}; }
+
+      /* recommended multi-byte nop of at most _max_len_ bytes (at most 9) */
+      opcode_t nop(std::size_t max_len);
+
       /* mov eax, imm32 */
       inline opcode_t mov_eax_imm32() { return {0xb8, 0x00, 0x00, 0x00, 0x00}; }
 
@@ -64,6 +82,30 @@ namespace MachO {
       /* jmp r64 */
       opcode_t jmp_r64(xed_reg_enum_t r64);
 
+      /* lea rsp, [rsp + disp] */
+      opcode_t lea_rsp_mem_rsp_disp(int32_t disp);
+
+      /* add rsp, imm (sub rsp, -imm if negative; clobbers flags). imm must not be INT32_MIN. */
+      opcode_t add_rsp_imm(int32_t imm);
+
+      /* mov [rsp + disp], r16/r32 */
+      opcode_t mov_mem_rsp_disp_reg(int32_t disp, xed_reg_enum_t reg);
+
+      /* mov dword [rsp + disp], imm32 */
+      opcode_t mov_mem_rsp_disp_imm32(int32_t disp, uint32_t imm);
+
+      /* mov qword [rsp + disp], simm32 */
+      opcode_t mov_mem_rsp_disp_simm32_64(int32_t disp, uint32_t imm);
+
+      /* mov r32, [rsp + disp] */
+      opcode_t mov_r32_mem_rsp_disp(xed_reg_enum_t r32, int32_t disp);
+
+      /* mov r32, r32 */
+      opcode_t mov_r32_r32(xed_reg_enum_t dst, xed_reg_enum_t src);
+
+      /* mov r32, imm32 (any r32) */
+      opcode_t mov_r32_imm32(xed_reg_enum_t r32, uint32_t imm);
+
       template <typename T>
       void push_back_imm(opcode_t& opcode, T imm) {
          static_assert(std::is_integral<T>());
@@ -2,6 +2,7 @@
 
 #include <map>
 #include <unordered_map>
+#include <vector>
 
 #include "loc.hh"
 #include "types.hh"
@@ -43,12 +44,16 @@ namespace MachO {
       Segment<bits> *current_segment = nullptr;
       Section<bits> *current_section = nullptr;
       Regions data_in_code;
+      std::vector<std::size_t> code_seeds; /*!< file offsets of known code (entry, function starts,
+                                            *   exports) */
 
       /* vmaddr-to-placeholder map */
       using TodoPlaceholders = std::map<std::size_t, Placeholder<bits> *>;
       TodoPlaceholders placeholders;
 
       Placeholder<bits> *add_placeholder(std::size_t vmaddr);
+      /** Section::split_data() that also registers the range starting at _vmaddr_. */
+      void split_data(Section<bits>& section, std::size_t vmaddr);
       void do_resolve();
       
       
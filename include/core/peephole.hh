@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+
+#include "types.hh"
+#include "loc.hh"
+
+namespace MachO {
+
+   /**
+    * Peephole optimizer for translated x86_64 code.
+    * Rewrites runs of consecutive stack operations (stack pointer adjustments and 16/32-bit
+    * loads and stores to [rsp+disp]) left behind by instruction-at-a-time translation:
+    * adjustments are combined and hoisted, pushes followed by pops are folded into register
+    * moves, stack slot stores that are overwritten or popped before being read are dropped,
+    * adjacent immediate stores are merged, and no-op leas are removed.
+    * Runs never span placeholders, so branch targets and other references stay at the same
+    * position in the instruction stream. Replaced instructions are deactivated rather than
+    * deleted.
+    * @return number of instructions saved
+    */
+   std::size_t peephole(Section<Bits::M64>& section);
+   std::size_t peephole(Archive<Bits::M64>& archive); /*!< optimizes __text sections */
+
+}
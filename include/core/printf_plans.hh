@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+
+#include "types.hh"
+
+namespace MachO {
+
+   /**
+    * Precompiles printf argument-conversion plans (see abiconv/printf-plan.hh) for the constant
+    * C strings referenced by instructions (through immediates or memory displacements) that
+    * contain printf conversions, and stores them in a new __TEXT,__printf_plan section, which
+    * the libabiconv vararg wrappers consult before parsing a format at runtime.
+    * Strings whose formats are unsupported are left to the runtime fallback.
+    * @return number of plans
+    */
+   template <Bits bits>
+   std::size_t emit_printf_plans(Archive<bits>& archive);
+
+}
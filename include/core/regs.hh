@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+
+extern "C" {
+#include <xed/xed-interface.h>
+}
+
+#include "types.hh"
+
+namespace MachO {
+
+   /* Bit of the general-purpose register enclosing _reg_ in a register mask (0 if not a GPR). */
+   uint32_t gpr_mask(xed_reg_enum_t reg);
+
+   /**
+    * Backward liveness analysis of the general-purpose registers over all instructions in an
+    * archive. Stores the set of registers that may be live after each instruction in
+    * Instruction::live_regs. Calls, indirect branches and unresolved targets conservatively keep
+    * all registers live, and system calls and interrupts read all of them.
+    * @param abi assume only the return value and callee-saved registers are live after returns,
+    *            as per the i386 calling convention (i.e. ecx is dead)
+    */
+   template <Bits bits>
+   void analyze_reg_liveness(Archive<bits>& archive, bool abi = true);
+
+   /**
+    * Hands out scratch registers for the x86_64 expansion of one i386 instruction.
+    * Guest registers that are dead after the instruction come first, since they need no REX
+    * prefix; then r11, r10, r9 and r8, which never hold guest state. r12-r15 are never used,
+    * since they are callee-saved for native code calling back into translated code.
+    */
+   class ScratchRegs {
+   public:
+      /** @param live mask of guest registers that must not be clobbered (see gpr_mask()) */
+      ScratchRegs(uint32_t live);
+
+      /** Marks _reg_ as unavailable, e.g. because the expansion reads it after the scratch write. */
+      void reserve(xed_reg_enum_t reg) { busy |= gpr_mask(reg); }
+
+      /** Allocates a scratch register and returns its 32-bit name. */
+      xed_reg_enum_t r32();
+      
+   private:
+      uint32_t busy;
+   };
+
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <unordered_map>
+#include <vector>
+
+#include "types.hh"
+
+namespace MachO {
+
+   /**
+    * Execution profile of a binary. Each non-empty line of the text form is either
+    *    <vmaddr> <count>                  (function call/sample count), or
+    *    <caller vmaddr> <callee vmaddr> <count>  (call-graph edge).
+    * Addresses may point anywhere inside a function and are parsed with base prefixes (0x...).
+    * Lines starting with `#' are comments.
+    */
+   struct Profile {
+      struct Edge {
+         std::size_t caller;
+         std::size_t callee;
+         uint64_t count;
+      };
+      
+      std::unordered_map<std::size_t, uint64_t> counts;
+      std::vector<Edge> edges;
+
+      static Profile Parse(std::istream& is);
+   };
+
+   /**
+    * Reorders __text at LC_FUNCTION_STARTS boundaries: the first function (or code before the first
+    * function start) stays first, followed by profiled functions clustered along the heaviest call-graph edges
+    * (hottest clusters first), followed by unprofiled functions in their original order.
+    * Functions that may fall through to their original successor get an explicit jump.
+    * Function starts and data-in-code entries are re-sorted to match the new layout; all other
+    * references are symbolic and are fixed up by the next Build.
+    * Profile addresses refer to the archive's current layout, so it must be parsed or built.
+    * @return number of functions moved out of their original position
+    */
+   template <Bits bits>
+   std::size_t reorder_functions(Archive<bits>& archive, const Profile& profile);
+
+}
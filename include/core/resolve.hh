@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <map>
 #include <list>
 #include <memory>
@@ -7,6 +8,7 @@
 #include <typeinfo>
 
 #include "util.hh"
+#include "trace.hh"
 
 namespace MachO {
 
@@ -51,10 +53,16 @@ namespace MachO {
             (*callback)(found_it->second);
          } else {
             todo[key].emplace_back(pointer, callback);
+            peak_todo = std::max(peak_todo, todo.size());
          }
       }
 
       void do_resolve() {
+         Trace::Span span("Resolver::do_resolve");
+         if (span) {
+            span.arg("resolver", name);
+            span.arg("todo", std::to_string(todo.size()));
+         }
          for (auto todo_it = todo.begin(); todo_it != todo.end(); todo_it = todo.erase(todo_it)) {
             // for (auto todo_it = todo.begin(); todo_it != todo.end(); ++todo_it) {
             if (!todo_it->second.empty()) {
@@ -75,6 +83,8 @@ namespace MachO {
 
       FoundMap found;
       TodoMap todo;
+      std::size_t peak_todo = 0; /*!< largest size of _todo_ (see Stats) */
+      bool report = true; /*!< report to Stats on destruction */
 
       const std::string name;
 
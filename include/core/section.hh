@@ -1,6 +1,7 @@
 #pragma once
 
 #include <list>
+#include <map>
 #include <vector>
 #include <sstream>
 #include <mach-o/reloc.h>
@@ -18,6 +19,15 @@ namespace MachO {
 #define SECT_STUB_HELPER "__stub_helper"
 #define SECT_SYMBOL_STUB "__symbol_stub"
 #define SECT_CONST       "__const"
+#define SECT_CSTRING     "__cstring"
+
+   /** A blob to insert before or after the blob at a location (see Section::insert). */
+   template <Bits bits>
+   struct Insertion {
+      SectionBlob<bits> *blob;
+      Location loc;
+      Relation rel;
+   };
    
    template <Bits bits>
    class Section: public Node {
@@ -30,6 +40,8 @@ namespace MachO {
       Relocations relocs;
       uint8_t id; /*!< assigned at build time */
       const Segment<bits> *segment = nullptr; /*!< containing segment (parse-time) */
+      std::map<std::size_t, DataRange<bits> *> data_ranges; /*!< by vmaddr (see split_data()) */
+      bool dirty = false; /*!< content changed since the last layout (see Archive::Relayout()) */
 
       std::string name() const;
       Location loc() const { return Location(sect.offset, sect.addr); }
@@ -43,6 +55,15 @@ namespace MachO {
       bool contains_vmaddr(std::size_t vmaddr) const;
 
       static Section<bits> *Parse(const Image& img, std::size_t offset, ParseEnv<bits>& env);
+
+      /**
+       * Creates an empty section; the caller adds it to a segment and sets _segment_.
+       * @param align log2 of section alignment
+       */
+      static Section<bits> *Create(const std::string& segname, const std::string& sectname,
+                                   uint32_t flags, uint32_t align) {
+         return new Section(segname, sectname, flags, align);
+      }
       void Parse1(const Image& img, ParseEnv<bits>& env);
       void Parse2(ParseEnv<bits>& env);
 
@@ -50,6 +71,7 @@ namespace MachO {
       void Build(BuildEnv<bits>& env);
       // std::size_t content_size() const;
       void Emit(Image& img, std::size_t offset) const;
+      void Emit_content(Image& img) const; /*!< content and relocations only, at sect.offset */
       void Insert(const SectionLocation<bits>& loc, SectionBlob<bits> *blob);
 
       virtual Section<opposite<bits>> *Transform(TransformEnv<bits>& env) const {
@@ -58,6 +80,12 @@ namespace MachO {
 
       void insert(SectionBlob<bits> *blob, const Location& loc, Relation rel);
 
+      /**
+       * Insert many blobs in a single pass over the content. Same result as calling insert()
+       * for each element of _blobs_ in order, but linear in the size of the section.
+       */
+      void insert(const std::vector<Insertion<bits>>& blobs);
+
       template <template <Bits> class Blob>
       Blob<bits> *find_blob(std::size_t vmaddr) const {
          auto it = std::lower_bound(content.begin(), content.end(), vmaddr,
@@ -94,6 +122,12 @@ namespace MachO {
          }
       }
 
+      /**
+       * Split the data range containing _vmaddr_, if any, so that a blob starts at _vmaddr_.
+       * @return the range starting at _vmaddr_, or nullptr if no data range contains it
+       */
+      DataRange<bits> *split_data(std::size_t vmaddr);
+
       typename Content::iterator find(std::size_t vmaddr); /* inclusive greatest lower bound */
       typename Content::const_iterator find(std::size_t vmaddr) const;
 
@@ -103,11 +137,22 @@ namespace MachO {
       
       Section(const Image& img, std::size_t offset, ParseEnv<bits>& env, Parser parser);
       Section(const Section<opposite<bits>>& other, TransformEnv<opposite<bits>>& env);
+      Section(const std::string& segname, const std::string& sectname, uint32_t flags,
+              uint32_t align);
 
       static SectionBlob<bits> *TextParser(const Image& img, const Location& loc,
                                            ParseEnv<bits>& env);
       static SectionBlob<bits> *StubHelperParser(const Image& img, const Location& loc,
                                                  ParseEnv<bits>& env);
+
+      /**
+       * Decode instructions reachable from the code seeds in this section; everything else
+       * becomes data. Follows fallthrough, relative branch targets and the entries of i386 jump
+       * tables indexed as `jmp [table + index*4]', which are parsed as Immediates. Each run of
+       * remaining bytes becomes a single DataRange (see split_data()).
+       * @return false if no seed lies in this section (nothing was parsed)
+       */
+      bool Parse1_recursive(const Image& img, ParseEnv<bits>& env);
       
       template <Bits> friend class Section;
    };
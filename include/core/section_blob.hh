@@ -44,6 +44,7 @@ namespace MachO {
       static SectionBlob<bits> *Parse(const Image& img, const Location& loc, ParseEnv<bits>& env) {
          return new DataBlob(img, loc, env);
       }
+      static DataBlob<bits> *Create(uint8_t data) { return new DataBlob(data); }
       
       virtual DataBlob<opposite<bits>> *Transform_one(TransformEnv<bits>& env) const override {
          return new DataBlob<opposite<bits>>(*this, env);
@@ -52,10 +53,42 @@ namespace MachO {
    private:
       DataBlob(const Image& img, const Location& loc, ParseEnv<bits>& env);
       DataBlob(const DataBlob<opposite<bits>>& other, TransformEnv<opposite<bits>>& env);
+      DataBlob(uint8_t data): data(data) {}
 
       template <Bits b> friend class DataBlob;
    };
 
+   /**
+    * Run of bytes that isn't decoded any further, e.g. bytes that recursive-descent parsing never
+    * reaches. A reference into the middle of a run splits it (see Section::split_data()).
+    */
+   template <Bits bits>
+   class DataRange: public SectionBlob<bits> {
+   public:
+      std::vector<uint8_t> data;
+      virtual std::size_t size() const override { return data.size(); }
+      virtual void Emit(Image& img, std::size_t offset) const override;
+
+      static DataRange<bits> *Parse(const Image& img, const Location& loc, ParseEnv<bits>& env,
+                                    std::size_t size)
+      { return new DataRange(img, loc, env, size); }
+
+      virtual DataRange<opposite<bits>> *Transform_one(TransformEnv<bits>& env) const override {
+         return new DataRange<opposite<bits>>(*this, env);
+      }
+
+      /** Move the bytes from _at_ on into a new range, which the caller places after this one. */
+      DataRange<bits> *split(std::size_t at);
+
+   private:
+      DataRange(const Image& img, const Location& loc, ParseEnv<bits>& env, std::size_t size);
+      DataRange(const DataRange<opposite<bits>>& other, TransformEnv<opposite<bits>>& env):
+         SectionBlob<bits>(other, env), data(other.data) {}
+      DataRange(std::vector<uint8_t>&& data): data(std::move(data)) {}
+
+      template <Bits b> friend class DataRange;
+   };
+
    template <Bits bits>
    class ZeroBlob: public SectionBlob<bits> {
    public:
@@ -183,6 +216,37 @@ namespace MachO {
       template <Bits> friend class Placeholder;
    };
 
+   /**
+    * Multi-byte NOP padding that aligns the following blob. Its size is recomputed on every build;
+    * if more than _max_size_ bytes would be needed, no padding is emitted.
+    */
+   template <Bits bits>
+   class Padding: public SectionBlob<bits> {
+   public:
+      unsigned align;       /*!< log2 of requested alignment */
+      std::size_t max_size; /*!< maximum number of padding bytes */
+
+      virtual std::size_t size() const override { return size_; }
+      virtual void Build(BuildEnv<bits>& env) override;
+      virtual void Emit(Image& img, std::size_t offset) const override;
+
+      virtual Padding<opposite<bits>> *Transform_one(TransformEnv<bits>& env) const override {
+         return new Padding<opposite<bits>>(*this, env);
+      }
+
+      static Padding<bits> *Create(unsigned align, std::size_t max_size) {
+         return new Padding(align, max_size);
+      }
+
+   private:
+      std::size_t size_ = 0;
+
+      Padding(unsigned align, std::size_t max_size): align(align), max_size(max_size) {}
+      Padding(const Padding<opposite<bits>>& other, TransformEnv<opposite<bits>>& env):
+         SectionBlob<bits>(other, env), align(other.align), max_size(other.max_size) {}
+      template <Bits> friend class Padding;
+   };
+
    template <Bits bits>
    class RelocBlob: public SectionBlob<bits> {
    public:
@@ -1,8 +1,11 @@
 #pragma once
 
+#include <unordered_set>
+#include <vector>
 #include <mach-o/loader.h>
 
 #include "image.hh"
+#include "loc.hh"
 #include "util.hh"
 #include "lc.hh"
 #include "parse.hh"
@@ -27,6 +30,9 @@ namespace MachO {
       virtual void Build(BuildEnv<bits>& env) override;
       virtual void AssignID(BuildEnv<bits>& env) override;
       virtual void Emit(Image& img, std::size_t offset) const override;
+      /** Emit the segment and section headers, but only the content of the sections in _dirty_. */
+      void Emit(Image& img, std::size_t offset,
+                const std::unordered_set<const Section<bits> *>& dirty) const;
       Location loc() const { return Location(segment_command.fileoff, segment_command.vmaddr); }
 
       Section<bits> *section(const std::string& name);
@@ -87,6 +93,16 @@ namespace MachO {
       template <typename... Args>
       static Segment_LINKEDIT<bits> *Parse(Args&&... args) { return new Segment_LINKEDIT(args...); }
       virtual void Build(BuildEnv<bits>& env) override;
+
+      /**
+       * Lay the tables out again in place after section content moved, in the same order as
+       * Build(). Tables that encode addresses are rebuilt, and so is any table that no longer
+       * starts where it did; the others keep their place and content.
+       * @param commands receives the commands whose tables were rebuilt
+       * @param stale receives the file ranges that the rebuilt tables occupied before
+       */
+      void Relayout(BuildEnv<bits>& env, std::unordered_set<const LoadCommand<bits> *>& commands,
+                    std::vector<FileRange>& stale);
       virtual Segment<opposite<bits>> *Transform(TransformEnv<bits>& env) const override {
          return new Segment_LINKEDIT<opposite<bits>>(*this, env);
       }
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+#include "types.hh"
+
+namespace MachO {
+
+   class Stats;
+   extern Stats *stats;
+
+   /**
+    * Node census, resolver sizes and step timings of a run, collected while _stats_ points at an
+    * instance. With _stats_ unset every instrumented step costs a single pointer test.
+    * Timings are keyed `<phase>/<step>`, followed by the load command for per-command steps, e.g.
+    * `parse/Parse1 Segment(__TEXT)`; repeated steps (build rounds) accumulate.
+    */
+   class Stats {
+   public:
+      struct Census {
+         std::size_t count = 0;
+         std::size_t bytes = 0; /*!< approximate memory: object sizes plus owned buffers */
+      };
+      using Censuses = std::map<std::string, Census>; /*!< key: type name */
+
+      struct Resolver {
+         std::string name;
+         std::size_t found;
+         std::size_t todo;       /*!< largest number of keys waiting for a value */
+         std::size_t unresolved; /*!< requests left when the resolver was destroyed */
+      };
+
+      /** Times steps, recording them only if _stats_ was set on construction. */
+      class Timer {
+      public:
+         Timer(): enabled(stats != nullptr) { if (enabled) { start = clock::now(); } }
+
+         /** Add the time since construction or the previous stop() to timing _name_. */
+         void stop(const char *name);
+         template <Bits bits> void stop(const char *name, const LoadCommand<bits> *lc);
+
+      private:
+         using clock = std::chrono::steady_clock;
+         bool enabled;
+         clock::time_point start;
+      };
+
+      /** Points _stats_ at an instance for its scope, even if the scope is left by a throw. */
+      class Enable {
+      public:
+         Enable(Stats *instance): previous(stats) { stats = instance; }
+         ~Enable() { stats = previous; }
+         Enable(const Enable&) = delete;
+
+      private:
+         Stats *previous;
+      };
+
+      /** Times its scope. */
+      class Scope {
+      public:
+         Scope(const char *name): name(name) {}
+         ~Scope() { timer.stop(name); }
+
+      private:
+         const char *name;
+         Timer timer;
+      };
+
+      std::vector<std::pair<std::string, double>> timings; /*!< seconds, in first-seen order */
+      std::vector<std::pair<std::string, Censuses>> censuses; /*!< key: point of the run */
+      std::vector<Resolver> resolvers;
+
+      void time(const std::string& name, double seconds);
+      void resolver(const std::string& name, std::size_t found, std::size_t todo,
+                    std::size_t unresolved);
+
+      /** Count the nodes reachable from _archive_ as census _label_. */
+      template <Bits bits> void census(const std::string& label, const Archive<bits>& archive);
+
+      void print(std::ostream& os) const;
+      void print_json(std::ostream& os) const;
+
+      /** Type name of _node_ without namespace and template arguments, e.g. `Instruction'. */
+      template <typename T> static std::string type_name(const T& node);
+
+   private:
+      std::mutex mutex; /*!< resolvers of transform shards report from worker threads */
+      std::unordered_map<std::string, std::size_t> timing_index;
+
+      static std::string demangle(const char *name);
+   };
+
+   template <typename T>
+   std::string Stats::type_name(const T& node) {
+      return demangle(typeid(node).name());
+   }
+
+}
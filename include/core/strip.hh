@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "types.hh"
+
+namespace MachO {
+
+   /**
+    * Dead stripping. Splits __text, __const, __cstring, __data, __bss and __common into atoms at
+    * function starts, defined symbols and (for C string sections) string boundaries, then marks
+    * the atoms reachable from the entry point, the exports and the _keep_ symbols. All other
+    * sections are kept whole and treated as roots.
+    * An atom references the atoms containing the targets of its instructions' branches, memory
+    * displacements and immediate pointers; any 32-bit immediate or absolute displacement that
+    * lies in an atom; any aligned pointer-sized value in its data (which covers rebased pointers
+    * and jump tables); and, if its last instruction may fall through, the following atom.
+    * Unreached atoms are deactivated, and their function starts and data-in-code entries are
+    * removed. Symbols into stripped atoms are kept and point at the next live address.
+    * Code that computes addresses relative to a PIC base isn't followed, so this is only safe for
+    * non-PIC code. Requires up-to-date locations, i.e. a parsed or built archive.
+    * @param keep names of additional root symbols
+    * @return number of bytes deactivated
+    */
+   template <Bits bits>
+   std::size_t dead_strip(Archive<bits>& archive, const std::vector<std::string>& keep = {});
+
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace MachO {
+
+   class Trace;
+   extern Trace *trace;
+
+   /**
+    * Spans of a run in the Chrome trace-event format (load the output in chrome://tracing or
+    * Perfetto), collected while _trace_ points at an instance. With _trace_ unset a span costs a
+    * single pointer test. Spans are complete events that nest by time on the thread that ran
+    * them; the constructing thread is `main' and others are numbered by their first span.
+    */
+   class Trace {
+   public:
+      using clock = std::chrono::steady_clock;
+      using Args = std::vector<std::pair<const char *, std::string>>;
+
+      /** Records its scope as span _name_ if _trace_ was set on construction. */
+      class Span {
+      public:
+         Span(const char *name): name(name), tracer(trace) {
+            if (tracer) { start = clock::now(); }
+         }
+         ~Span() { if (tracer) { tracer->complete(name, start, clock::now(), std::move(args)); } }
+         Span(const Span&) = delete;
+
+         explicit operator bool() const { return tracer != nullptr; }
+
+         /** Show _value_ as argument _key_ of the span; guard the call with operator bool. */
+         void arg(const char *key, const std::string& value) { args.emplace_back(key, value); }
+
+      private:
+         const char *name;
+         Trace *tracer;
+         clock::time_point start;
+         Args args;
+      };
+
+      Trace();
+
+      void complete(const char *name, clock::time_point start, clock::time_point end, Args args);
+
+      /** Write the trace-event JSON. Call once the traced work has finished. */
+      void write(std::ostream& os) const;
+
+   private:
+      struct Event {
+         const char *name;
+         unsigned tid;
+         clock::time_point start;
+         clock::time_point end;
+         Args args;
+      };
+
+      clock::time_point origin;
+      std::mutex mutex; /*!< transform shards record spans from worker threads */
+      std::vector<Event> events;
+      std::unordered_map<std::thread::id, unsigned> tids;
+   };
+
+}
@@ -1,7 +1,14 @@
 #pragma once
 
 #include <cstdio>
+#include <list>
+#include <map>
+#include <mutex>
+#include <set>
 #include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "resolve.hh"
 #include "types.hh"
@@ -12,10 +19,55 @@ namespace MachO {
    template <Bits b1, Bits b2>
    class TransformEnv {
    public:
+      bool direct_stub_calls = false; /*!< call through lazy pointers instead of symbol stubs */
+      bool rsb_calls = false; /*!< translate call/ret to real call/ret pairs via call thunks */
+      unsigned jobs = 1; /*!< worker threads per section (0 selects the hardware concurrency) */
+
+      /*! Out-of-line code generated while transforming a section's content (e.g. call thunks);
+       *  appended to the end of the section and then cleared. */
+      std::list<SectionBlob<b2> *> trailer;
+
+      using CallThunkKey = std::pair<const Node *, int>;
+
+      /*! Call thunks, keyed by (branch target, target register). */
+      std::map<CallThunkKey, const SectionBlob<b2> *> call_thunks;
+
+      /**
+       * Get the call thunk for _key_, creating it on first use.
+       * @param make callable returning the thunk's blobs, entry first; they are appended to the
+       *        trailer
+       * @return thunk entry
+       */
+      template <typename Make>
+      const SectionBlob<b2> *call_thunk(const CallThunkKey& key, Make make) {
+         if (parent == nullptr) {
+            auto& thunk = call_thunks[key];
+            if (thunk == nullptr) {
+               auto blobs = make();
+               thunk = blobs.front();
+               trailer.splice(trailer.end(), blobs);
+            }
+            return thunk;
+         }
+
+         /* shared between shards; placed in the trailer by merge() in first-use order */
+         std::lock_guard<std::mutex> lock(parent->thunk_mutex);
+         auto& thunk = parent->call_thunks[key];
+         if (thunk == nullptr) {
+            auto blobs = make();
+            thunk = blobs.front();
+            parent->unplaced_thunks[key].splice(parent->unplaced_thunks[key].end(), blobs);
+         }
+         if (used_thunks.insert(key).second) {
+            thunk_uses.push_back(key);
+         }
+         return thunk;
+      }
+      
       template <template<Bits> typename T>
       void add(const T<b1> *key, T<b2> *pointee) {
          if (key) {
-            resolver.add(key, pointee);
+            add_node(key, pointee);
          } else {
             // fprintf(stderr, "warning: %s: not adding null key\n", __FUNCTION__);
          }
@@ -25,7 +77,7 @@ namespace MachO {
          static_assert(std::is_base_of<Node, T<b1>>());
          static_assert(std::is_base_of<Node, T<b2>>());
          if (key) {
-            resolver.resolve(key, (const Node **) pointer);
+            resolve_node(key, (const Node **) pointer);
          } else {
             // fprintf(stderr, "warning: %s: not resolving null key\n", __FUNCTION__);
          }
@@ -36,10 +88,47 @@ namespace MachO {
       void operator()(const nlist_t<b1>& n1, nlist_t<b2>& n2) const;
       void operator()(const section_t<b1>& s1, section_t<b2>& s2) const;
 
-      TransformEnv(): resolver("TransformEnv::resolver") {}
+      TransformEnv(): resolver("TransformEnv::resolver"), id(next_id()) { resolver.report = false; }
+      ~TransformEnv();
+
+      /**
+       * Shard of _parent_ for transforming part of a section's content on another thread.
+       * Additions and resolution requests stay in the shard until it is merged, so requests
+       * for blobs of other shards are left pending rather than raced on.
+       */
+      explicit TransformEnv(TransformEnv& parent):
+         direct_stub_calls(parent.direct_stub_calls), rsb_calls(parent.rsb_calls), jobs(1),
+         resolver("TransformEnv::resolver (shard)"), parent(&parent), id(parent.id)
+      { resolver.report = false; }
+
+      /**
+       * Replay the additions and pending requests of _shard_ into this environment and append
+       * the call thunks it created to the trailer. Shards must be merged in content order for
+       * the result to match a serial transform.
+       */
+      void merge(TransformEnv& shard);
       
    private:
+      /* The root environment maps nodes through their Node::translation slots, so adding and
+       * resolving are a store and a load; requests for nodes not yet added wait in _pending_.
+       * Shards must not write slots that other threads read, so they collect additions in
+       * _resolver_ until they are merged. Only the root reports to Stats, for itself and the
+       * shards merged into it. */
       Resolver<const Node *, Node, false> resolver;
+      std::unordered_map<const Node *, std::vector<const Node **>> pending;
+      std::size_t filled = 0;       /*!< translation slots filled */
+      std::size_t peak_pending = 0; /*!< largest size of _pending_ */
+      std::size_t shard_pending = 0; /*!< largest sizes of the merged shards' requests, summed */
+      TransformEnv *parent = nullptr;
+      const std::size_t id; /*!< unique per root environment; shards share their parent's */
+      std::mutex thunk_mutex;
+      std::map<CallThunkKey, std::list<SectionBlob<b2> *>> unplaced_thunks;
+      std::set<CallThunkKey> used_thunks;
+      std::vector<CallThunkKey> thunk_uses; /*!< call thunks used by this shard, in order */
+
+      static std::size_t next_id();
+      void add_node(const Node *key, Node *pointee);
+      void resolve_node(const Node *key, const Node **pointer);
       // Resolver<const void *, void, false> resolver;
    };
    
@@ -52,6 +52,7 @@ namespace MachO {
    template <Bits> class Instruction;
    template <Bits> class SectionBlob;
    template <Bits> class Placeholder;
+   template <Bits> class DataRange;
    template <Bits> class RelocBlob;
 
    template <Bits> class RebaseInfo;
@@ -69,6 +70,21 @@ namespace MachO {
    constexpr std::size_t vmaddr_start = bits == Bits::M32 ? 0x1000 : 0x100000000;
 
    class Node {
+   public:
+      /*! Counterpart of this node in the archive being transformed to (see TransformEnv).
+       *  Only meaningful if _env_ is the id of the environment doing the lookup. */
+      struct Translation {
+         std::size_t env = 0;
+         const Node *node = nullptr;
+         bool found = false;   /*!< _node_ has been added (it may be null) */
+         bool pending = false; /*!< requests for _node_ are waiting in _env_ */
+      };
+      mutable Translation translation;
+
+      Node() {}
+      Node(const Node&) {}
+      Node& operator=(const Node&) { return *this; }
+
    private:
       virtual void dummy() const {}
    };
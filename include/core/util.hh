@@ -140,5 +140,8 @@ namespace MachO {
          return fits_in_bits((typename std::make_unsigned<T>::type) val, bits - 1);
       }
    }
+
+   /** _s_ as a quoted JSON string. */
+   std::string json_string(const std::string& s);
    
 }
@@ -6,6 +6,7 @@
 
 #include "macho-tool.h"
 #include "core/types.hh"
+#include "core/stats.hh"
 
 struct Command {
    const char *name;
@@ -19,6 +20,11 @@ struct Command {
    virtual std::vector<option> longopts() const = 0;
    virtual int opthandler(int optchar) = 0;
    virtual void arghandler(int argc, char *argv[]) = 0;
+
+   /* options shared by a kind of command; their values start at COMMON_OPT */
+   static constexpr int COMMON_OPT = 0x1000;
+   virtual std::vector<option> common_longopts() const { return {}; }
+   virtual int common_opthandler(int optchar) { abort(); }
    virtual int work() = 0;
    virtual int handle(int argc, char *argv[]);
    
@@ -58,11 +64,23 @@ struct InplaceCommand: public Command {
 };
 
 struct InOutCommand: Command {
+   static constexpr int STATS = COMMON_OPT;
+   enum class StatsFormat {NONE, TEXT, JSON};
+
    const char *in_path = nullptr, *out_path = nullptr;
    std::unique_ptr<MachO::Image> in_img, out_img;
+   StatsFormat stats_format = StatsFormat::NONE;
+   std::unique_ptr<MachO::Stats> stats; /*!< printed to stderr after the command's work */
    
-   virtual std::string subusage() const override { return "<inpath> [<outpath>='a.out']"; }
+   virtual std::string subusage() const override {
+      return "[--stats[=text|json]] <inpath> [<outpath>='a.out']";
+   }
    virtual void arghandler(int argc, char *argv[]) override;
+   virtual std::vector<option> common_longopts() const override {
+      return {{"stats", optional_argument, nullptr, STATS}};
+   }
+   virtual int common_opthandler(int optchar) override;
+   virtual int handle(int argc, char *argv[]) override;
    InOutCommand(const char *name): Command(name) {}
 };
 
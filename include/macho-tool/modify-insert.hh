@@ -1,6 +1,7 @@
 #pragma once
 
 #include <optional>
+#include <vector>
 
 #include "modify.hh"
 
@@ -21,14 +22,19 @@ struct ModifyCommand::Insert::Instruction: Operation {
    MachO::Location loc;
    MachO::Relation relation = MachO::Relation::BEFORE;
    std::optional<unsigned long> bytes;
+   std::vector<char> data; /*!< instruction bytes; read from stdin unless given with `hex' */
 
    virtual std::vector<char *> keylist() const override {
-      return {"vmaddr", "offset", "before", "after", "bytes", nullptr};
+      return {"vmaddr", "offset", "before", "after", "bytes", "hex", nullptr};
    }
    virtual int subopthandler(int index, char *value) override;
    virtual void operator()(MachO::MachO *macho) override;
    template <MachO::Bits b> void workT(MachO::Archive<b> *archive);
    virtual void validate() const override;
+
+   /** Read the instruction bytes from stdin if they weren't given with `hex'. */
+   void read();
+   template <MachO::Bits b> MachO::Insertion<b> insertion() const;
 };
 
 struct ModifyCommand::Insert::LoadDylib: Operation {
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <optional>
+#include <unordered_set>
 
 #include "modify.hh"
 
@@ -8,11 +9,15 @@ struct ModifyCommand::Update: Subcommand {
    struct LoadDylib;
    struct BindNode;
    struct StripBind; 
+   struct RenameBind;
+   struct Rebind;
 
    virtual std::vector<char *> keylist() const override {
       return {"load_dylib", "load-dylib",
               "bind",
               "strip-bind",
+              "rename-bind",
+              "rebind",
               nullptr};
    }
 
@@ -63,14 +68,48 @@ struct ModifyCommand::Update::BindNode: Operation {
 
 struct ModifyCommand::Update::StripBind: Operation {
    std::list<std::string> suffixes;
+   std::optional<std::string> prefix; /*!< only strip symbols with this prefix */
    
    virtual std::vector<char *> keylist() const override {
-      return {"suffix", nullptr};
+      return {"suffix", "prefix", nullptr};
    }
    virtual int subopthandler(int index, char *value) override;
    virtual void validate() const override {}
    virtual void operator()(MachO::MachO *macho) override;
    template <MachO::Bits b> void workT(MachO::Archive<b> *archive);
    template <MachO::Bits b, bool lazy> void workT(MachO::BindInfo<b, lazy> *bind_info);
-   void strip(std::string& s) const;
+   std::optional<std::string> strip(const std::string& s) const;
+};
+
+/* Replace a trailing symbol suffix in all bind nodes. */
+struct ModifyCommand::Update::RenameBind: Operation {
+   std::optional<std::string> suffix;
+   std::string replacement;
+   std::optional<bool> lazy; /*!< restrict to lazy or non-lazy bind info */
+
+   virtual std::vector<char *> keylist() const override {
+      return {"suffix", "replace", "lazy", "nonlazy", nullptr};
+   }
+   virtual int subopthandler(int index, char *value) override;
+   virtual void validate() const override;
+   virtual void operator()(MachO::MachO *macho) override;
+   template <MachO::Bits b> void workT(MachO::Archive<b> *archive);
+   template <MachO::Bits b, bool l> void workT(MachO::BindInfo<b, l> *bind_info);
+};
+
+/* Rebind a set of symbols to another dylib in one pass. */
+struct ModifyCommand::Update::Rebind: Operation {
+   std::unordered_set<std::string> syms;
+   std::optional<unsigned> new_dylib_ord;
+   std::string prefix; /*!< prepended to each rebound symbol */
+   bool lazy = false;
+
+   virtual std::vector<char *> keylist() const override {
+      return {"sym", "syms", "new_dylib", "new-dylib", "prefix", "lazy", nullptr};
+   }
+   virtual int subopthandler(int index, char *value) override;
+   virtual void validate() const override;
+   virtual void operator()(MachO::MachO *macho) override;
+   template <MachO::Bits b, bool l> void workT(MachO::Archive<b> *archive);
+   void read_syms(const char *path);
 };
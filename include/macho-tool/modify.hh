@@ -11,21 +11,35 @@ struct ModifyCommand: public InOutCommand {
    struct Start;
    struct Update;
 
-   virtual const char *optstring() const override { return "hi:d:s:"; }
+   virtual const char *optstring() const override { return "hi:d:s:u:f:"; }
    virtual std::vector<option> longopts() const override {
       return {{"help", no_argument, nullptr, 'h'},
               {"insert", required_argument, nullptr, 'i'},
               {"delete", required_argument, nullptr, 'd'},
               {"start", required_argument, nullptr, 's'},
               {"update", required_argument, nullptr, 'u'},
+              {"script", required_argument, nullptr, 'f'},
               {0}};
    }
    virtual int opthandler(int optchar) override;
 
    std::list<std::unique_ptr<Functor>> operations;
 
+   /**
+    * Add an operation as if it had been given with option _optchar_.
+    * @return status of parsing _arg_ (see Command::opthandler)
+    */
+   int add_operation(int optchar, char *arg);
+
+   /**
+    * Read operations from an edit script (`-' for stdin), one per line, each an option name
+    * followed by its argument, e.g. `insert inst,vmaddr=0x1f00,hex=90'. Blank lines and lines
+    * starting with `#' are ignored.
+    */
+   void read_script(const char *path);
+
    virtual std::string optusage() const override {
-      return "[-h | -i (vmaddr=<vmaddr>|offset=<offset>),bytes=<count>,[before|after] | -d (vmaddr=<vmaddr>|offset=<offset>) | -s <vmaddr>]";
+      return "[-h | -i (vmaddr=<vmaddr>|offset=<offset>),(bytes=<count>|hex=<bytes>),[before|after] | -d (vmaddr=<vmaddr>|offset=<offset>) | -s <vmaddr> | -f <script>]";
    }
 
    virtual int work() override;
@@ -1,12 +1,15 @@
 #pragma once
 
-#include <unordered_set>
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
 extern "C" {
 #include <xed/xed-interface.h>
 }
 #include "command.hh"
 #include "core/segment.hh"
 #include "core/section.hh"
+#include "core/cfg.hh"
 
 struct Rebasify: InOutCommand {
    struct state_info {
@@ -17,20 +20,29 @@ struct Rebasify: InOutCommand {
        */
       int state;
       std::size_t vmaddr;
-      using LiveRegs = std::unordered_set<xed_reg_enum_t>;
+      using LiveRegs = uint32_t; /*!< mask of 32-bit GPRs holding the thunk base (see gpr_mask()) */
       LiveRegs live_regs;
       std::optional<int> frame_index;
 
       MachO::Archive<MachO::Bits::M32> *archive = nullptr;
       MachO::Segment<MachO::Bits::M32> *segment = nullptr;
       MachO::Section<MachO::Bits::M32> *section = nullptr;
-      typename MachO::Section<MachO::Bits::M32>::Content::iterator text_it;
       
+      /* Mask bit of _reg_ if it is a 32-bit GPR, otherwise 0. */
+      static LiveRegs reg_bit(xed_reg_enum_t reg);
+      bool live(xed_reg_enum_t reg) const { return (live_regs & reg_bit(reg)) != 0; }
+      void set_live(xed_reg_enum_t reg) { live_regs |= reg_bit(reg); }
+      void kill(xed_reg_enum_t reg) { live_regs &= ~reg_bit(reg); }
+
       void reset();
       state_info(MachO::Archive<MachO::Bits::M32> *archive);
-      state_info(const state_info& other, const MachO::SectionBlob<MachO::Bits::M32> *target);
+
+      /* Combine with the state along another incoming edge. A PIC register survives only if it
+       * holds the same thunk base on both edges. */
+      void meet(const state_info& other);
 
       bool operator==(const state_info& other) const;
+      bool operator!=(const state_info& other) const { return !(*this == other); }
    };
 
    struct decode_info {
@@ -59,9 +71,17 @@ struct Rebasify: InOutCommand {
    virtual int work() override;
    Rebasify(): InOutCommand("rebasify") {}
 
+   using Iters = std::unordered_map<const MachO::SectionBlob<MachO::Bits::M32> *,
+                                    MachO::Section<MachO::Bits::M32>::Content::iterator>;
+
    void handle_insts(MachO::Archive<MachO::Bits::M32> *archive) const;
+   /* Run the dataflow over one function's graph, then rewrite it. _iters_ locates each
+    * instruction of __text in the section's content. */
+   void handle_function(MachO::Archive<MachO::Bits::M32> *archive,
+                        MachO::CFG<MachO::Bits::M32>& cfg, const Iters& iters) const;
+   /* _apply_ selects whether to rewrite PIC references (final pass) or only update _state_. */
    int handle_inst(MachO::Instruction<MachO::Bits::M32> *inst, state_info& state,
-                   const decode_info& info) const;
+                   const decode_info& info, bool apply) const;
    int handle_inst_thunk(MachO::Instruction<MachO::Bits::M32> *inst, state_info& state,
-                         const decode_info& info) const;
+                         const decode_info& info, bool apply) const;
 };
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "command.hh"
+
+struct ReorderCommand: InOutCommand {
+   const char *profile_path = nullptr;
+   bool verbose = false;
+
+   virtual const char *optstring() const override { return "hp:v"; }
+   virtual std::vector<option> longopts() const override {
+      return {{"help", no_argument, nullptr, 'h'},
+              {"profile", required_argument, nullptr, 'p'},
+              {"verbose", no_argument, nullptr, 'v'},
+              {0}};
+   }
+   virtual int opthandler(int optchar) override;
+   virtual std::string optusage() const override { return "[-h | -v] -p <profile>"; }
+
+   template <MachO::Bits bits> int workT(MachO::MachO *macho);
+   virtual int work() override;
+
+   ReorderCommand(): InOutCommand("reorder") {}
+};
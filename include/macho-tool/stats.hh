@@ -0,0 +1,21 @@
+#pragma once
+
+#include "command.hh"
+
+struct StatsCommand: InplaceCommand {
+   bool json = false;
+
+   virtual const char *optstring() const override { return "hj"; }
+   virtual std::vector<option> longopts() const override {
+      return {{"help", no_argument, nullptr, 'h'},
+              {"json", no_argument, nullptr, 'j'},
+              {0}};
+   }
+   virtual int opthandler(int optchar) override;
+
+   virtual std::string optusage() const override { return "[-h] [-j]"; }
+
+   virtual int work() override;
+
+   StatsCommand();
+};
@@ -1,20 +1,47 @@
 #pragma once
 
 #include <optional>
+#include <string>
+#include <vector>
 
 #include "command.hh"
+#include "core/align.hh"
 
 struct TransformCommand: InOutCommand {
    std::optional<MachO::Bits> bits;
+   bool direct_stub_calls = false;
+   bool abi_flags = true; /*!< assume flags are dead across calls and returns */
+   bool abi_regs = true;  /*!< assume caller-saved scratch registers are dead after returns */
+   bool peephole = false;
+   bool rsb_calls = false; /*!< keep real call/ret pairs for return prediction */
+   bool printf_plans = false;
+   bool dead_strip = false;
+   std::vector<std::string> keep_symbols; /*!< additional dead stripping roots */
+   bool verbose = false;
+   unsigned jobs = 1; /*!< transform threads per section (0: hardware concurrency) */
+   MachO::CodeAlignment alignment;
 
-   virtual const char *optstring() const override { return "hm:"; }
+   virtual const char *optstring() const override { return "hm:dFGORpsk:vj:a:l:P:"; }
    virtual std::vector<option> longopts() const override {
       return {{"help", no_argument, nullptr, 'h'},
               {"bits", required_argument, nullptr, 'm'},
+              {"direct-calls", no_argument, nullptr, 'd'},
+              {"strict-flags", no_argument, nullptr, 'F'},
+              {"strict-regs", no_argument, nullptr, 'G'},
+              {"peephole", no_argument, nullptr, 'O'},
+              {"rsb-calls", no_argument, nullptr, 'R'},
+              {"printf-plans", no_argument, nullptr, 'p'},
+              {"dead-strip", no_argument, nullptr, 's'},
+              {"keep", required_argument, nullptr, 'k'},
+              {"verbose", no_argument, nullptr, 'v'},
+              {"jobs", required_argument, nullptr, 'j'},
+              {"align-functions", required_argument, nullptr, 'a'},
+              {"align-loops", required_argument, nullptr, 'l'},
+              {"max-padding", required_argument, nullptr, 'P'},
               {0}};
    }
    virtual int opthandler(int optchar) override;
-   virtual std::string optusage() const override { return "[-h | -m <bits>]"; }
+   virtual std::string optusage() const override { return "[-h | -m <bits> | -d | -F | -G | -O | -R | -p | -s | -k <symbol> | -v | -j <threads> | -a <bytes> | -l <bytes> | -P <bytes>]"; }
 
    template <MachO::Bits bits> int workT(MachO::MachO *macho);
    virtual int work() override;
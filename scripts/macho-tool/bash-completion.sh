@@ -5,12 +5,14 @@ _macho_tool_completions_command() {
     ARG="${COMP_WORDS[${#COMP_WORDS[@]}-1]}"
     
     cmd_help=""
-    cmd_noop="--help"
-    cmd_modify="--help --insert --delete --start"
+    cmd_noop="--help --stats"
+    cmd_modify="--help --insert --delete --start --update --script --stats"
     cmd_translate="--help --offset"
     cmd_tweak="--help --flags"
-    cmd_convert="--help --archive"
-    cmd_transform="--help --bits"
+    cmd_convert="--help --archive --stats"
+    cmd_transform="--help --bits --direct-calls --strict-flags --strict-regs --peephole --rsb-calls --printf-plans --dead-strip --keep --verbose --jobs --align-functions --align-loops --max-padding --stats"
+    cmd_stats="--help --json"
+    cmd_reorder="--help --profile --verbose --stats"
 
     if [[ "$ARG" = -* ]]; then
         lookup=cmd_$COMMAND
@@ -24,7 +26,7 @@ _macho_tool_completions_command() {
         help)
             COMPREPLY=()
             ;;
-        noop|modify|translate|tweak|convert|transform)
+        noop|modify|translate|tweak|convert|transform|reorder|stats)
             COMPREPLY=("${files[@]}")
             ;;
     esac
@@ -36,7 +38,7 @@ _macho_tool_completions() {
     COMMAND="${COMP_WORDS[1]}"
 
     # check if in command list
-    CMDS="help noop modify translate tweak convert transform"
+    CMDS="help noop modify translate tweak convert transform reorder stats"
     for REF in $CMDS; do
         if [[ $REF = "$COMMAND" ]]; then
             _macho_tool_completions_command $COMMAND
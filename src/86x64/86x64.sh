@@ -83,7 +83,7 @@ v "$MACHO_TOOL" rebasify "$ARCHIVE32" "$REBASE32" || error
 # TRANSFORM64=$(mktemp)
 # trap "rm $TRANSFORM64" EXIT
 TRANSFORM64="${ARCHIVE64}_transform"
-v "$MACHO_TOOL" -- transform "$REBASE32" "$TRANSFORM64" || error
+v "$MACHO_TOOL" -- transform --direct-calls --peephole --rsb-calls --printf-plans "$REBASE32" "$TRANSFORM64" || error
 
 # link 64-bit archive with libabiconv.dylib
 # ABI64=$(mktemp)
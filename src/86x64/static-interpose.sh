@@ -48,16 +48,14 @@ if ! [ "$INPATH" ]; then
     echo "$0: missing positional argument input archive"; exit 1
 fi
 
-ARGS=""
-
 ORD=$(macho-tool translate --load-dylib "$DYLIB" "$INPATH")
 if [[ $? != 0 ]]; then
     exit 2
 fi
 
-while read SYM; do
-    ARGS=$(echo "$ARGS" --update bind,lazy,old_sym="$SYM",new_sym="$PREFIX$SYM",new_dylib="$ORD")
-done
-
-CMD=$(echo macho-tool modify "$ARGS" "$INPATH" "$OUTPATH")
-$CMD
+# rebind all symbols in one pass; symbols are read from the arguments or stdin
+if [[ $# -gt 0 ]]; then
+    printf "%s\n" "$@"
+else
+    cat
+fi | macho-tool modify --update rebind,lazy,syms=-,prefix="$PREFIX",new_dylib="$ORD" "$INPATH" "$OUTPATH"
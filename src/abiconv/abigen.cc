@@ -36,6 +36,8 @@ struct ABIConversion {
    using Regs = std::list<const reg_group *>;
    Regs regs;
 
+   size_t data_size = 0; /*!< bytes of converted argument data the thunk reserves on the stack */
+
    virtual void emit_call(std::ostream& os) const = 0;
 
    ABIConversion(CXCursor function_decl, const Regs& regs):
@@ -99,34 +101,6 @@ struct ABIConversion {
       return align_up<size_t>(size, 16);
    }
 
-   size_t stack_data_size() const {
-      size_t size = 0;
-
-      for (unsigned argi = 0; argi < argc(); ++argi) {
-         CXType argtype = clang_getCanonicalType(clang_getArgType(function_type, argi));
-
-         std::optional<CXType> size_type;
-         switch (argtype.kind) {
-         case CXType_Pointer:
-            size_type = clang_getPointeeType(argtype);
-            break;
-         case CXType_ConstantArray:
-            size_type = argtype;
-            break;
-         default:
-            break;
-         }
-
-         if (size_type) {
-            align_up(size, alignof_type(*size_type, arch::x86_64));
-            size += sizeof_type(*size_type, arch::x86_64);
-         }
-      }
-
-      return align_up<size_t>(size, 16);
-   }
-
-
 #if 0
    void emit_function_call(std::ostream& os, Symbols& symbols, const Symbols& ignore_structs) {
       const std::list<const reg_group *> regs {&rdi, &rsi, &rdx, &rcx, &r8, &r9};
@@ -148,17 +122,109 @@ struct ABIConversion {
    }
 #endif
 
-   void emit(std::ostream& os, Symbols& symbols, const Symbols& ignore_structs) {
+   /* pointee types whose layout is identical on i386 and x86_64 */
+   static bool same_layout_pointee(CXType pointee, const Symbols& ignore_structs) {
+      pointee = clang_getCanonicalType(pointee);
+      switch (pointee.kind) {
+      case CXType_Void:
+      case CXType_Bool:
+      case CXType_Char_U:
+      case CXType_UChar:
+      case CXType_Char_S:
+      case CXType_SChar:
+      case CXType_UShort:
+      case CXType_Short:
+      case CXType_UInt:
+      case CXType_Int:
+      case CXType_Enum:
+      case CXType_ULongLong:
+      case CXType_LongLong:
+      case CXType_Float:
+      case CXType_Double:
+         return true;
+      case CXType_Record:
+         return ignore_structs.find(to_string(pointee)) != ignore_structs.end();
+      default:
+         return false;
+      }
+   }
+
+   /**
+    * Whether this signature can be converted without touching memory: every argument is an
+    * integer or a pointer to data with the same layout on both architectures, all arguments fit
+    * in registers, and the return value fits in %eax.
+    * @param ignore_structs structs whose pointers are passed through unconverted
+    */
+   bool trivial(const Symbols& ignore_structs) const {
+      if (argc() > regs.size()) {
+         return false;
+      }
+
+      for (unsigned argi = 0; argi < argc(); ++argi) {
+         const CXType type = handle_type(clang_getArgType(function_type, argi));
+         switch (type.kind) {
+         case CXType_Bool:
+         case CXType_Char_U:
+         case CXType_UChar:
+         case CXType_Char_S:
+         case CXType_SChar:
+         case CXType_UShort:
+         case CXType_Short:
+         case CXType_UInt:
+         case CXType_Int:
+         case CXType_Enum:
+         case CXType_ULong:
+         case CXType_Long:
+         case CXType_ULongLong:
+         case CXType_LongLong:
+            break;
+         case CXType_Pointer:
+            if (!same_layout_pointee(clang_getPointeeType(type), ignore_structs)) {
+               return false;
+            }
+            break;
+         default:
+            return false;
+         }
+      }
+
+      const CXType ret = handle_type(clang_getResultType(function_type));
+      switch (ret.kind) {
+      case CXType_Void:
+      case CXType_Pointer:
+      case CXType_Bool:
+      case CXType_Char_U:
+      case CXType_UChar:
+      case CXType_Char_S:
+      case CXType_SChar:
+      case CXType_UShort:
+      case CXType_Short:
+      case CXType_UInt:
+      case CXType_Int:
+      case CXType_Enum:
+      case CXType_ULong:
+      case CXType_Long:
+         return true;
+      default:
+         return false;
+      }
+   }
+
+   /**
+    * Emit a thunk for the symbol.
+    * @return whether the thunk took the direct (trivially-convertible) path
+    */
+   bool emit(std::ostream& os, Symbols& symbols, const Symbols& ignore_structs) {
       const bool variadic = clang_isFunctionTypeVariadic(function_type);
       const std::string& override_prefix = "__";
 
       if (variadic) {
          /* skip variadic functions */
-         return;
+         return false;
       }
       
       if (symbols.find(sym) == symbols.end()) {
-         return;
+         return false;
       }
       symbols.erase(sym);
       
@@ -188,7 +254,47 @@ struct ABIConversion {
       /* align stack */
       emit_inst(os, "and", "rsp", "~0xf");
 
-      /* make space on stack */
+      const bool direct = trivial(ignore_structs);
+      if (direct) {
+         emit_direct(os, ignore_structs);
+      } else {
+         emit_generic(os, ignore_structs);
+      }
+
+      emit_inst(os, "lea", "rsp", "[rbp - 0x10]");
+      
+      /* cleanup */
+      emit_inst(os, "pop", "rsi");
+      emit_inst(os, "pop", "rdi");
+      emit_inst(os, "leave");
+
+      /* return */
+      emit_inst(os, "mov", "r11d", "dword [rsp]");
+      emit_inst(os, "add", "rsp", "4");
+      emit_inst(os, "jmp", "r11");
+
+      return direct;
+   }
+
+   /* Load each argument straight from the i386 stack into its argument register and call.
+    * Pointers are zero-extended in place; the pointee is shared rather than copied.
+    */
+   void emit_direct(std::ostream& os, const Symbols& ignore_structs) {
+      unsigned label = 0;
+      conversion to_conv(false, arch::i386, arch::x86_64, {rsp, 0}, label, ignore_structs);
+      auto reg_it = regs.begin();
+      MemoryLocation load_loc(rbp, 12);
+
+      for (unsigned argi = 0; argi < argc(); ++argi) {
+         const CXType type = handle_type(clang_getArgType(function_type, argi));
+         to_conv.convert_int(os, type.kind, load_loc, RegisterLocation(**reg_it++));
+         load_loc += align_up<size_t>(sizeof_type(type.kind, arch::i386), 4);
+      }
+
+      emit_call(os);
+   }
+
+   void emit_generic(std::ostream& os, const Symbols& ignore_structs) {
       MemoryLocation stack_args(rsp, 0);
       // MemoryLocation stack_data(rsp, stack_args_size());
       unsigned label = 0;
@@ -197,8 +303,6 @@ struct ABIConversion {
       conversion from_conv(false, arch::x86_64, arch::i386,
                            {rsp, static_cast<int>(stack_args_size())}, label, ignore_structs);
       
-      emit_inst(os, "sub", "rsp", stack_data_size() + stack_args_size());
-      
       /* transfer arguments */
       param_info info(regs.begin(), regs.end(), 8);
       int param_it;
@@ -255,6 +359,11 @@ struct ABIConversion {
 
       }
 
+      /* make space on stack: the converted data area is sized by what the conversion actually
+       * laid out, including data behind pointers nested in structs and arrays */
+      data_size = align_up<size_t>(to_conv.data.index - stack_args_size(), 16);
+      emit_inst(os, "sub", "rsp", data_size + stack_args_size());
+
       /* convert from i386 to x86_64 */
       os << to_ss.str();
       
@@ -264,19 +373,7 @@ struct ABIConversion {
       /* convert from x86_64 to i386 */
       os << from_ss.str();
 
-      // emit_inst(os, "add", "rsp", stack_data_size() + stack_args_size());
-      emit_inst(os, "lea", "rsp", "[rbp - 0x10]");
-      
-      /* cleanup */
-      emit_inst(os, "pop", "rsi");
-      emit_inst(os, "pop", "rdi");
-      emit_inst(os, "leave");
-
-      /* return */
-      emit_inst(os, "mov", "r11d", "dword [rsp]");
-      emit_inst(os, "add", "rsp", "4");
-      emit_inst(os, "jmp", "r11");
-      
+      // emit_inst(os, "add", "rsp", data_size + stack_args_size());
    }
    
 };
@@ -308,6 +405,10 @@ struct ABIGenerator {
    Symbols ignore_structs;
    enum class ABI {FUNCTION, SYSCALL} abi;
    bool force_all;
+   unsigned thunks = 0;        /*!< number of thunks emitted */
+   unsigned direct_thunks = 0; /*!< number of thunks that took the direct path */
+   size_t max_data_size = 0;   /*!< largest converted argument data area of any thunk */
+   std::string max_data_sym;
 
    ABIGenerator(std::ostream& os, ABI abi): os(os), abi(abi) {}
 
@@ -320,6 +421,15 @@ struct ABIGenerator {
       os << "\textern __dyld_stub_binder_flag" << std::endl;
    }
 
+   /* Export the stack high-water mark of converted argument data so that threads with small
+    * stacks (e.g. created with a custom pthread stack size) can be checked against it. */
+   void emit_footer() {
+      os << "\tsegment .data" << std::endl;
+      os << "\tglobal __abiconv_arg_data_max" << std::endl;
+      os << "__abiconv_arg_data_max:" << std::endl;
+      emit_inst(os, "dq", max_data_size);
+   }
+
    void handle_file(const std::string& path) {
       CXTranslationUnit unit = clang_parseTranslationUnit(index, path.c_str(), nullptr, 0, nullptr,
                                                           0, CXTranslationUnit_None);
@@ -356,7 +466,7 @@ struct ABIGenerator {
       }
 
       std::unique_ptr<ABIConversion> conv(make_conv(c));
-      conv->emit(os, symbols, ignore_structs);
+      emit_conv(*conv);
    }
 
    void handle_asm_label_attr(CXCursor c, CXCursor p) {
@@ -365,7 +475,29 @@ struct ABIGenerator {
          return; /* this is something else */
       }
       std::unique_ptr<ABIConversion> conv(make_conv(clang_getCursorType(p), sym));
-      conv->emit(os, symbols, ignore_structs);
+      emit_conv(*conv);
+   }
+
+   void emit_conv(ABIConversion& conv) {
+      const std::size_t nsyms = symbols.size();
+      const bool direct = conv.emit(os, symbols, ignore_structs);
+      if (symbols.size() != nsyms) {
+         ++thunks;
+         direct_thunks += direct;
+         if (conv.data_size > max_data_size) {
+            max_data_size = conv.data_size;
+            max_data_sym = conv.sym;
+         }
+      }
+   }
+
+   void report(std::ostream& os) const {
+      os << "abigen: " << direct_thunks << "/" << thunks << " thunks took the direct path"
+         << std::endl;
+      if (max_data_size > 0) {
+         os << "abigen: largest converted argument data: " << max_data_size << " bytes ("
+            << max_data_sym << ")" << std::endl;
+      }
    }
 
    template <typename... Args>
@@ -415,7 +547,8 @@ int main(int argc, char *argv[]) {
                       "  -s <symfile>    file containing symbols to consider\n" \
                       "  -i <ignorefile> file containing symbols to ignore\n" \
                       "  -r <structfile> file containing struct names to not convert\n" \
-                      "  -c              use system call ABI"           \
+                      "  -c              use system call ABI\n"         \
+                      "  -v              report how many thunks took the direct path\n" \
                       "";
                    fprintf(f, usage, argv[0]);
                 };
@@ -424,14 +557,16 @@ int main(int argc, char *argv[]) {
    const char *sympath = nullptr;
    const char *symignorepath = nullptr;
    const char *structpath = nullptr;
+   bool verbose = false;
    ABIGenerator::ABI abi = ABIGenerator::ABI::FUNCTION;
-   const char *optstring = "ho:s:i:r:";
+   const char *optstring = "ho:s:i:r:v";
    const struct option longopts[] = {{"help", no_argument, nullptr, 'h'},
                                      {"output", required_argument, nullptr, 'o'},
                                      {"symfile", required_argument, nullptr, 's'},
                                      {"ignorefile", required_argument, nullptr, 'i'},
                                      {"structfile", required_argument, nullptr, 'r'},
                                      {"syscall", required_argument, nullptr, 'c'},
+                                     {"verbose", no_argument, nullptr, 'v'},
                                      {0}
    };
    
@@ -456,6 +591,9 @@ int main(int argc, char *argv[]) {
       case 'c':
          abi = ABIGenerator::ABI::SYSCALL;
          break;
+      case 'v':
+         verbose = true;
+         break;
       case '?':
          usage(stderr);
          return 1;
@@ -491,5 +629,11 @@ int main(int argc, char *argv[]) {
       abigen.handle_file(argv[i]);
    }
 
+   abigen.emit_footer();
+
+   if (verbose) {
+      abigen.report(std::cerr);
+   }
+
    return 0;
 }
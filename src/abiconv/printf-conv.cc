@@ -1,10 +1,11 @@
+#include <algorithm>
 #include <cstdint>
 #include <cstdlib>
 #include <stdexcept>
-#include <list>
-#include <string>
-#include <optional>
-#include <unordered_map>
+#include <mach-o/dyld.h>
+#include <mach-o/getsect.h>
+
+#include "printf-plan.hh"
 
 typedef uint32_t ptr32_t;
 typedef uint64_t ptr64_t;
@@ -76,151 +77,82 @@ namespace {
       convert_arg<T32, T64>(args32, args64, argtypes, arg_count);
    }
 
-   static bool printf_is_length_modifier(char c) {
-      switch (c) {
-      case 'h':
-      case 'l':
-      case 'j':
-      case 't':
-      case 'z':
-         return true;
-      default:
-         return false;
-      }
-   }
-
-   enum class printf_type {SIGNED, UNSIGNED, STRING, FLOAT, CHAR, POINTER, ESCAPE};
-   printf_type printf_parse_type(const char *& format) {
-      const std::list<std::pair<std::string, printf_type>> conv =
-         {{"di", printf_type::SIGNED},
-          {"ouxX", printf_type::UNSIGNED},
-          {"eEfFgGaA", printf_type::FLOAT},
-          {"c", printf_type::CHAR},
-          {"s", printf_type::STRING},
-          {"p", printf_type::POINTER},
-          {"%", printf_type::ESCAPE},
-         };
-      for (auto pair : conv) {
-         if (pair.first.find(*format) != std::string::npos) {
-            ++format;
-            return pair.second;
+   typedef void (*converter_t)(const void *&, void *&, reg_width_t *&, unsigned&);
+
+   /* indexed by printf_plan_op */
+   const converter_t plan_converters[] =
+      {convert_arg_s<i32_t, i64_t>,       // PRINTF_PLAN_INT
+       convert_arg_s<int8_t, int8_t>,     // PRINTF_PLAN_INT8
+       convert_arg_s<sc32_t, sc64_t>,     // PRINTF_PLAN_SCHAR
+       convert_arg_s<uint8_t, uint8_t>,   // PRINTF_PLAN_UCHAR
+       convert_arg_s<s32_t, s64_t>,       // PRINTF_PLAN_SHORT
+       convert_arg_s<uint16_t, uint16_t>, // PRINTF_PLAN_USHORT
+       convert_arg_s<l32_t, l64_t>,       // PRINTF_PLAN_LONG
+       convert_arg_s<uint32_t, uint64_t>, // PRINTF_PLAN_ULONG
+       convert_arg_s<ll32_t, ll64_t>,     // PRINTF_PLAN_LLONG
+       convert_arg_s<double, double>,     // PRINTF_PLAN_DOUBLE
+      };
+
+   /* Precompiled plans of the main executable, if macho-tool emitted any. */
+   struct printf_plan_table {
+      const uint8_t *base = nullptr;
+      const printf_plan_entry *entries = nullptr;
+      uint32_t count = 0;
+      intptr_t slide = 0;
+
+      printf_plan_table() {
+         unsigned long size;
+         const auto header = (const struct mach_header_64 *) _dyld_get_image_header(0);
+         base = getsectiondata(header, PRINTF_PLAN_SEGNAME, PRINTF_PLAN_SECTNAME, &size);
+         if (base == nullptr || size < sizeof(uint32_t)) {
+            base = nullptr;
+            return;
          }
+         count = * (const uint32_t *) base;
+         entries = (const printf_plan_entry *) (base + sizeof(uint32_t));
+         slide = _dyld_get_image_vmaddr_slide(0);
       }
 
-      throw std::invalid_argument("invalid conversion specifier");
-   }
-
-   enum class printf_modifier {H, HH, L, LL, J, T, Z};
-   std::optional<printf_modifier> printf_parse_modifier(const char *& format) {
-      const std::list<std::pair<const char *, printf_modifier>> conv =
-         {{"h", printf_modifier::H},
-          {"hh", printf_modifier::HH},
-          {"l", printf_modifier::L},
-          {"ll", printf_modifier::LL},
-          {"j", printf_modifier::J},
-          {"t", printf_modifier::T},
-          {"z", printf_modifier::Z},
-         };
-      for (auto pair : conv) {
-         auto len = strlen(pair.first);
-         if (strncmp(pair.first, format, len) == 0) {
-            format += len;
-            return pair.second;
+      const uint8_t *find(const char *format) const {
+         const uintptr_t vmaddr = (uintptr_t) format - slide;
+         const auto end = entries + count;
+         const auto it = std::lower_bound(entries, end, vmaddr,
+                                          [] (const printf_plan_entry& entry, uintptr_t vmaddr) {
+                                             return entry.format < vmaddr;
+                                          });
+         if (it == end || it->format != vmaddr) {
+            return nullptr;
          }
+         return base + it->plan;
       }
-      return std::nullopt;
-   }
-
-   void printf_parse_directive(const void *& args32, void *& args64, reg_width_t *& argtypes,
-                               const char *& format, unsigned& arg_count) {
-      /* parse flags */
-      switch (*format) {
-      case '#':
-      case '0':
-      case '-':
-      case ' ':
-      case '+':
-      case '\'':
-         ++format;
-         break;
-      }
-
-      /* parse minimum field width */
-      while (isdigit(*format)) {
-         ++format;
-      }
+   };
 
-      /* parse precision */
-      if (*format == '.') {
-         while (isdigit(*++format)) {}
+   void printf_run_plan(const void *& args32, void *& args64, reg_width_t *& argtypes,
+                        const uint8_t *ops, unsigned nops, unsigned& arg_count) {
+      for (unsigned i = 0; i < nops; ++i) {
+         plan_converters[ops[i]](args32, args64, argtypes, arg_count);
       }
-
-      /* parse length modifier */
-      std::optional<printf_modifier> modifier = printf_parse_modifier(format);
-      
-      /* parse format specifier */
-      const printf_type type = printf_parse_type(format);
-
-      /* do conversion */
-      const std::unordered_map<printf_type,
-                               std::unordered_map<std::optional<printf_modifier>,
-                                                  void (*)(const void*&, void*&, reg_width_t*&,
-                                                           unsigned&)
-                                                  >
-                               > converter
-         {{printf_type::SIGNED, {{std::nullopt, convert_arg_s<i32_t, i64_t>},
-                                 {printf_modifier::HH, convert_arg_s<sc32_t, sc64_t>},
-                                 {printf_modifier::H, convert_arg_s<s32_t, s64_t>},
-                                 {printf_modifier::L, convert_arg_s<l32_t, l64_t>},
-                                 {printf_modifier::LL, convert_arg_s<ll32_t, ll64_t>},
-                                 {printf_modifier::J, convert_arg_s<j32_t, j64_t>},
-                                 {printf_modifier::T, convert_arg_s<t32_t, t64_t>},
-                                 {printf_modifier::Z, convert_arg_s<int8_t, int8_t>}
-               }
-           },
-          {printf_type::UNSIGNED, {{std::nullopt, convert_arg_s<i32_t, i64_t>},
-                                   {printf_modifier::HH, convert_arg_s<uint8_t, uint8_t>},
-                                   {printf_modifier::H, convert_arg_s<uint16_t, uint16_t>},
-                                   {printf_modifier::L, convert_arg_s<uint32_t, uint64_t>},
-                                   {printf_modifier::LL, convert_arg_s<uint64_t, uint64_t>},
-                                   {printf_modifier::J, convert_arg_s<uint64_t, uint64_t>},
-                                   {printf_modifier::T, convert_arg_s<uint32_t, uint64_t>},
-                                   {printf_modifier::Z, convert_arg_s<uint32_t, uint64_t>}
-             }
-          },
-          {printf_type::STRING, {{std::nullopt, convert_arg_s<uint32_t, uint64_t>}}},
-          {printf_type::FLOAT, {{std::nullopt, convert_arg_s<double, double>},
-                                {printf_modifier::L, convert_arg_s<double, double>}
-             }
-          },
-          {printf_type::CHAR, {{std::nullopt, convert_arg_s<int32_t, int32_t>}}},
-          {printf_type::POINTER, {{std::nullopt, convert_arg_s<uint32_t, uint64_t>}}},
-          {printf_type::ESCAPE, {{std::nullopt, nullptr}}}
-         };
-
-      converter.at(type).at(modifier)(args32, args64, argtypes, arg_count);
-
    }
    
 }
 
 extern "C" unsigned printf_conversion_f(const void *args32, void *args64, reg_width_t *argtypes) {
-   unsigned idx_64 = 0;
-   unsigned idx_32 = 0;
+   static const printf_plan_table plans;
    unsigned arg_count = 0;
 
    const char *format = (const char *) convert_arg<ptr32_t, ptr64_t>(args32, args64, argtypes,
                                                                      arg_count);
-   char c;
-   while ((c = *format++)) {
-      switch (c) {
-      case '%':
-         printf_parse_directive(args32, args64, argtypes, format, arg_count);
-         break;
-         
-      default:
-         break;
+
+   /* use precompiled plan for constant formats; compile others on the fly */
+   if (const uint8_t *plan = plans.find(format)) {
+      printf_run_plan(args32, args64, argtypes, plan + 1, plan[0], arg_count);
+   } else {
+      uint8_t ops[PRINTF_PLAN_MAX_OPS];
+      const int nops = printf_plan::compile(format, ops);
+      if (nops < 0) {
+         throw std::invalid_argument("invalid conversion specifier");
       }
+      printf_run_plan(args32, args64, argtypes, ops, nops, arg_count);
    }
    
    return arg_count;
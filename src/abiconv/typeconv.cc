@@ -221,12 +221,52 @@ void conversion::convert(std::ostream& os, CXType type, const Location& src, con
    }
 }
 
+void conversion::copy_block(std::ostream& os, MemoryLocation src, MemoryLocation dst,
+                            size_t size) {
+   os << "\t; copy " << size << " bytes" << std::endl;
+   
+   /* 16-byte chunks through %xmm0 */
+   if (size >= 16) {
+      src.push(); dst.push(); data.push();
+      src.push(); dst.push(); data.push();
+      emit_inst(os, "sub", "rsp", 16);
+      emit_inst(os, "movdqu", "[rsp]", "xmm0");
+      for (; size >= 16; size -= 16, src += 16, dst += 16) {
+         emit_inst(os, "movdqu", "xmm0", src.op());
+         emit_inst(os, "movdqu", dst.op(), "xmm0");
+      }
+      emit_inst(os, "movdqu", "xmm0", "[rsp]");
+      emit_inst(os, "add", "rsp", 16);
+      src.pop(); dst.pop(); data.pop();
+      src.pop(); dst.pop(); data.pop();
+   }
+
+   /* remaining 8-, 4-, 2- and 1-byte chunks through %rax */
+   if (size > 0) {
+      const RegisterLocation tmp_reg(rax);
+      push(os, tmp_reg, src, dst);
+      for (reg_width width : {reg_width::Q, reg_width::D, reg_width::W, reg_width::B}) {
+         const size_t width_size = reg_width_size(width);
+         for (; size >= width_size; size -= width_size, src += width_size, dst += width_size) {
+            emit_inst(os, "mov", tmp_reg.op(width), src.op(width));
+            emit_inst(os, "mov", dst.op(width), tmp_reg.op(width));
+         }
+      }
+      pop(os, tmp_reg, src, dst);
+   }
+}
+
 void conversion::convert_constant_array(std::ostream& os, CXType array, MemoryLocation src,
                                         MemoryLocation dst) {
    /* convert data */
    const long long arrlen = clang_getArraySize(array);
    assert(arrlen >= 1);
    const CXType elem = clang_getArrayElementType(array);
+
+   if (same_layout(elem)) {
+      copy_block(os, src, dst, sizeof_type(array, from_arch));
+      return;
+   }
    const std::string loop = label();
    
    /*   push rcx
@@ -274,13 +314,43 @@ void conversion::convert_constant_array(std::ostream& os, CXType array, MemoryLo
 
 void conversion::convert_record(std::ostream& os, CXType record, MemoryLocation src,
                                 MemoryLocation dst) {
+   if (same_layout(record)) {
+      copy_block(os, src, dst, sizeof_type(record, from_arch));
+      return;
+   }
+   
    record_decl decl(record);
    assert(decl.cursor.kind == CXCursor_StructDecl);
+
+   /* Fields with the same layout are coalesced into runs whose offsets differ by the same amount
+    * in both structs; each run is copied as a single block.
+    */
+   int run_src = 0;
+   int run_dst = 0;
+   size_t run_size = 0;
+   const auto flush_run = [&] () {
+      if (run_size > 0) {
+         copy_block(os, MemoryLocation(src.base, run_src), MemoryLocation(dst.base, run_dst),
+                    run_size);
+         run_size = 0;
+      }
+   };
+   
    for (CXType field_type : decl.field_types) {
       src.align_field(field_type, from_arch);
       dst.align_field(field_type, to_arch);
-      
-      convert(os, field_type, src, dst);
+
+      if (same_layout(field_type)) {
+         if (run_size == 0 || src.index - run_src != dst.index - run_dst) {
+            flush_run();
+            run_src = src.index;
+            run_dst = dst.index;
+         }
+         run_size = src.index - run_src + sizeof_type(field_type, from_arch);
+      } else {
+         flush_run();
+         convert(os, field_type, src, dst);
+      }
 
 #if 0
       std::cerr << to_string(record) << "," << to_string(field_type) << "," << src.index
@@ -291,6 +361,8 @@ void conversion::convert_record(std::ostream& os, CXType record, MemoryLocation
       src += sizeof_type(field_type, from_arch);
       dst += sizeof_type(field_type, to_arch);
    }
+
+   flush_run();
 }
 
 void conversion::convert_pointer(std::ostream& os, CXType pointee, const Location& src_,
@@ -499,9 +571,9 @@ static size_t sizeof_struct(CXType type, arch a) {
    for (CXType field_type : decl.field_types) {
       const size_t field_size = sizeof_type(field_type, a);
       if (!decl.packed) {
-         const size_t field_align = alignof_type(field_type, a);
-         size = align_up(size, field_align) + field_size;
+         size = align_up(size, alignof_type(field_type, a));
       }
+      size += field_size;
    }
 
    if (!decl.packed) {
@@ -550,3 +622,64 @@ size_t alignof_type(CXType type, arch a) {
    }
 }
 
+
+/* LAYOUT */
+
+static bool same_layout_record(CXType type) {
+   if (sizeof_type(type, arch::i386) != sizeof_type(type, arch::x86_64)) {
+      return false;
+   }
+   
+   record_decl decl(type);
+   const bool is_union = clang_getCursorKind(decl.cursor) == CXCursor_UnionDecl;
+   MemoryLocation loc_i386(rsp);
+   MemoryLocation loc_x86_64(rsp);
+   for (CXType field_type : decl.field_types) {
+      if (!same_layout(field_type)) {
+         return false;
+      }
+      if (!decl.packed) {
+         loc_i386.align_field(field_type, arch::i386);
+         loc_x86_64.align_field(field_type, arch::x86_64);
+      }
+      if (loc_i386.index != loc_x86_64.index) {
+         return false;
+      }
+      if (!is_union) {
+         loc_i386 += sizeof_type(field_type, arch::i386);
+         loc_x86_64 += sizeof_type(field_type, arch::x86_64);
+      }
+   }
+
+   return true;
+}
+
+bool same_layout(CXType type) {
+   type = clang_getCanonicalType(type);
+   switch (type.kind) {
+   case CXType_Bool:
+   case CXType_UChar:
+   case CXType_Char_U:
+   case CXType_UShort:
+   case CXType_UInt:
+   case CXType_ULongLong:
+   case CXType_SChar:
+   case CXType_Char_S:
+   case CXType_Short:
+   case CXType_Int:
+   case CXType_LongLong:
+   case CXType_Enum:
+   case CXType_Float:
+   case CXType_Double:
+      return true;
+
+   case CXType_ConstantArray:
+      return same_layout(clang_getArrayElementType(type));
+
+   case CXType_Record:
+      return same_layout_record(type);
+      
+   default:
+      return false;
+   }
+}
@@ -0,0 +1,654 @@
+#include <cassert>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <vector>
+#include <fcntl.h>
+#include <mach-o/loader.h>
+#include <mach-o/nlist.h>
+
+#include "generator.hh"
+#include "core/image.hh"
+#include "core/util.hh"
+#include "core/leb.h"
+
+namespace Bench {
+
+   void InstructionMix::parse(const std::string& s) {
+      std::stringstream ss(s);
+      std::string token;
+      while (std::getline(ss, token, ',')) {
+         const auto eq = token.find('=');
+         if (eq == std::string::npos) {
+            throw std::string("instruction mix entry `") + token + "' is not <kind>=<weight>";
+         }
+         const std::string kind = token.substr(0, eq);
+         unsigned *weight;
+         if (kind == "alu") {
+            weight = &alu;
+         } else if (kind == "mem") {
+            weight = &mem;
+         } else if (kind == "branch") {
+            weight = &branch;
+         } else if (kind == "call") {
+            weight = &call;
+         } else if (kind == "pic") {
+            weight = &pic;
+         } else {
+            throw std::string("unknown instruction kind `") + kind + "'";
+         }
+         char *end;
+         *weight = std::strtoul(token.c_str() + eq + 1, &end, 0);
+         if (eq + 1 == token.size() || *end != '\0') {
+            throw std::string("invalid weight in `") + token + "'";
+         }
+      }
+   }
+
+   void GeneratorOptions::validate() const {
+      if (functions == 0) {
+         throw std::string("need at least one function");
+      }
+      if (exports == 0 || exports > 255 || exports > functions) {
+         throw std::string("exports must be between 1 and min(255, functions)");
+      }
+      if (insts > 0 && mix.total() == 0) {
+         throw std::string("instruction mix has no nonzero weights");
+      }
+      if (rebase_density + bind_density > 100) {
+         throw std::string("rebase and bind densities add up to more than 100%");
+      }
+      if (bind_density > 0 && imports == 0) {
+         throw std::string("binds need at least one import");
+      }
+      if (islands > functions) {
+         throw std::string("at most one data-in-code island per function");
+      }
+      if (islands > 0 && (island_size == 0 || island_size > UINT16_MAX)) {
+         throw std::string("island size must be between 1 and 65535");
+      }
+   }
+
+   namespace {
+
+      using Bytes = std::vector<uint8_t>;
+
+      constexpr std::size_t PAGESIZE = 0x1000;
+      constexpr std::size_t TEXT_VMADDR = PAGESIZE; /* just past __PAGEZERO */
+      constexpr uint8_t SEGMENT_DATA = 2;           /* index of __DATA among the segments */
+      constexpr std::size_t TEXT_ALIGN = 4;         /* log2 */
+      constexpr std::size_t DATA_ALIGN = 2;
+      const char *DYLINKER = "/usr/lib/dyld";
+      const char *DYLIB = "/usr/lib/libSystem.B.dylib";
+
+      void put_uleb(Bytes& bytes, uintmax_t n) {
+         uint8_t buf[16];
+         const std::size_t count = uleb128_encode(buf, sizeof(buf), n);
+         bytes.insert(bytes.end(), buf, buf + count);
+      }
+
+      void put_string(Bytes& bytes, const std::string& s) {
+         bytes.insert(bytes.end(), s.begin(), s.end());
+         bytes.push_back('\0');
+      }
+
+      template <typename T>
+      void put_struct(Bytes& bytes, const T& t) {
+         const uint8_t *begin = reinterpret_cast<const uint8_t *>(&t);
+         bytes.insert(bytes.end(), begin, begin + sizeof(t));
+      }
+
+      void pad(Bytes& bytes, std::size_t alignment) {
+         bytes.resize(MachO::align_up(bytes.size(), alignment));
+      }
+
+      /* A 32-bit field in generated code that refers to an address known only after layout. */
+      struct Fixup {
+         enum class Kind {CALL, DATA, PIC} kind;
+         std::size_t offset; /*!< offset of the field in the function */
+         std::size_t target; /*!< function index for calls, otherwise offset into __data */
+         std::size_t base;   /*!< PIC: offset in the function of the address the thunk loads */
+      };
+
+      struct Function {
+         std::string name;
+         Bytes code;
+         std::vector<Fixup> fixups;
+         std::size_t insts = 0;
+         std::size_t offset;      /*!< file offset, which is also the offset from __TEXT */
+         std::size_t island = 0;  /*!< bytes of data following the function */
+      };
+
+      struct Slot {
+         std::size_t offset; /*!< offset into __data */
+         std::size_t import; /*!< bound slots only */
+      };
+
+      class Generator {
+      public:
+         Generator(const GeneratorOptions& opts): opts(opts), rng(opts.seed) {}
+
+         GeneratorResult run(const char *path);
+
+      private:
+         const GeneratorOptions& opts;
+         std::mt19937 rng;
+         std::vector<Function> functions;
+         std::vector<std::string> imports;
+         Bytes data;
+         std::vector<Slot> rebases;
+         std::vector<Slot> binds;
+         std::size_t text_offset;
+         std::size_t text_size;
+         std::size_t data_offset;
+         GeneratorResult result;
+
+         /* modulo rather than a distribution, so that output doesn't depend on the C++ library */
+         std::size_t random(std::size_t n) { return rng() % n; }
+         std::size_t random_data() { return random(opts.data_size / 4) * 4; }
+         std::size_t text_vmaddr(std::size_t offset) const { return TEXT_VMADDR + offset; }
+         std::size_t data_vmaddr() const { return TEXT_VMADDR + data_offset; }
+
+         void generate_function(Function& f);
+         void layout();
+         void patch(Function& f);
+         void generate_data();
+
+         Bytes rebase_info() const;
+         Bytes bind_info() const;
+         Bytes export_trie() const;
+         Bytes function_starts() const;
+         Bytes data_in_code() const;
+      };
+
+      void Generator::generate_function(Function& f) {
+         const auto emit = [&] (std::initializer_list<uint8_t> bytes) {
+            f.code.insert(f.code.end(), bytes);
+            ++f.insts;
+         };
+         const auto fixup = [&] (Fixup::Kind kind, std::size_t target, std::size_t base = 0) {
+            f.fixups.push_back({kind, f.code.size() - sizeof(uint32_t), target, base});
+         };
+
+         emit({0x55});             /* push ebp */
+         emit({0x89, 0xe5});       /* mov ebp, esp */
+         emit({0x83, 0xec, 0x10}); /* sub esp, 16 */
+
+         const std::size_t n = opts.insts == 0 ? 0 : opts.insts / 2 + random(opts.insts + 1);
+         const bool have_data = opts.data_size >= sizeof(uint32_t);
+         for (std::size_t i = 0; i < n; ++i) {
+            std::size_t pick = random(opts.mix.total());
+            enum {ALU, MEM, BRANCH, CALL, PIC} kind;
+            if (pick < opts.mix.alu) {
+               kind = ALU;
+            } else if ((pick -= opts.mix.alu) < opts.mix.mem) {
+               kind = MEM;
+            } else if ((pick -= opts.mix.mem) < opts.mix.branch) {
+               kind = BRANCH;
+            } else if ((pick -= opts.mix.branch) < opts.mix.call) {
+               kind = CALL;
+            } else {
+               kind = PIC;
+            }
+            if ((kind == MEM || kind == PIC) && !have_data) {
+               kind = ALU;
+            }
+
+            switch (kind) {
+            case ALU:
+               switch (random(6)) {
+               case 0: emit({0x01, 0xd8}); break;                   /* add eax, ebx */
+               case 1: emit({0x29, 0xc8}); break;                   /* sub eax, ecx */
+               case 2: emit({0x31, 0xd2}); break;                   /* xor edx, edx */
+               case 3: emit({0x89, 0xc1}); break;                   /* mov ecx, eax */
+               case 4: emit({0x83, 0xc0, (uint8_t) random(0x80)}); break; /* add eax, imm8 */
+               case 5: emit({0x0f, 0xaf, 0xc1}); break;             /* imul eax, ecx */
+               }
+               break;
+
+            case MEM:
+               switch (random(5)) {
+               case 0: emit({0x8b, 0x45, 0xf8}); break;             /* mov eax, [ebp-8] */
+               case 1: emit({0x89, 0x45, 0xfc}); break;             /* mov [ebp-4], eax */
+               case 2:                                              /* mov eax, [abs32] */
+                  emit({0xa1, 0, 0, 0, 0});
+                  fixup(Fixup::Kind::DATA, random_data());
+                  break;
+               case 3:                                              /* mov [abs32], eax */
+                  emit({0xa3, 0, 0, 0, 0});
+                  fixup(Fixup::Kind::DATA, random_data());
+                  break;
+               case 4:                                              /* mov eax, imm32 */
+                  emit({0xb8, 0, 0, 0, 0});
+                  fixup(Fixup::Kind::DATA, random_data());
+                  break;
+               }
+               break;
+
+            case BRANCH:
+               /* each branch skips the following xor eax, eax */
+               switch (random(3)) {
+               case 0: emit({0x75, 0x02}); break;                   /* jne rel8 */
+               case 1: emit({0x0f, 0x85, 0x02, 0, 0, 0}); break;    /* jne rel32 */
+               case 2: emit({0xeb, 0x02}); break;                   /* jmp rel8 */
+               }
+               emit({0x31, 0xc0});
+               break;
+
+            case CALL:
+               emit({0xe8, 0, 0, 0, 0});                            /* call rel32 */
+               fixup(Fixup::Kind::CALL, random(opts.functions));
+               break;
+
+            case PIC:
+               {
+                  emit({0xe8, 0, 0, 0, 0});                         /* call 0 */
+                  const std::size_t base = f.code.size();
+                  emit({0x58});                                     /* pop eax */
+                  emit({0x8b, 0x80, 0, 0, 0, 0});                   /* mov eax, [eax+disp32] */
+                  fixup(Fixup::Kind::PIC, random_data(), base);
+               }
+               break;
+            }
+         }
+
+         emit({0x89, 0xec});       /* mov esp, ebp */
+         emit({0x5d});             /* pop ebp */
+         emit({0xc3});             /* ret */
+      }
+
+      void Generator::layout() {
+         const std::size_t sizeofcmds =
+            4 * sizeof(segment_command) + 2 * sizeof(section) + sizeof(dyld_info_command) +
+            sizeof(symtab_command) + sizeof(dysymtab_command) +
+            MachO::align_up(sizeof(dylinker_command) + strlen(DYLINKER) + 1, sizeof(uint32_t)) +
+            sizeof(entry_point_command) +
+            MachO::align_up(sizeof(dylib_command) + strlen(DYLIB) + 1, sizeof(uint32_t)) +
+            2 * sizeof(linkedit_data_command);
+         text_offset = MachO::align_up(sizeof(mach_header) + sizeofcmds,
+                                       std::size_t(1) << TEXT_ALIGN);
+
+         /* spread the islands evenly over the functions */
+         for (std::size_t i = 0; i < opts.islands; ++i) {
+            functions[i * opts.functions / opts.islands].island = opts.island_size;
+         }
+
+         std::size_t offset = text_offset;
+         for (Function& f : functions) {
+            f.offset = offset;
+            offset += f.code.size() + f.island;
+         }
+         text_size = offset - text_offset;
+         data_offset = MachO::align_up(offset, PAGESIZE);
+      }
+
+      void Generator::patch(Function& f) {
+         for (const Fixup& fixup : f.fixups) {
+            const std::size_t field = text_vmaddr(f.offset + fixup.offset);
+            uint32_t value;
+            switch (fixup.kind) {
+            case Fixup::Kind::CALL:
+               value = text_vmaddr(functions[fixup.target].offset) - (field + sizeof(uint32_t));
+               break;
+            case Fixup::Kind::DATA:
+               value = data_vmaddr() + fixup.target;
+               break;
+            case Fixup::Kind::PIC:
+               value = data_vmaddr() + fixup.target - text_vmaddr(f.offset + fixup.base);
+               break;
+            }
+            memcpy(&f.code[fixup.offset], &value, sizeof(value));
+         }
+      }
+
+      void Generator::generate_data() {
+         data.resize(opts.data_size);
+         for (uint8_t& byte : data) {
+            byte = random(0x100);
+         }
+
+         for (std::size_t offset = 0; offset + sizeof(uint32_t) <= data.size();
+              offset += sizeof(uint32_t)) {
+            const std::size_t percent = random(100);
+            uint32_t value;
+            if (percent < opts.rebase_density) {
+               /* half the rebased pointers point at code, the rest into __data */
+               if (random(2)) {
+                  value = text_vmaddr(functions[random(functions.size())].offset);
+               } else {
+                  value = data_vmaddr() + random_data();
+               }
+               rebases.push_back({offset, 0});
+            } else if (percent < opts.rebase_density + opts.bind_density) {
+               value = 0;
+               binds.push_back({offset, random(imports.size())});
+            } else {
+               continue;
+            }
+            memcpy(&data[offset], &value, sizeof(value));
+         }
+      }
+
+      Bytes Generator::rebase_info() const {
+         Bytes bytes;
+         if (rebases.empty()) {
+            return bytes;
+         }
+         bytes.push_back(REBASE_OPCODE_SET_TYPE_IMM | REBASE_TYPE_POINTER);
+         for (const Slot& slot : rebases) {
+            bytes.push_back(REBASE_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | SEGMENT_DATA);
+            put_uleb(bytes, slot.offset);
+            bytes.push_back(REBASE_OPCODE_DO_REBASE_IMM_TIMES | 1);
+         }
+         bytes.push_back(REBASE_OPCODE_DONE);
+         pad(bytes, sizeof(uint32_t));
+         return bytes;
+      }
+
+      Bytes Generator::bind_info() const {
+         Bytes bytes;
+         if (binds.empty()) {
+            return bytes;
+         }
+         bytes.push_back(BIND_OPCODE_SET_DYLIB_ORDINAL_IMM | 1);
+         bytes.push_back(BIND_OPCODE_SET_TYPE_IMM | BIND_TYPE_POINTER);
+         for (const Slot& slot : binds) {
+            bytes.push_back(BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM);
+            put_string(bytes, imports[slot.import]);
+            bytes.push_back(BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | SEGMENT_DATA);
+            put_uleb(bytes, slot.offset);
+            bytes.push_back(BIND_OPCODE_DO_BIND);
+         }
+         bytes.push_back(BIND_OPCODE_DONE);
+         pad(bytes, sizeof(uint32_t));
+         return bytes;
+      }
+
+      Bytes Generator::export_trie() const {
+         /* a root with one edge per export, each to a terminal node; the names all have the same
+          * length or start differently, so no edge is a prefix of another */
+         std::vector<Bytes> leaves;
+         for (std::size_t i = 0; i < opts.exports; ++i) {
+            Bytes info;
+            put_uleb(info, 0); /* flags: EXPORT_SYMBOL_FLAGS_KIND_REGULAR */
+            put_uleb(info, functions[i].offset);
+            Bytes leaf;
+            put_uleb(leaf, info.size());
+            leaf.insert(leaf.end(), info.begin(), info.end());
+            leaf.push_back(0); /* no edges */
+            leaves.push_back(leaf);
+         }
+
+         /* edge offsets are ULEBs, so the root's size depends on where it puts the leaves */
+         Bytes root;
+         std::size_t root_size = 0;
+         for (;;) {
+            root.clear();
+            put_uleb(root, 0); /* not terminal */
+            root.push_back(leaves.size());
+            std::size_t offset = root_size;
+            for (std::size_t i = 0; i < leaves.size(); ++i) {
+               put_string(root, functions[i].name);
+               put_uleb(root, offset);
+               offset += leaves[i].size();
+            }
+            if (root.size() <= root_size) {
+               break;
+            }
+            root_size = root.size();
+         }
+         root.resize(root_size);
+
+         for (const Bytes& leaf : leaves) {
+            root.insert(root.end(), leaf.begin(), leaf.end());
+         }
+         pad(root, sizeof(uint32_t));
+         return root;
+      }
+
+      Bytes Generator::function_starts() const {
+         Bytes bytes;
+         std::size_t prev = 0; /* __TEXT's file offset */
+         for (const Function& f : functions) {
+            put_uleb(bytes, f.offset - prev);
+            prev = f.offset;
+         }
+         bytes.push_back(0);
+         pad(bytes, sizeof(uint32_t));
+         return bytes;
+      }
+
+      Bytes Generator::data_in_code() const {
+         Bytes bytes;
+         for (const Function& f : functions) {
+            if (f.island > 0) {
+               data_in_code_entry entry;
+               entry.offset = f.offset + f.code.size();
+               entry.length = f.island;
+               entry.kind = DICE_KIND_DATA;
+               put_struct(bytes, entry);
+            }
+         }
+         return bytes;
+      }
+
+      GeneratorResult Generator::run(const char *path) {
+         /* names of the same width, so that export trie edges never share a prefix */
+         const std::size_t width = std::to_string(std::max(opts.functions, opts.imports)).size();
+         const auto name = [&] (const char *prefix, std::size_t i) {
+            std::string s = std::to_string(i);
+            return prefix + std::string(width - s.size(), '0') + s;
+         };
+
+         functions.resize(opts.functions);
+         for (std::size_t i = 0; i < functions.size(); ++i) {
+            functions[i].name = i == 0 ? "_main" : name("_f", i);
+            generate_function(functions[i]);
+            result.insts += functions[i].insts;
+         }
+         for (std::size_t i = 0; i < opts.imports; ++i) {
+            imports.push_back(name("_ext", i));
+         }
+
+         layout();
+         for (Function& f : functions) {
+            patch(f);
+         }
+         generate_data();
+         result.rebases = rebases.size();
+         result.binds = binds.size();
+
+         const std::size_t data_filesize = MachO::align_up(data.size(), PAGESIZE);
+         const std::size_t linkedit_offset = data_offset + data_filesize;
+
+         /* __LINKEDIT, in the order Segment_LINKEDIT builds it */
+         Bytes linkedit;
+         const auto append = [&] (const Bytes& bytes) {
+            const std::size_t offset = linkedit_offset + linkedit.size();
+            linkedit.insert(linkedit.end(), bytes.begin(), bytes.end());
+            return bytes.empty() ? 0 : offset;
+         };
+
+         dyld_info_command dyld_info = {LC_DYLD_INFO_ONLY, sizeof(dyld_info_command)};
+         const Bytes rebase = rebase_info();
+         dyld_info.rebase_off = append(rebase);
+         dyld_info.rebase_size = rebase.size();
+         const Bytes bind = bind_info();
+         dyld_info.bind_off = append(bind);
+         dyld_info.bind_size = bind.size();
+         const Bytes exports = export_trie();
+         dyld_info.export_off = append(exports);
+         dyld_info.export_size = exports.size();
+
+         linkedit_data_command function_starts_cmd =
+            {LC_FUNCTION_STARTS, sizeof(linkedit_data_command)};
+         const Bytes starts = function_starts();
+         function_starts_cmd.dataoff = append(starts);
+         function_starts_cmd.datasize = starts.size();
+
+         linkedit_data_command data_in_code_cmd = {LC_DATA_IN_CODE, sizeof(linkedit_data_command)};
+         const Bytes dice = data_in_code();
+         data_in_code_cmd.dataoff = dice.empty() ? linkedit_offset + linkedit.size() : append(dice);
+         data_in_code_cmd.datasize = dice.size();
+
+         /* symbols: locals, then external definitions, then undefined */
+         Bytes strtab = {' ', '\0'};
+         std::vector<struct nlist> syms;
+         const auto add_sym = [&] (const std::string& name, uint8_t type, uint8_t sect,
+                                   int16_t desc, uint32_t value) {
+            struct nlist sym;
+            sym.n_un.n_strx = strtab.size();
+            sym.n_type = type;
+            sym.n_sect = sect;
+            sym.n_desc = desc;
+            sym.n_value = value;
+            syms.push_back(sym);
+            put_string(strtab, name);
+         };
+         for (std::size_t i = opts.exports; i < functions.size() && i - opts.exports < opts.symbols;
+              ++i) {
+            add_sym(functions[i].name, N_SECT, 1, 0, text_vmaddr(functions[i].offset));
+         }
+         const std::size_t nlocals = syms.size();
+         for (std::size_t i = 0; i < opts.exports; ++i) {
+            add_sym(functions[i].name, N_SECT | N_EXT, 1, 0, text_vmaddr(functions[i].offset));
+         }
+         int16_t undef_desc = REFERENCE_FLAG_UNDEFINED_NON_LAZY;
+         SET_LIBRARY_ORDINAL(undef_desc, 1);
+         for (const std::string& import : imports) {
+            add_sym(import, N_UNDF | N_EXT, NO_SECT, undef_desc, 0);
+         }
+         pad(strtab, sizeof(uint32_t));
+
+         symtab_command symtab = {LC_SYMTAB, sizeof(symtab_command)};
+         Bytes symbols;
+         for (const struct nlist& sym : syms) {
+            put_struct(symbols, sym);
+         }
+         symtab.symoff = append(symbols);
+         symtab.nsyms = syms.size();
+         symtab.stroff = append(strtab);
+         symtab.strsize = strtab.size();
+
+         dysymtab_command dysymtab = {LC_DYSYMTAB, sizeof(dysymtab_command)};
+         dysymtab.ilocalsym = 0;
+         dysymtab.nlocalsym = nlocals;
+         dysymtab.iextdefsym = nlocals;
+         dysymtab.nextdefsym = opts.exports;
+         dysymtab.iundefsym = nlocals + opts.exports;
+         dysymtab.nundefsym = imports.size();
+
+         /* load commands */
+         Bytes cmds;
+         uint32_t ncmds = 0;
+         const auto command = [&] (const auto& cmd) {
+            put_struct(cmds, cmd);
+            ++ncmds;
+         };
+         const auto segment = [&] (const char *name, std::size_t fileoff, std::size_t filesize,
+                                   std::size_t vmaddr, std::size_t vmsize, vm_prot_t prot,
+                                   uint32_t nsects) {
+            segment_command seg = {LC_SEGMENT};
+            seg.cmdsize = sizeof(segment_command) + nsects * sizeof(section);
+            strncpy(seg.segname, name, sizeof(seg.segname));
+            seg.vmaddr = vmaddr;
+            seg.vmsize = vmsize;
+            seg.fileoff = fileoff;
+            seg.filesize = filesize;
+            seg.maxprot = prot;
+            seg.initprot = prot;
+            seg.nsects = nsects;
+            command(seg);
+         };
+         const auto sect = [&] (const char *sectname, const char *segname, std::size_t offset,
+                                std::size_t size, uint32_t align) {
+            section s = {};
+            strncpy(s.sectname, sectname, sizeof(s.sectname));
+            strncpy(s.segname, segname, sizeof(s.segname));
+            s.addr = text_vmaddr(offset);
+            s.size = size;
+            s.offset = offset;
+            s.align = align;
+            if (strcmp(sectname, SECT_TEXT) == 0) {
+               s.flags = S_REGULAR | S_ATTR_PURE_INSTRUCTIONS | S_ATTR_SOME_INSTRUCTIONS;
+            }
+            put_struct(cmds, s);
+         };
+         const auto dylib_name = [&] (const char *name) {
+            Bytes bytes;
+            put_string(bytes, name);
+            pad(bytes, sizeof(uint32_t));
+            cmds.insert(cmds.end(), bytes.begin(), bytes.end());
+         };
+
+         segment(SEG_PAGEZERO, 0, 0, 0, TEXT_VMADDR, VM_PROT_NONE, 0);
+         segment(SEG_TEXT, 0, data_offset, TEXT_VMADDR, data_offset,
+                 VM_PROT_READ | VM_PROT_EXECUTE, 1);
+         sect(SECT_TEXT, SEG_TEXT, text_offset, text_size, TEXT_ALIGN);
+         segment(SEG_DATA, data_offset, data_filesize, data_vmaddr(), data_filesize,
+                 VM_PROT_READ | VM_PROT_WRITE, 1);
+         sect(SECT_DATA, SEG_DATA, data_offset, data.size(), DATA_ALIGN);
+         segment(SEG_LINKEDIT, linkedit_offset, linkedit.size(), text_vmaddr(linkedit_offset),
+                 MachO::align_up(linkedit.size(), PAGESIZE), VM_PROT_READ, 0);
+         command(dyld_info);
+         command(symtab);
+         command(dysymtab);
+
+         dylinker_command dylinker = {LC_LOAD_DYLINKER};
+         dylinker.cmdsize = MachO::align_up(sizeof(dylinker) + strlen(DYLINKER) + 1,
+                                            sizeof(uint32_t));
+         dylinker.name.offset = sizeof(dylinker);
+         command(dylinker);
+         dylib_name(DYLINKER);
+
+         entry_point_command entry = {LC_MAIN, sizeof(entry_point_command)};
+         entry.entryoff = functions.front().offset;
+         entry.stacksize = 0;
+         command(entry);
+
+         dylib_command dylib = {LC_LOAD_DYLIB};
+         dylib.cmdsize = MachO::align_up(sizeof(dylib) + strlen(DYLIB) + 1, sizeof(uint32_t));
+         dylib.dylib.name.offset = sizeof(dylib);
+         dylib.dylib.timestamp = 2;
+         dylib.dylib.current_version = 0x050c3c01;
+         dylib.dylib.compatibility_version = 0x00010000;
+         command(dylib);
+         dylib_name(DYLIB);
+
+         command(function_starts_cmd);
+         command(data_in_code_cmd);
+
+         mach_header header = {MH_MAGIC, CPU_TYPE_I386, CPU_SUBTYPE_I386_ALL, MH_EXECUTE};
+         header.ncmds = ncmds;
+         header.sizeofcmds = cmds.size();
+         header.flags = MH_DYLDLINK | MH_TWOLEVEL;
+
+         assert(sizeof(header) + cmds.size() <= text_offset);
+
+         /* write */
+         MachO::Image img(path, O_RDWR | O_CREAT | O_TRUNC);
+         img.at<mach_header>(0) = header;
+         img.copy(sizeof(header), cmds.begin(), cmds.size());
+         for (const Function& f : functions) {
+            img.copy(f.offset, f.code.begin(), f.code.size());
+            for (std::size_t i = 0; i < f.island; ++i) {
+               img.at<uint8_t>(f.offset + f.code.size() + i) = random(0x100);
+            }
+         }
+         if (!data.empty()) {
+            img.copy(data_offset, data.begin(), data.size());
+         }
+         img.copy(linkedit_offset, linkedit.begin(), linkedit.size());
+
+         result.size = img.size();
+         return result;
+      }
+
+   }
+
+   GeneratorResult generate(const GeneratorOptions& opts, const char *path) {
+      opts.validate();
+      return Generator(opts).run(path);
+   }
+
+}
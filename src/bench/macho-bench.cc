@@ -0,0 +1,345 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#include "core/macho.hh"
+#include "core/archive.hh"
+#include "core/instruction.hh"
+#include "core/transform.hh"
+#include "core/flags.hh"
+#include "core/regs.hh"
+#include "rebasify.hh"
+
+const char *progname = nullptr;
+
+namespace {
+
+   const char *usagestr =
+      "usage: %1$s [options...] path...\n"                               \
+      "       %1$s -h\n"                                                 \
+      "\n"                                                               \
+      "Time the library's passes over each Mach-O and report MB/s and instructions/s.\n" \
+      "Only 32-bit inputs are rebasified and transformed.\n"             \
+      "\n"                                                               \
+      "Options:\n"                                                       \
+      "  -n, --iterations <count>  runs of each phase; the fastest is reported (default 5)\n" \
+      "  -p, --phases <phase>,...  phases to run, of parse, rebasify, transform, build and emit\n" \
+      "                            (default all)\n"                      \
+      "  -j, --jobs <count>        transform worker threads per section (default 1)\n" \
+      "  -s, --save <file>         save the timings as a baseline\n"     \
+      "  -b, --baseline <file>     compare against a saved baseline and fail on regressions\n" \
+      "  -t, --tolerance <pct>     slowdown tolerated before a phase regresses (default 10)\n" \
+      "  -h, --help                print this help dialog\n"             \
+      ;
+
+   void usage(FILE *f) {
+      fprintf(f, usagestr, progname);
+   }
+
+   const std::vector<std::string> all_phases = {"parse", "rebasify", "transform", "build", "emit"};
+
+   struct Options {
+      unsigned iterations = 5;
+      std::vector<std::string> phases = all_phases;
+      unsigned jobs = 1;
+      const char *save = nullptr;
+      const char *baseline = nullptr;
+      double tolerance = 10;
+
+      bool enabled(const std::string& phase) const {
+         return std::find(phases.begin(), phases.end(), phase) != phases.end();
+      }
+   };
+
+   struct Result {
+      std::string input; /*!< basename, so that baselines carry over between checkouts */
+      std::string phase;
+      double seconds;    /*!< fastest iteration */
+      std::size_t bytes;
+      std::size_t insts;
+   };
+
+   /* Baselines map `<input> <phase>' to seconds. */
+   using Baseline = std::map<std::pair<std::string, std::string>, double>;
+
+   template <typename Function>
+   double measure(Function function) {
+      using clock = std::chrono::steady_clock;
+      const auto start = clock::now();
+      function();
+      return std::chrono::duration<double>(clock::now() - start).count();
+   }
+
+   template <MachO::Bits b>
+   std::size_t count_insts(const MachO::Archive<b> *archive) {
+      if (archive == nullptr) {
+         throw std::string("fat images aren't supported");
+      }
+      std::size_t insts = 0;
+      for (const MachO::Section<b> *section : archive->sections()) {
+         for (const MachO::SectionBlob<b> *blob : section->content) {
+            if (dynamic_cast<const MachO::Instruction<b> *>(blob)) {
+               ++insts;
+            }
+         }
+      }
+      return insts;
+   }
+
+   std::size_t count_insts(const MachO::MachO *macho) {
+      switch (macho->bits()) {
+      case MachO::Bits::M32:
+         return count_insts(dynamic_cast<const MachO::Archive<MachO::Bits::M32> *>(macho));
+      case MachO::Bits::M64:
+         return count_insts(dynamic_cast<const MachO::Archive<MachO::Bits::M64> *>(macho));
+      default: abort();
+      }
+   }
+
+   class Runner {
+   public:
+      Runner(const Options& opts): opts(opts) {}
+
+      std::vector<Result> run(const char *path);
+
+   private:
+      using Archive32 = MachO::Archive<MachO::Bits::M32>;
+
+      const Options& opts;
+      std::map<std::string, double> best;
+
+      void record(const std::string& phase, double seconds) {
+         const auto it = best.emplace(phase, seconds).first;
+         it->second = std::min(it->second, seconds);
+      }
+   };
+
+   std::vector<Result> Runner::run(const char *path) {
+      const MachO::Image img(path, O_RDONLY);
+
+      char tmp_path[] = "/tmp/macho-bench.XXXXXX";
+      const int fd = mkstemp(tmp_path);
+      if (fd < 0) {
+         throw std::string("mkstemp: ") + strerror(errno);
+      }
+      close(fd);
+      std::unique_ptr<MachO::Image> out;
+      try {
+         out = std::make_unique<MachO::Image>(tmp_path, O_RDWR | O_TRUNC);
+      } catch (...) {
+         unlink(tmp_path);
+         throw;
+      }
+      unlink(tmp_path);
+
+      std::size_t insts = 0;
+      bool m32 = false;
+      for (unsigned i = 0; i < opts.iterations; ++i) {
+         std::unique_ptr<MachO::MachO> macho;
+         const auto parse = [&] { macho.reset(MachO::MachO::Parse(img)); };
+
+         record("parse", measure(parse));
+         if (i == 0) {
+            insts = count_insts(macho.get());
+            m32 = macho->bits() == MachO::Bits::M32;
+         }
+
+         if (opts.enabled("build") || opts.enabled("emit")) {
+            record("build", measure([&] { macho->Build(); }));
+            record("emit", measure([&] { macho->Emit(*out); }));
+         }
+
+         if (m32 && opts.enabled("rebasify")) {
+            parse();
+            auto archive = dynamic_cast<Archive32 *>(macho.get());
+            if (archive->section(SECT_TEXT) != nullptr) {
+               const Rebasify rebasify;
+               record("rebasify", measure([&] { rebasify.handle_insts(archive); }));
+            }
+         }
+
+         if (m32 && opts.enabled("transform")) {
+            parse();
+            auto archive = dynamic_cast<Archive32 *>(macho.get());
+            std::unique_ptr<MachO::MachO> result;
+            record("transform", measure([&] {
+               /* as `macho-tool transform' does it */
+               archive->Build(0);
+               MachO::analyze_flags_liveness(*archive);
+               MachO::analyze_reg_liveness(*archive);
+               MachO::TransformEnv<MachO::Bits::M32> env;
+               env.jobs = opts.jobs;
+               result.reset(archive->Transform(env));
+            }));
+         }
+      }
+
+      std::vector<Result> results;
+      const std::string input = std::string(path).substr(std::string(path).rfind('/') + 1);
+      for (const std::string& phase : all_phases) {
+         const auto it = best.find(phase);
+         if (it != best.end() && opts.enabled(phase)) {
+            results.push_back({input, phase, it->second, img.size(), insts});
+         }
+      }
+      return results;
+   }
+
+   Baseline read_baseline(const char *path) {
+      std::ifstream file(path);
+      if (!file) {
+         throw std::string("failed to open baseline `") + path + "'";
+      }
+
+      Baseline baseline;
+      std::string line;
+      for (unsigned lineno = 1; std::getline(file, line); ++lineno) {
+         std::istringstream ss(line);
+         std::string input, phase;
+         double seconds;
+         if (!(ss >> input) || input[0] == '#') {
+            continue;
+         }
+         if (!(ss >> phase >> seconds)) {
+            throw std::string(path) + ":" + std::to_string(lineno) +
+               ": expected `<input> <phase> <seconds>'";
+         }
+         baseline[{input, phase}] = seconds;
+      }
+      return baseline;
+   }
+
+   void save_baseline(const char *path, const std::vector<Result>& results) {
+      std::ofstream file(path);
+      if (!file) {
+         throw std::string("failed to open baseline `") + path + "' for writing";
+      }
+      file << "# <input> <phase> <seconds>" << std::endl;
+      for (const Result& result : results) {
+         file << result.input << " " << result.phase << " " << result.seconds << std::endl;
+      }
+   }
+
+}
+
+int main(int argc, char *argv[]) {
+   progname = argv[0];
+
+   const char *optstring = "hn:p:j:s:b:t:";
+   const option longopts[] = {
+      {"help", no_argument, nullptr, 'h'},
+      {"iterations", required_argument, nullptr, 'n'},
+      {"phases", required_argument, nullptr, 'p'},
+      {"jobs", required_argument, nullptr, 'j'},
+      {"save", required_argument, nullptr, 's'},
+      {"baseline", required_argument, nullptr, 'b'},
+      {"tolerance", required_argument, nullptr, 't'},
+      {0}};
+
+   Options opts;
+
+   try {
+      int optchar;
+      while ((optchar = getopt_long(argc, argv, optstring, longopts, nullptr)) >= 0) {
+         switch (optchar) {
+         case 'h':
+            usage(stdout);
+            return 0;
+
+         case 'n':
+            if ((opts.iterations = std::stoul(optarg)) == 0) {
+               throw std::string("need at least one iteration");
+            }
+            break;
+
+         case 'p':
+            {
+               opts.phases.clear();
+               std::stringstream ss(optarg);
+               std::string phase;
+               while (std::getline(ss, phase, ',')) {
+                  if (std::find(all_phases.begin(), all_phases.end(), phase) == all_phases.end()) {
+                     throw std::string("unknown phase `") + phase + "'";
+                  }
+                  opts.phases.push_back(phase);
+               }
+            }
+            break;
+
+         case 'j': opts.jobs = std::stoul(optarg); break;
+         case 's': opts.save = optarg; break;
+         case 'b': opts.baseline = optarg; break;
+         case 't': opts.tolerance = std::stod(optarg); break;
+
+         default:
+            usage(stderr);
+            return 1;
+         }
+      }
+      if (optind == argc) {
+         usage(stderr);
+         return 1;
+      }
+
+      const Baseline baseline = opts.baseline ? read_baseline(opts.baseline) : Baseline();
+
+      MachO::init();
+
+      std::vector<Result> results;
+      for (int i = optind; i < argc; ++i) {
+         const auto input_results = Runner(opts).run(argv[i]);
+         results.insert(results.end(), input_results.begin(), input_results.end());
+      }
+
+      bool regressed = false;
+      printf("%-24s %-10s %12s %10s %12s", "input", "phase", "time (ms)", "MB/s", "Minst/s");
+      printf(opts.baseline ? " %10s\n" : "\n", "vs base");
+      for (const Result& result : results) {
+         printf("%-24s %-10s %12.3f %10.2f %12.3f", result.input.c_str(), result.phase.c_str(),
+                result.seconds * 1e3, result.bytes / result.seconds / 1e6,
+                result.insts / result.seconds / 1e6);
+         if (opts.baseline) {
+            const auto it = baseline.find({result.input, result.phase});
+            if (it == baseline.end()) {
+               printf(" %10s", "-");
+            } else {
+               const double change = (result.seconds / it->second - 1) * 100;
+               const bool regression = change > opts.tolerance;
+               printf(" %+9.1f%%%s", change, regression ? "  REGRESSION" : "");
+               regressed = regressed || regression;
+            }
+         }
+         printf("\n");
+      }
+
+      if (opts.save) {
+         save_baseline(opts.save, results);
+      }
+      if (regressed) {
+         fprintf(stderr, "%s: slower than baseline by more than %g%%\n", progname,
+                 opts.tolerance);
+         return 1;
+      }
+   } catch (const std::string& s) {
+      fprintf(stderr, "%s: %s\n", progname, s.c_str());
+      return 1;
+   } catch (const std::exception& e) {
+      fprintf(stderr, "%s: %s\n", progname, e.what());
+      return 1;
+   }
+
+   return 0;
+}
@@ -0,0 +1,137 @@
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#include "generator.hh"
+#include "core/macho.hh"
+#include "core/image.hh"
+
+namespace {
+
+   const char *progname = nullptr;
+   const char *usagestr =
+      "usage: %1$s [options...] [outpath='a.out']\n"                      \
+      "       %1$s -h\n"                                                  \
+      "\n"                                                                \
+      "Write a synthetic i386 executable, parsed and re-emitted by the library.\n" \
+      "\n"                                                                \
+      "Options:\n"                                                        \
+      "  -n, --functions <count>       functions (default 1000)\n"        \
+      "  -i, --insts <count>           mean instructions per function body (default 32)\n" \
+      "  -m, --mix <kind>=<weight>,... weights of alu, mem, branch, call and pic instructions\n" \
+      "                                (default alu=8,mem=4,branch=2,call=1,pic=1)\n" \
+      "  -d, --data <bytes>            size of __data (default 65536)\n"  \
+      "  -s, --symbols <count>         local function symbols (default 1000)\n" \
+      "  -e, --exports <count>         exported functions, including _main (default 16, max 255)\n" \
+      "  -I, --imports <count>         imported symbols (default 16)\n"   \
+      "  -r, --rebase-density <pct>    percentage of __data pointers rebased (default 10)\n" \
+      "  -b, --bind-density <pct>      percentage of __data pointers bound (default 5)\n" \
+      "  -l, --islands <count>         data-in-code islands in __text (default 0)\n" \
+      "  -L, --island-size <bytes>     size of each island (default 16)\n" \
+      "  -S, --seed <seed>             random seed (default 0)\n"         \
+      "  -R, --raw                     write the generator's image without re-emitting it\n" \
+      "  -h, --help                    print this help dialog\n"          \
+      ;
+
+   void usage(FILE *f) {
+      fprintf(f, usagestr, progname);
+   }
+
+   std::size_t parse_count(const char *arg) {
+      char *end;
+      const std::size_t n = std::strtoul(arg, &end, 0);
+      if (*arg == '\0' || *end != '\0') {
+         throw std::string("invalid count `") + arg + "'";
+      }
+      return n;
+   }
+
+}
+
+int main(int argc, char *argv[]) {
+   progname = argv[0];
+
+   const char *optstring = "hn:i:m:d:s:e:I:r:b:l:L:S:R";
+   const option longopts[] = {
+      {"help", no_argument, nullptr, 'h'},
+      {"functions", required_argument, nullptr, 'n'},
+      {"insts", required_argument, nullptr, 'i'},
+      {"mix", required_argument, nullptr, 'm'},
+      {"data", required_argument, nullptr, 'd'},
+      {"symbols", required_argument, nullptr, 's'},
+      {"exports", required_argument, nullptr, 'e'},
+      {"imports", required_argument, nullptr, 'I'},
+      {"rebase-density", required_argument, nullptr, 'r'},
+      {"bind-density", required_argument, nullptr, 'b'},
+      {"islands", required_argument, nullptr, 'l'},
+      {"island-size", required_argument, nullptr, 'L'},
+      {"seed", required_argument, nullptr, 'S'},
+      {"raw", no_argument, nullptr, 'R'},
+      {0}};
+
+   Bench::GeneratorOptions opts;
+   bool raw = false;
+
+   try {
+      int optchar;
+      while ((optchar = getopt_long(argc, argv, optstring, longopts, nullptr)) >= 0) {
+         switch (optchar) {
+         case 'h':
+            usage(stdout);
+            return 0;
+         case 'n': opts.functions = parse_count(optarg); break;
+         case 'i': opts.insts = parse_count(optarg); break;
+         case 'm': opts.mix.parse(optarg); break;
+         case 'd': opts.data_size = parse_count(optarg); break;
+         case 's': opts.symbols = parse_count(optarg); break;
+         case 'e': opts.exports = parse_count(optarg); break;
+         case 'I': opts.imports = parse_count(optarg); break;
+         case 'r': opts.rebase_density = parse_count(optarg); break;
+         case 'b': opts.bind_density = parse_count(optarg); break;
+         case 'l': opts.islands = parse_count(optarg); break;
+         case 'L': opts.island_size = parse_count(optarg); break;
+         case 'S': opts.seed = parse_count(optarg); break;
+         case 'R': raw = true; break;
+         default:
+            usage(stderr);
+            return 1;
+         }
+      }
+      if (argc - optind > 1) {
+         usage(stderr);
+         return 1;
+      }
+      const std::string path = optind < argc ? argv[optind] : "a.out";
+
+      /* round-trip through the library, so that the output is laid out the way it builds */
+      const std::string raw_path = raw ? path : path + ".raw";
+      const Bench::GeneratorResult result = Bench::generate(opts, raw_path.c_str());
+      if (!raw) {
+         MachO::init();
+         {
+            const MachO::Image in(raw_path.c_str(), O_RDONLY);
+            std::unique_ptr<MachO::MachO> macho(MachO::MachO::Parse(in));
+            macho->Build();
+            MachO::Image out(path.c_str(), O_RDWR | O_CREAT | O_TRUNC);
+            macho->Emit(out);
+         }
+         unlink(raw_path.c_str());
+      }
+
+      printf("%s: %zu functions, %zu instructions, %zu rebases, %zu binds, %zu bytes raw\n",
+             path.c_str(), opts.functions, result.insts, result.rebases, result.binds,
+             result.size);
+   } catch (const std::string& s) {
+      fprintf(stderr, "%s: %s\n", progname, s.c_str());
+      return 1;
+   } catch (const std::exception& e) {
+      fprintf(stderr, "%s: %s\n", progname, e.what());
+      return 1;
+   }
+
+   return 0;
+}
@@ -0,0 +1,88 @@
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <mach-o/loader.h>
+
+extern "C" {
+#include <xed/xed-interface.h>
+}
+
+#include "align.hh"
+#include "archive.hh"
+#include "section.hh"
+#include "section_blob.hh"
+#include "instruction.hh"
+#include "linkedit.hh"
+
+namespace MachO {
+
+   template <Bits bits>
+   std::size_t align_code(Archive<bits>& archive, const CodeAlignment& opts) {
+      Section<bits> *text = archive.section(SECT_TEXT);
+      if (text == nullptr || (opts.function_align == 0 && opts.loop_align == 0)) {
+         return 0;
+      }
+      auto& content = text->content;
+
+      /* function entries */
+      std::unordered_set<const SectionBlob<bits> *> funcs;
+      for (LoadCommand<bits> *lc : archive.load_commands) {
+         if (auto starts = dynamic_cast<FunctionStarts<bits> *>(lc)) {
+            funcs.insert(starts->entries.begin(), starts->entries.end());
+         }
+      }
+
+      /* loop heads: targets of non-call branches that precede the branch in __text */
+      std::unordered_map<const SectionBlob<bits> *, std::size_t> index;
+      for (const SectionBlob<bits> *blob : content) {
+         index.emplace(blob, index.size());
+      }
+      std::unordered_set<const SectionBlob<bits> *> loops;
+      for (const SectionBlob<bits> *blob : content) {
+         const auto inst = dynamic_cast<const Instruction<bits> *>(blob);
+         if (inst == nullptr || !inst->active || inst->brdisp == nullptr ||
+             xed_decoded_inst_get_category(&inst->xedd) == XED_CATEGORY_CALL) {
+            continue;
+         }
+         const auto target_it = index.find(inst->brdisp);
+         if (target_it != index.end() && target_it->second <= index.at(inst)) {
+            loops.insert(inst->brdisp);
+         }
+      }
+
+      /* Pad in front of the run of zero-size blobs (placeholders) that the target belongs to, so
+       * that every branch to that address skips the padding. */
+      std::size_t count = 0;
+      auto run = content.begin();
+      Padding<bits> *padding = nullptr; /* padding already in front of _run_ */
+      for (auto it = content.begin(); it != content.end(); ++it) {
+         const unsigned align = std::max(funcs.count(*it) ? opts.function_align : 0,
+                                         loops.count(*it) ? opts.loop_align : 0);
+         if (align > 0) {
+            if (padding == nullptr) {
+               padding = Padding<bits>::Create(align, opts.max_padding);
+               content.insert(run, padding);
+               ++count;
+            } else {
+               padding->align = std::max(padding->align, align);
+            }
+         }
+         
+         if ((*it)->active && (*it)->size() > 0) {
+            run = std::next(it);
+            padding = nullptr;
+         }
+      }
+
+      if (count > 0) {
+         text->sect.align = std::max<uint32_t>(text->sect.align,
+                                               std::max(opts.function_align, opts.loop_align));
+      }
+      
+      return count;
+   }
+
+   template std::size_t align_code(Archive<Bits::M32>&, const CodeAlignment&);
+   template std::size_t align_code(Archive<Bits::M64>&, const CodeAlignment&);
+
+}
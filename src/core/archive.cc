@@ -1,5 +1,10 @@
+#include <algorithm>
+#include <cstdint>
 #include <sstream>
 #include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "archive.hh"
 #include "parse.hh"
@@ -7,9 +12,134 @@
 #include "segment.hh"
 #include "types.hh"
 #include "section_blob.hh"
+#include "section.hh"
+#include "instruction.hh"
+#include "linkedit.hh"
+#include "fenwick.hh"
+#include "stats.hh"
+#include "trace.hh"
 
 namespace MachO {
 
+   namespace {
+      /* Widens the short branches of _section_ whose targets in the same section are out of
+       * rel8 range even if all padding in between shrank to nothing, so each of them must be
+       * widened in any stable layout. The growth of widened branches is tracked in a Fenwick
+       * tree, which lets later decisions in the same round see the shifted layout without
+       * another build. Requires locations from a completed build. */
+      template <Bits b>
+      std::size_t relax_section(Section<b>& section) {
+         const std::vector<SectionBlob<b> *> blobs(section.content.begin(),
+                                                   section.content.end());
+         std::unordered_map<const SectionBlob<b> *, std::size_t> index;
+         std::vector<Instruction<b> *> branches;
+         std::vector<std::size_t> branch_index;
+         Fenwick padding(blobs.size());
+         for (std::size_t i = 0; i < blobs.size(); ++i) {
+            index.emplace(blobs[i], i);
+            if (!blobs[i]->active) {
+               continue;
+            }
+            if (dynamic_cast<Padding<b> *>(blobs[i])) {
+               padding.add(i, blobs[i]->size());
+            } else if (auto inst = dynamic_cast<Instruction<b> *>(blobs[i])) {
+               if (inst->short_branch() && inst->brdisp) {
+                  branches.push_back(inst);
+                  branch_index.push_back(i);
+               }
+            }
+         }
+
+         Fenwick growth(blobs.size());
+         std::size_t widened = 0;
+         bool changed;
+         do {
+            changed = false;
+            for (std::size_t k = 0; k < branches.size(); ++k) {
+               Instruction<b> *inst = branches[k];
+               const auto target_it = index.find(inst->brdisp);
+               if (!inst->short_branch() || target_it == index.end()) {
+                  continue;
+               }
+               
+               const std::size_t i = branch_index[k];
+               const std::size_t j = target_it->second;
+               const ssize_t src = inst->loc.vmaddr + growth.prefix(i) + inst->size();
+               const ssize_t dst = inst->brdisp->loc.vmaddr + growth.prefix(j);
+               const ssize_t slack = j > i ? padding.range(i + 1, j) : padding.range(j, i);
+               ssize_t disp = dst - src;
+               disp = disp > 0 ? std::max<ssize_t>(disp - slack, 0) :
+                  std::min<ssize_t>(disp + slack, 0);
+               if (disp >= INT8_MIN && disp <= INT8_MAX) {
+                  continue;
+               }
+
+               const std::size_t old_size = inst->size();
+               inst->widen();
+               growth.add(i, inst->size() - old_size);
+               ++widened;
+               changed = true;
+            }
+         } while (changed);
+
+         return widened;
+      }
+
+      /* Lays out the dirty sections of _segment_ again, and the ones behind them, which shift by
+       * the size deltas of the sections laid out in front of them. The segment itself stays put.
+       * Returns whether any section was laid out, or std::nullopt if they no longer fit. */
+      template <Bits b>
+      std::optional<bool> relayout_segment(Archive<b> *archive, Segment<b>& segment,
+                                           typename Archive<b>::Dirty& dirty) {
+         ssize_t shift = 0;
+         const Section<b> *last = nullptr;
+         for (Section<b> *section : segment.sections) {
+            if (!section->dirty && shift == 0) {
+               continue;
+            }
+            /* zerofill sections have no file extent to shift in a parsed image, and relocation
+             * entries would have to move along */
+            if ((section->sect.flags & SECTION_TYPE) == S_ZEROFILL || !section->relocs.empty()) {
+               return std::nullopt;
+            }
+
+            const Location old = section->loc();
+            const std::size_t old_size = section->sect.size;
+            BuildEnv<b> env(archive, old + shift);
+            section->Build(env);
+            shift = (ssize_t) (section->sect.offset + section->sect.size) -
+               (ssize_t) (old.offset + old_size);
+            dirty.stale.push_back(FileRange {old.offset, old_size});
+            dirty.sections.insert(section);
+            last = section;
+         }
+
+         if (last == nullptr) {
+            return false;
+         }
+         const segment_command_t<b>& cmd = segment.segment_command;
+         if (last->sect.offset + last->sect.size > cmd.fileoff + cmd.filesize ||
+             last->sect.addr + last->sect.size > cmd.vmaddr + cmd.vmsize) {
+            return std::nullopt;
+         }
+         return true;
+      }
+
+      /* whether the bytes of _section_ are the same wherever other blobs are laid out */
+      template <Bits b>
+      bool plain_data(const Section<b>& section) {
+         return std::all_of(section.content.begin(), section.content.end(),
+                            [] (const SectionBlob<b> *blob) {
+                               return !blob->active ||
+                                  dynamic_cast<const DataBlob<b> *>(blob) ||
+                                  dynamic_cast<const DataRange<b> *>(blob) ||
+                                  dynamic_cast<const ZeroBlob<b> *>(blob) ||
+                                  dynamic_cast<const Placeholder<b> *>(blob) ||
+                                  dynamic_cast<const Padding<b> *>(blob);
+                            });
+      }
+   }
+
 #if 0
    uint32_t lc_build_order[] =
       {LC_SEGMENT,
@@ -27,22 +157,28 @@ namespace MachO {
    Archive<b>::Archive(const Image& img, std::size_t offset):
       header(img.at<mach_header_t<b>>(offset))
    {
+      Trace::Span span("Archive::Archive");
       ParseEnv<b> env(*this);
+      Stats::Timer timer;
       offset += sizeof(header);
       for (int i = 0; i < header.ncmds; ++i) {
          LoadCommand<b> *cmd = LoadCommand<b>::Parse(img, offset, env);
+         timer.stop("parse/Parse", cmd);
          load_commands.push_back(cmd);
          offset += cmd->size();
       }
 
       for (LoadCommand<b> *cmd : load_commands) {
          cmd->Parse1(img, env);
+         timer.stop("parse/Parse1", cmd);
       }
 
       env.do_resolve();
+      timer.stop("parse/do_resolve");
 
       for (LoadCommand<b> *cmd : load_commands) {
          cmd->Parse2(env);
+         timer.stop("parse/Parse2", cmd);
       }
 
       /* remaining placeholder should go at end of sections */
@@ -50,7 +186,11 @@ namespace MachO {
          auto placeholder_it = env.placeholders.begin();
          while (placeholder_it != env.placeholders.end()) {
             if (section->sect.addr + section->sect.size == placeholder_it->first) {
-               section->content.push_back(placeholder_it->second);
+               placeholder_it->second->segment = section->segment;
+               placeholder_it->second->section = section;
+               placeholder_it->second->loc.offset = section->sect.offset + section->sect.size;
+               placeholder_it->second->iter =
+                  section->content.insert(section->content.end(), placeholder_it->second);
                placeholder_it = env.placeholders.erase(placeholder_it);
             } else {
                ++placeholder_it;
@@ -63,6 +203,11 @@ namespace MachO {
       }
 
       env.do_resolve();
+      timer.stop("parse/do_resolve");
+
+      if (stats) {
+         stats->census("parse", *this);
+      }
    }
 
    template <Bits b>
@@ -84,6 +229,54 @@ namespace MachO {
 
    template <Bits b>
    std::size_t Archive<b>::Build(std::size_t offset) {
+      /* Span-dependent branch relaxation: lay out every branch in its current (short) form,
+       * widen the ones whose displacement overflows and repeat until layout is stable. Branches
+       * only ever grow, so this terminates. Branches within a section are relaxed to a local
+       * fixpoint between builds (see relax_section()), so few rounds are needed. */
+      Trace::Span span("Archive::Build");
+      relaxed_branches = 0;
+      unsigned rounds = 0;
+      std::size_t widened;
+      do {
+         Build_once(offset);
+         Stats::Scope scope("build/relax");
+         Trace::Span relax_span("Archive::relax_branches");
+         widened = relax_branches();
+         relaxed_branches += widened;
+         ++rounds;
+      } while (widened > 0);
+      if (span) {
+         span.arg("rounds", std::to_string(rounds));
+      }
+      return total_size;
+   }
+
+   template <Bits b>
+   std::size_t Archive<b>::relax_branches() {
+      std::size_t widened = 0;
+      for (Section<b> *section : sections()) {
+         widened += relax_section(*section);
+      }
+
+      /* branches across sections and those that might still fit are decided by the build */
+      short_branches = 0;
+      for (Section<b> *section : sections()) {
+         for (SectionBlob<b> *blob : section->content) {
+            if (auto inst = dynamic_cast<Instruction<b> *>(blob)) {
+               if (inst->relax()) {
+                  ++widened;
+               } else if (inst->active && inst->short_branch()) {
+                  ++short_branches;
+               }
+            }
+         }
+      }
+      return widened;
+   }
+
+   template <Bits b>
+   void Archive<b>::Build_once(std::size_t offset) {
+      Trace::Span span("Archive::Build_once");
       BuildEnv<b> env(this, Location(offset, vmaddr));
       
       env.allocate(sizeof(header));
@@ -105,23 +298,146 @@ namespace MachO {
       }
       
       /* build each command */
+      Stats::Timer timer;
       for (LoadCommand<b> *lc : load_commands) {
          lc->Build(env);
+         timer.stop("build/Build", lc);
       }
 
       total_size = env.loc.offset - offset;
-      return total_size;
+   }
+
+   template <Bits b>
+   std::optional<typename Archive<b>::Dirty> Archive<b>::Relayout() {
+      Trace::Span span("Archive::Relayout");
+
+      /* load commands must keep their size, or all of the content would move */
+      std::size_t sizeofcmds = 0;
+      for (const LoadCommand<b> *lc : load_commands) {
+         sizeofcmds += lc->size();
+      }
+      if (header.ncmds != load_commands.size() || header.sizeofcmds != sizeofcmds) {
+         return std::nullopt;
+      }
+
+      BuildEnv<b> env(this, Location(0, vmaddr));
+      for (LoadCommand<b> *lc : load_commands) {
+         lc->AssignID(env);
+      }
+
+      Dirty dirty;
+      bool moved = false;
+      for (Segment<b> *segment : segments()) {
+         if (dynamic_cast<Segment_LINKEDIT<b> *>(segment)) {
+            continue;
+         }
+
+         /* widening short branches that the new layout pushed out of range makes their sections
+          * dirty again, so repeat until none do */
+         for (;;) {
+            const std::optional<bool> relaid = relayout_segment(this, *segment, dirty);
+            if (!relaid) {
+               return std::nullopt;
+            } else if (!*relaid) {
+               break;
+            }
+            moved = true;
+
+            std::size_t widened = 0;
+            for (Section<b> *section : segment->sections) {
+               for (SectionBlob<b> *blob : section->content) {
+                  auto inst = dynamic_cast<Instruction<b> *>(blob);
+                  if (inst && inst->relax()) {
+                     section->dirty = true;
+                     ++widened;
+                  }
+               }
+            }
+            relaxed_branches += widened;
+            if (widened == 0) {
+               break;
+            }
+         }
+      }
+
+      /* whatever refers to a blob may have to change once anything moved */
+      if (moved) {
+         for (Section<b> *section : sections()) {
+            if (!plain_data(*section)) {
+               dirty.sections.insert(section);
+            }
+         }
+         if (auto linkedit = subcommand<Segment_LINKEDIT>()) {
+            BuildEnv<b> linkedit_env(this, linkedit->loc());
+            linkedit->Relayout(linkedit_env, dirty.tables, dirty.stale);
+         }
+      }
+
+      /* other commands only fill in their headers, e.g. the entry point's offset */
+      for (LoadCommand<b> *lc : load_commands) {
+         if (!dynamic_cast<Segment<b> *>(lc)) {
+            lc->Build(env);
+         }
+      }
+
+      total_size = 0;
+      for (const Segment<b> *segment : segments()) {
+         total_size = std::max<std::size_t>(total_size, segment->segment_command.fileoff +
+                                            segment->segment_command.filesize);
+      }
+      dirty.size = total_size;
+
+      if (span) {
+         span.arg("sections", std::to_string(dirty.sections.size()));
+         span.arg("tables", std::to_string(dirty.tables.size()));
+      }
+      return dirty;
+   }
+
+   template <Bits b>
+   void Archive<b>::Emit(Image& img, const Dirty& dirty) const {
+      Trace::Span span("Archive::Emit");
+
+      for (const FileRange& range : dirty.stale) {
+         img.memset(range.offset, 0, range.size);
+      }
+      
+      img.at<mach_header_t<b>>(0) = header;
+      
+      std::size_t offset = sizeof(header);
+      for (const LoadCommand<b> *lc : load_commands) {
+         if (auto segment = dynamic_cast<const Segment<b> *>(lc)) {
+            segment->Emit(img, offset, dirty.sections);
+         } else if (!dynamic_cast<const LinkeditCommand<b> *>(lc) || dirty.tables.count(lc)) {
+            lc->Emit(img, offset);
+         }
+         offset += lc->size();
+      }
    }
 
    template <Bits b>
    void Archive<b>::Emit(Image& img) const {
+      Trace::Span span("Archive::Emit");
+      if (stats) {
+         stats->census("emit", *this);
+      }
+
       /* emit header */
       img.at<mach_header_t<b>>(0) = header;
       
       /* emit load commands */
+      Stats::Timer timer;
       std::size_t offset = sizeof(header);
       for (LoadCommand<b> *lc : load_commands) {
+         Trace::Span lc_span("LoadCommand::Emit");
+         if (lc_span) {
+            lc_span.arg("command", Stats::type_name(*lc));
+            if (auto segment = dynamic_cast<const Segment<b> *>(lc)) {
+               lc_span.arg("segment", segment->name());
+            }
+         }
          lc->Emit(img, offset);
+         timer.stop("emit/Emit", lc);
          offset += lc->size();
       }
    }
@@ -129,9 +445,12 @@ namespace MachO {
    template <Bits b>
    Archive<b>::Archive(const Archive<opposite<b>>& other, TransformEnv<opposite<b>>& env)
    {
+      Trace::Span span("Archive::Transform");
       env(other.header, header);
+      Stats::Timer timer;
       for (const auto lc : other.load_commands) {
          load_commands.push_back(lc->Transform(env));
+         timer.stop("transform/Transform", lc);
       }
    }
 
@@ -163,6 +482,29 @@ namespace MachO {
       throw std::invalid_argument("location not in any segment");
    }
 
+   template <Bits b>
+   void Archive<b>::insert(const std::vector<Insertion<b>>& blobs) {
+      std::unordered_map<Section<b> *, std::vector<Insertion<b>>> by_section;
+      const auto sections = this->sections();
+      for (const Insertion<b>& insertion : blobs) {
+         const Location& loc = insertion.loc;
+         const auto it = std::find_if(sections.begin(), sections.end(),
+                                      [&] (const Section<b> *section) {
+                                         return loc.offset ? section->contains_offset(loc.offset) :
+                                            section->contains_vmaddr(loc.vmaddr);
+                                      });
+         if (it == sections.end()) {
+            throw std::invalid_argument("location not in any section");
+         }
+         insertion.blob->segment = (*it)->segment;
+         by_section[*it].push_back(insertion);
+      }
+
+      for (auto& [section, insertions] : by_section) {
+         section->insert(insertions);
+      }
+   }
+
    template <Bits b>
    std::size_t Archive<b>::offset_to_vmaddr(std::size_t offset) const {
       for (Segment<b> *segment : segments()) {
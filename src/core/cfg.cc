@@ -0,0 +1,474 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <unordered_set>
+#include <mach-o/loader.h>
+
+extern "C" {
+#include <xed/xed-interface.h>
+}
+
+#include "cfg.hh"
+#include "archive.hh"
+#include "section.hh"
+#include "section_blob.hh"
+#include "instruction.hh"
+#include "linkedit.hh"
+
+namespace MachO {
+
+   namespace {
+      bool ends_block(const xed_decoded_inst_t& xedd) {
+         switch (xed_decoded_inst_get_category(&xedd)) {
+         case XED_CATEGORY_UNCOND_BR:
+         case XED_CATEGORY_COND_BR:
+         case XED_CATEGORY_RET:
+            return true;
+         default:
+            return false;
+         }
+      }
+
+      bool falls_through(const xed_decoded_inst_t& xedd) {
+         switch (xed_decoded_inst_get_category(&xedd)) {
+         case XED_CATEGORY_UNCOND_BR:
+         case XED_CATEGORY_RET:
+            return false;
+         default:
+            return true;
+         }
+      }
+   }
+
+   template <Bits bits>
+   unsigned CFG<bits>::Block::loop_depth() const {
+      return loop ? loop->depth : 0;
+   }
+
+   template <Bits bits>
+   bool CFG<bits>::Loop::contains(const Block *block) const {
+      for (const Loop *loop = block->loop; loop; loop = loop->parent) {
+         if (loop == this) {
+            return true;
+         }
+      }
+      return false;
+   }
+
+   template <Bits bits>
+   CFG<bits>::CFG(Section<bits> *section, typename Content::iterator begin,
+                  typename Content::iterator end): section(section)
+   {
+      /* split into blocks; _fallthrough_ is the block that control falls into the next block
+       * from, if any */
+      std::vector<const SectionBlob<bits> *> pending;
+      std::vector<Block *> fallthrough(1, nullptr);
+      std::unordered_set<const SectionBlob<bits> *> targets;
+      for (auto it = begin; it != end; ++it) {
+         const auto inst = dynamic_cast<const Instruction<bits> *>(*it);
+         if (inst && inst->active && inst->brdisp) {
+            targets.insert(inst->brdisp);
+         }
+      }
+
+      Block *cur = nullptr;
+      bool leader = false;
+      for (auto it = begin; it != end; ++it) {
+         SectionBlob<bits> *blob = *it;
+         if (!blob->active) {
+            continue;
+         }
+
+         if (auto inst = dynamic_cast<Instruction<bits> *>(blob)) {
+            leader = leader || cur == nullptr || targets.count(inst) != 0;
+            for (const SectionBlob<bits> *placeholder : pending) {
+               leader = leader || targets.count(placeholder) != 0;
+            }
+            if (leader) {
+               Block *prev = cur;
+               blocks.push_back(std::make_unique<Block>());
+               cur = blocks.back().get();
+               cur->id = blocks.size() - 1;
+               fallthrough.push_back(prev && falls_through(prev->last()->xedd) ? prev : nullptr);
+               leader = false;
+            }
+
+            cur->insts.push_back(inst);
+            labels[inst] = cur;
+            for (const SectionBlob<bits> *placeholder : pending) {
+               labels[placeholder] = cur;
+               placeholders[placeholder] = inst;
+            }
+            pending.clear();
+            leader = ends_block(inst->xedd);
+         } else if (blob->size() == 0) {
+            pending.push_back(blob);
+         } else {
+            /* data or stub helper entries end fallthrough */
+            if (cur) {
+               cur->exit = cur->exit || falls_through(cur->last()->xedd);
+            }
+            pending.clear();
+            cur = nullptr;
+         }
+      }
+      if (cur && falls_through(cur->last()->xedd)) {
+         cur->exit = true;
+      }
+
+      /* edges */
+      const auto add_edge = [] (Block *from, Block *to) {
+         from->succs.push_back(to);
+         to->preds.push_back(from);
+      };
+      for (const auto& block : blocks) {
+         if (Block *prev = fallthrough.at(block->id + 1)) {
+            add_edge(prev, block.get());
+         }
+
+         const Instruction<bits> *last = block->last();
+         switch (xed_decoded_inst_get_category(&last->xedd)) {
+         case XED_CATEGORY_UNCOND_BR:
+         case XED_CATEGORY_COND_BR:
+            {
+               Block *target = last->brdisp ? this->block(last->brdisp) : nullptr;
+               if (target) {
+                  add_edge(block.get(), target);
+               } else {
+                  block->exit = true;
+               }
+            }
+            break;
+         case XED_CATEGORY_RET:
+            block->exit = true;
+            break;
+         default:
+            break;
+         }
+      }
+
+      compute_dominators();
+      compute_loops();
+   }
+
+   template <Bits bits>
+   typename CFG<bits>::Block *CFG<bits>::block(const SectionBlob<bits> *blob) const {
+      const auto it = labels.find(blob);
+      return it == labels.end() ? nullptr : it->second;
+   }
+
+   template <Bits bits>
+   bool CFG<bits>::dominates(const Block *a, const Block *b) const {
+      for (; b; b = b->idom) {
+         if (a == b) {
+            return true;
+         }
+      }
+      return false;
+   }
+
+   /* Cooper, Harvey & Kennedy, "A Simple, Fast Dominance Algorithm". Blocks without predecessors
+    * (function entries and code only reached indirectly) are roots; any block left unvisited
+    * afterwards also becomes a root. */
+   template <Bits bits>
+   void CFG<bits>::compute_dominators() {
+      const std::size_t n = blocks.size();
+      const std::size_t none = n;
+      std::vector<std::size_t> rpo_index(n, none);
+      std::vector<Block *> rpo;
+      rpo.reserve(n);
+
+      /* iterative post-order DFS */
+      std::vector<Block *> postorder;
+      std::vector<bool> visited(n, false);
+      const auto dfs = [&] (Block *root) {
+         std::vector<std::pair<Block *, std::size_t>> stack {{root, 0}};
+         visited[root->id] = true;
+         while (!stack.empty()) {
+            auto& [block, succ_i] = stack.back();
+            if (succ_i < block->succs.size()) {
+               Block *succ = block->succs[succ_i++];
+               if (!visited[succ->id]) {
+                  visited[succ->id] = true;
+                  stack.emplace_back(succ, 0);
+               }
+            } else {
+               postorder.push_back(block);
+               stack.pop_back();
+            }
+         }
+      };
+      std::vector<bool> root(n, false);
+      for (const auto& block : blocks) {
+         if (block->preds.empty()) {
+            root[block->id] = true;
+            dfs(block.get());
+         }
+      }
+      for (const auto& block : blocks) {
+         if (!visited[block->id]) {
+            root[block->id] = true;
+            dfs(block.get());
+         }
+      }
+      rpo.assign(postorder.rbegin(), postorder.rend());
+      for (std::size_t i = 0; i < rpo.size(); ++i) {
+         rpo_index[rpo[i]->id] = i;
+      }
+
+      /* idoms as rpo indices; roots are dominated by a virtual root (_none_) */
+      std::vector<std::size_t> idom(n, none);
+      std::vector<bool> done(n, false);
+      for (std::size_t i = 0; i < n; ++i) {
+         done[i] = root[rpo[i]->id];
+      }
+      const auto intersect = [&] (std::size_t a, std::size_t b) {
+         while (a != b) {
+            while (a != none && (b == none || a > b)) {
+               a = idom[a];
+            }
+            while (b != none && (a == none || b > a)) {
+               b = idom[b];
+            }
+            if (a == none || b == none) {
+               return none;
+            }
+         }
+         return a;
+      };
+
+      bool changed;
+      do {
+         changed = false;
+         for (std::size_t i = 0; i < n; ++i) {
+            if (root[rpo[i]->id]) {
+               continue;
+            }
+            std::optional<std::size_t> new_idom;
+            for (const Block *pred : rpo[i]->preds) {
+               const std::size_t p = rpo_index[pred->id];
+               if (!done[p]) {
+                  continue;
+               }
+               new_idom = new_idom ? intersect(p, *new_idom) : p;
+            }
+            if (new_idom && (!done[i] || idom[i] != *new_idom)) {
+               idom[i] = *new_idom;
+               done[i] = true;
+               changed = true;
+            }
+         }
+      } while (changed);
+
+      for (std::size_t i = 0; i < n; ++i) {
+         rpo[i]->idom = idom[i] == none ? nullptr : rpo[idom[i]];
+      }
+   }
+
+   /* Natural loops of back edges (edges whose target dominates their source). Back edges that
+    * share a header form one loop. */
+   template <Bits bits>
+   void CFG<bits>::compute_loops() {
+      std::unordered_map<Block *, std::unordered_set<Block *>> bodies;
+      for (const auto& block : blocks) {
+         for (Block *succ : block->succs) {
+            if (!dominates(succ, block.get())) {
+               continue;
+            }
+
+            auto& body = bodies[succ];
+            body.insert(succ);
+            std::vector<Block *> worklist;
+            if (body.insert(block.get()).second) {
+               worklist.push_back(block.get());
+            }
+            while (!worklist.empty()) {
+               Block *cur = worklist.back();
+               worklist.pop_back();
+               for (Block *pred : cur->preds) {
+                  if (body.insert(pred).second) {
+                     worklist.push_back(pred);
+                  }
+               }
+            }
+         }
+      }
+
+      for (auto& [header, body] : bodies) {
+         loops.push_back(std::make_unique<Loop>());
+         loops.back()->header = header;
+         loops.back()->blocks.assign(body.begin(), body.end());
+         std::sort(loops.back()->blocks.begin(), loops.back()->blocks.end(),
+                   [] (const Block *a, const Block *b) { return a->id < b->id; });
+      }
+
+      /* outer loops are strictly larger than the loops they contain */
+      std::sort(loops.begin(), loops.end(), [] (const auto& a, const auto& b) {
+         return a->blocks.size() > b->blocks.size() ||
+            (a->blocks.size() == b->blocks.size() && a->header->id < b->header->id);
+      });
+      for (const auto& loop : loops) {
+         /* the innermost loop seen so far that contains the header encloses this loop */
+         loop->parent = loop->header->loop;
+         loop->depth = loop->parent ? loop->parent->depth + 1 : 1;
+         for (Block *block : loop->blocks) {
+            block->loop = loop.get();
+         }
+      }
+   }
+
+   template <Bits bits>
+   void CFG<bits>::insert(const SectionBlob<bits> *pos, Instruction<bits> *inst) {
+      if (ends_block(inst->xedd) || xed_decoded_inst_get_category(&inst->xedd) ==
+          XED_CATEGORY_CALL) {
+         throw std::invalid_argument("CFG::insert: inserted instruction transfers control");
+      }
+
+      Block *block = this->block(pos);
+      if (block == nullptr) {
+         throw std::invalid_argument("CFG::insert: position not in graph");
+      }
+
+      /* a placeholder stays in front of the instruction it labels */
+      const auto placeholder = placeholders.find(pos);
+      const SectionBlob<bits> *at = placeholder == placeholders.end() ? pos : placeholder->second;
+      const auto it = std::find(block->insts.begin(), block->insts.end(), at);
+      assert(it != block->insts.end());
+
+      /* branches land on the labels in front of the block's first instruction, so an instruction
+       * inserted in front of one of them only runs on fallthrough */
+      if (it == block->insts.begin()) {
+         for (const Block *pred : block->preds) {
+            const SectionBlob<bits> *target = pred->last()->brdisp;
+            if (target && this->block(target) == block && (at != pos || target == pos)) {
+               throw std::invalid_argument("CFG::insert: position is a branch target");
+            }
+         }
+      }
+      
+      block->insts.insert(it, inst);
+      labels[inst] = block;
+   }
+
+   template <Bits bits>
+   std::vector<std::unique_ptr<CFG<bits>>> CFG<bits>::Functions(Archive<bits>& archive,
+                                                               unsigned jobs) {
+      std::vector<std::unique_ptr<CFG<bits>>> cfgs;
+      Section<bits> *text = archive.section(SECT_TEXT);
+      if (text == nullptr) {
+         return cfgs;
+      }
+      auto& content = text->content;
+
+      std::unordered_set<const SectionBlob<bits> *> starts;
+      for (LoadCommand<bits> *lc : archive.load_commands) {
+         if (auto fs = dynamic_cast<FunctionStarts<bits> *>(lc)) {
+            starts.insert(fs->entries.begin(), fs->entries.end());
+         }
+      }
+
+      std::vector<std::pair<typename Content::iterator, typename Content::iterator>> ranges;
+      auto range_begin = content.begin();
+      for (auto it = content.begin(); it != content.end(); ++it) {
+         if (starts.count(*it) && it != range_begin) {
+            ranges.emplace_back(range_begin, it);
+            range_begin = it;
+         }
+      }
+      if (range_begin != content.end()) {
+         ranges.emplace_back(range_begin, content.end());
+      }
+
+      /* building only reads the section, so functions can be built concurrently */
+      cfgs.resize(ranges.size());
+      if (jobs == 0) {
+         jobs = std::max(1U, std::thread::hardware_concurrency());
+      }
+      std::atomic<std::size_t> next(0);
+      const auto worker = [&] () {
+         for (std::size_t i; (i = next++) < ranges.size(); ) {
+            cfgs[i] = std::make_unique<CFG<bits>>(text, ranges[i].first, ranges[i].second);
+         }
+      };
+      std::vector<std::thread> threads;
+      for (unsigned i = 1; i < std::min<std::size_t>(jobs, ranges.size()); ++i) {
+         threads.emplace_back(worker);
+      }
+      worker();
+      for (std::thread& thread : threads) {
+         thread.join();
+      }
+
+      return cfgs;
+   }
+
+   template <Bits bits>
+   void backward_dataflow(const CFG<bits>& cfg, uint32_t exit,
+                          const std::function<Transfer (const Instruction<bits>&)>& transfer,
+                          const std::function<void (Instruction<bits>&, uint32_t)>& store) {
+      using Block = typename CFG<bits>::Block;
+      std::vector<std::vector<Transfer>> transfers(cfg.blocks.size());
+      for (const auto& block : cfg.blocks) {
+         auto& block_transfers = transfers[block->id];
+         block_transfers.reserve(block->insts.size());
+         for (const Instruction<bits> *inst : block->insts) {
+            block_transfers.push_back(transfer(*inst));
+         }
+      }
+
+      /* walks _block_ backwards from its live-out mask, reporting the mask after each
+       * instruction; returns the block's live-in mask */
+      std::vector<uint32_t> live_in(cfg.blocks.size(), 0);
+      const auto walk = [&] (const Block& block, auto&& visit) {
+         uint32_t live = block.exit ? exit : 0;
+         for (const Block *succ : block.succs) {
+            live |= live_in[succ->id];
+         }
+         const auto& block_transfers = transfers[block.id];
+         for (std::size_t i = block.insts.size(); i-- > 0; ) {
+            const Transfer& t = block_transfers[i];
+            if (t.out) {
+               live = *t.out;
+            }
+            visit(*block.insts[i], live);
+            live = (live & ~t.kill) | t.gen;
+         }
+         return live;
+      };
+
+      /* blocks are in address order, so visiting them in reverse follows most edges backwards */
+      bool changed;
+      do {
+         changed = false;
+         for (auto it = cfg.blocks.rbegin(); it != cfg.blocks.rend(); ++it) {
+            const uint32_t in = walk(**it, [] (Instruction<bits>&, uint32_t) {});
+            if (in != live_in[(*it)->id]) {
+               live_in[(*it)->id] = in;
+               changed = true;
+            }
+         }
+      } while (changed);
+
+      for (const auto& block : cfg.blocks) {
+         walk(*block, store);
+      }
+   }
+
+   template class CFG<Bits::M32>;
+   template class CFG<Bits::M64>;
+
+   template void backward_dataflow(const CFG<Bits::M32>& cfg, uint32_t exit,
+                                   const std::function<Transfer (const Instruction<Bits::M32>&)>&
+                                   transfer,
+                                   const std::function<void (Instruction<Bits::M32>&, uint32_t)>&
+                                   store);
+   template void backward_dataflow(const CFG<Bits::M64>& cfg, uint32_t exit,
+                                   const std::function<Transfer (const Instruction<Bits::M64>&)>&
+                                   transfer,
+                                   const std::function<void (Instruction<Bits::M64>&, uint32_t)>&
+                                   store);
+
+}
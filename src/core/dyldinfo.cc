@@ -146,6 +146,8 @@ namespace MachO {
             throw error("%s: BIND_OPCODE_THREADED not supported", __FUNCTION__);
          }
       }
+
+      reindex();
    }
       
    template <Bits bits, bool lazy>
@@ -343,6 +345,65 @@ namespace MachO {
       for (const auto other_bindee : other.bindees) {
          bindees.push_back(other_bindee->Transform(env));
       }
+      reindex();
+   }
+
+   template <Bits bits, bool lazy>
+   void BindInfo<bits, lazy>::reindex() {
+      index.clear();
+      index.reserve(bindees.size());
+      for (BindNode<bits, lazy> *node : bindees) {
+         index.emplace(node->sym, node);
+      }
+   }
+
+   template <Bits bits, bool lazy>
+   std::vector<BindNode<bits, lazy> *>
+   BindInfo<bits, lazy>::find(const std::string& sym, const DylibCommand<bits> *dylib) const {
+      std::vector<BindNode<bits, lazy> *> nodes;
+      const auto range = index.equal_range(sym);
+      for (auto it = range.first; it != range.second; ++it) {
+         if (dylib == nullptr || it->second->dylib == dylib) {
+            nodes.push_back(it->second);
+         }
+      }
+      return nodes;
+   }
+
+   template <Bits bits, bool lazy>
+   void BindInfo<bits, lazy>::rename(BindNode<bits, lazy> *node, const std::string& sym) {
+      const auto range = index.equal_range(node->sym);
+      for (auto it = range.first; it != range.second; ++it) {
+         if (it->second == node) {
+            index.erase(it);
+            break;
+         }
+      }
+      node->sym = sym;
+      index.emplace(node->sym, node);
+   }
+
+   template <Bits bits, bool lazy>
+   std::size_t BindInfo<bits, lazy>::rebind(const std::unordered_set<std::string>& syms,
+                                            const DylibCommand<bits> *dylib,
+                                            const std::string& prefix) {
+      /* collect all matches before renaming so that new names aren't matched again */
+      std::vector<BindNode<bits, lazy> *> nodes;
+      for (const std::string& sym : syms) {
+         const auto range = index.equal_range(sym);
+         for (auto it = range.first; it != range.second; ++it) {
+            nodes.push_back(it->second);
+         }
+      }
+
+      for (BindNode<bits, lazy> *node : nodes) {
+         node->dylib = dylib;
+         if (!prefix.empty()) {
+            rename(node, prefix + node->sym);
+         }
+      }
+      
+      return nodes.size();
    }
 
    template <Bits bits, bool lazy>
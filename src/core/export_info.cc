@@ -24,6 +24,7 @@ namespace MachO {
       // env.offset_resolver.resolve(value_offset, &value);
       if (value_offset > 0) {
          value = env.add_placeholder(env.archive.offset_to_vmaddr(value_offset));
+         env.code_seeds.push_back(value_offset);
       }
    }
 
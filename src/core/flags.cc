@@ -0,0 +1,60 @@
+extern "C" {
+#include <xed/xed-interface.h>
+}
+
+#include "flags.hh"
+#include "archive.hh"
+#include "cfg.hh"
+#include "section.hh"
+#include "instruction.hh"
+
+namespace MachO {
+
+   uint32_t status_flags() {
+      xed_flag_set_t set;
+      set.flat = 0;
+      set.s.of = set.s.sf = set.s.zf = set.s.af = set.s.pf = set.s.cf = 1;
+      return set.flat;
+   }
+
+   template <Bits bits>
+   void analyze_flags_liveness(Archive<bits>& archive, bool abi) {
+      const uint32_t all = status_flags();
+
+      const auto transfer = [&] (const Instruction<bits>& inst) {
+         const xed_decoded_inst_t& xedd = inst.xedd;
+         Transfer t;
+         
+         const xed_simple_flag_t *rflags = xed_decoded_inst_get_rflags_info(&xedd);
+         if (rflags) {
+            t.gen = xed_simple_flag_get_read_flag_set(rflags)->flat & all;
+            if (xed_simple_flag_get_must_write(rflags)) {
+               t.kill = (xed_simple_flag_get_written_flag_set(rflags)->flat |
+                         xed_simple_flag_get_undefined_flag_set(rflags)->flat) & all;
+            }
+         }
+
+         switch (xed_decoded_inst_get_category(&xedd)) {
+         case XED_CATEGORY_RET:
+         case XED_CATEGORY_CALL:
+            t.out = abi ? 0 : all;
+            break;
+         default:
+            break;
+         }
+         
+         return t;
+      };
+
+      for (Section<bits> *section : archive.sections()) {
+         backward_dataflow<bits>(CFG<bits>(section), all, transfer,
+                                 [] (Instruction<bits>& inst, uint32_t live) {
+                                    inst.live_flags = live;
+                                 });
+      }
+   }
+
+   template void analyze_flags_liveness(Archive<Bits::M32>& archive, bool abi);
+   template void analyze_flags_liveness(Archive<Bits::M64>& archive, bool abi);
+   
+}
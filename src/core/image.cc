@@ -79,5 +79,14 @@ namespace MachO {
       grow(offset + bytes);
       ::memset((char *) img + offset, c, bytes);
    }
+
+   void Image::truncate(std::size_t size) {
+      if (size > filesize) {
+         grow(size);
+      } else {
+         filesize = size;
+         if (ftruncate(fd, filesize) < 0) { throw cerror("ftruncate"); }
+      }
+   }
    
 }
@@ -1,3 +1,4 @@
+#include <cstdint>
 #include <unordered_map>
 
 extern "C" {
@@ -11,6 +12,7 @@ extern "C" {
 #include "transform.hh"
 #include "opcodes.hh"
 #include "section.hh"
+#include "regs.hh"
 
 namespace MachO {
 
@@ -21,7 +23,19 @@ namespace MachO {
           select_value(bits, XED_ADDRESS_WIDTH_32b, XED_ADDRESS_WIDTH_32b)
          };
 
-      typename SectionBlob<Bits::M32>::SectionBlobs push_r32(xed_reg_enum_t r32) {
+      typename SectionBlob<Bits::M32>::SectionBlobs push_r32(xed_reg_enum_t r32,
+                                                             bool clobber_flags) {
+         if (clobber_flags) {
+            /* i386 | push r32
+             * -----|---------
+             * X86  | sub rsp,4
+             *      | mov [rsp], r32
+             */
+            auto sub = new Instruction<Bits::M64>(opcode::sub_rsp_4());
+            auto mov = new Instruction<Bits::M64>(opcode::mov_mem_rsp_r32(r32));
+            return {sub, mov};
+         }
+         
          /* i386 | push r32
           * -----|---------
           * X86  | push ax
@@ -35,42 +49,53 @@ namespace MachO {
          return {push1, push2, mov};
       }
 
-      typename SectionBlob<Bits::M32>::SectionBlobs push_imm(uint32_t imm) {
+      typename SectionBlob<Bits::M32>::SectionBlobs push_imm(uint32_t imm, bool clobber_flags) {
          /* i386 | push imm32
           * -----|-----------
           * X86  | push ax
           *      | push ax
           *      | mov dword [rsp], imm
+          * With dead flags, the two pushes are replaced with `sub rsp,4'.
           */
-         auto push1 = new Instruction<Bits::M64>(opcode::push_ax());
-         auto push2 = new Instruction<Bits::M64>(opcode::push_ax());
+         typename SectionBlob<Bits::M32>::SectionBlobs insts;
+         if (clobber_flags) {
+            insts.push_back(new Instruction<Bits::M64>(opcode::sub_rsp_4()));
+         } else {
+            insts.push_back(new Instruction<Bits::M64>(opcode::push_ax()));
+            insts.push_back(new Instruction<Bits::M64>(opcode::push_ax()));
+         }
          opcode_t mov_opcode = {0xc7, 0x04, 0x24};
          opcode::push_back_imm<uint32_t>(mov_opcode, imm);
-         auto mov = new Instruction<Bits::M64>(mov_opcode);
-         return {push1, push2, mov};
+         insts.push_back(new Instruction<Bits::M64>(mov_opcode));
+         return insts;
       }
 
-      typename SectionBlob<Bits::M32>::SectionBlobs pop_r32(xed_reg_enum_t r32) {
+      typename SectionBlob<Bits::M32>::SectionBlobs pop_r32(xed_reg_enum_t r32,
+                                                            bool clobber_flags) {
          /* i386 | pop r32
           * -----|--------
           * X86  | mov r32,[rsp]
           *      | lea rsp,[rsp+4]
-          * NOTE: Shouldn't modify flags.
+          * NOTE: Shouldn't modify flags, unless they are dead (then `add rsp,4').
           */
          auto mov = new Instruction<Bits::M64>(opcode::mov_r32_mem_rsp(r32));
-         auto lea = new Instruction<Bits::M64>(opcode::lea_rsp_mem_rsp_4());
-         return {mov, lea};
+         auto adj = new Instruction<Bits::M64>(clobber_flags ? opcode::add_rsp_4() :
+                                               opcode::lea_rsp_mem_rsp_4());
+         return {mov, adj};
       }
 
-      typename SectionBlob<Bits::M32>::SectionBlobs call_op(SectionBlob<Bits::M64> *jmp_inst) {
+      typename SectionBlob<Bits::M32>::SectionBlobs call_op(SectionBlob<Bits::M64> *jmp_inst,
+                                                            bool clobber_flags,
+                                                            xed_reg_enum_t scratch) {
          /* i386 | call <op>
           * -----|----------
-          * X86  | lea r11,[rip+<size>]
-          *      | _push r11d
+          * X86  | lea <scratch>,[rip+<size>]
+          *      | _push <scratch>
           *      | jmp <op>
+          * NOTE: <op> must not read <scratch>.
           */
-         auto lea_inst = new Instruction<Bits::M64>(opcode::lea_r11_mem_rip_disp32());
-         auto push_insts = push_r32(XED_REG_R11D);
+         auto lea_inst = new Instruction<Bits::M64>(opcode::lea_r32_mem_rip_disp32(scratch));
+         auto push_insts = push_r32(scratch, clobber_flags);
          auto ret_placeholder = Placeholder<Bits::M64>::Create();
          lea_inst->memidx = 0;
          lea_inst->memdisp = ret_placeholder;
@@ -80,6 +105,81 @@ namespace MachO {
          insts.push_back(ret_placeholder);
          return insts;
       }
+
+      /* Emits a real `call' to a shared thunk that converts the 64-bit return address pushed
+       * by the call into the 32-bit return address the guest code expects, so that the
+       * matching `ret' (see XED_IFORM_RET_NEAR) is predicted by the return stack buffer.
+       * The thunk is created on first use, keyed by (_target_, _reg_), and ends with the
+       * instruction returned by _make_jmp_. Relies on code being mapped below 4GB. */
+      template <typename MakeJmp>
+      typename SectionBlob<Bits::M32>::SectionBlobs
+      rsb_call_op(TransformEnv<Bits::M32>& env, const Node *target, int reg, MakeJmp make_jmp) {
+         const auto thunk = env.call_thunk({target, reg}, [&] () {
+            /* X86 | thunk:
+             *     |   mov r11d,[rsp]
+             *     |   lea rsp,[rsp+4]
+             *     |   mov [rsp],r11d
+             *     |   jmp <op>
+             */
+            typename SectionBlob<Bits::M32>::SectionBlobs blobs;
+            blobs.push_back(Placeholder<Bits::M64>::Create());
+            blobs.push_back(new Instruction<Bits::M64>(opcode::mov_r32_mem_rsp(XED_REG_R11D)));
+            blobs.push_back(new Instruction<Bits::M64>(opcode::lea_rsp_mem_rsp_4()));
+            blobs.push_back(new Instruction<Bits::M64>(opcode::mov_mem_rsp_r32(XED_REG_R11D)));
+            blobs.push_back(make_jmp());
+            return blobs;
+         });
+
+         /* i386 | call <op>
+          * -----|-----------
+          * X86  | call thunk
+          */
+         auto call_inst = new Instruction<Bits::M64>(opcode::call_rel32());
+         call_inst->brdisp = thunk;
+         return {call_inst};
+      }
+
+      /* Turns `ff /n <mem>' into `mov <r32>,<mem>', which shares the ModRM memory operand. */
+      opcode_t mov_r32_from_mem_op(const opcode_t& instbuf, xed_reg_enum_t r32) {
+         assert(instbuf.at(0) == 0xff);
+         assert(r32 >= XED_REG_EAX && r32 <= XED_REG_R15D);
+         opcode_t mov = instbuf;
+         mov.at(0) = 0x8b;
+         mov.at(1) = (mov.at(1) & ~0x38) | (((r32 - XED_REG_EAX) % 8) << 3);
+         if (r32 >= XED_REG_R8D) {
+            mov.insert(mov.begin(), 0x44);
+         }
+         return mov;
+      }
+
+      /* If _target_ is the start of a symbol stub of the form `jmp [abs32]', returns the stub's
+       * symbol pointer; otherwise returns nullptr. */
+      const SectionBlob<Bits::M32> *stub_pointee(const SectionBlob<Bits::M32> *target) {
+         if (target == nullptr || target->section == nullptr) {
+            return nullptr;
+         }
+         
+         const std::string sectname = target->section->name();
+         if (sectname != SECT_STUBS && sectname != SECT_SYMBOL_STUB) {
+            return nullptr;
+         }
+
+         /* branch targets are placeholders, so skip ahead to the stub instruction */
+         const auto& content = target->section->content;
+         for (typename Section<Bits::M32>::Content::const_iterator it = target->iter;
+              it != content.end() && (*it)->loc.vmaddr == target->loc.vmaddr; ++it) {
+            const auto stub = dynamic_cast<const Instruction<Bits::M32> *>(*it);
+            if (stub) {
+               if (xed_decoded_inst_get_iform_enum(&stub->xedd) == XED_IFORM_JMP_MEMv &&
+                   stub->imm && stub->imm->pointee) {
+                  return stub->imm->pointee;
+               }
+               return nullptr;
+            }
+         }
+         
+         return nullptr;
+      }
       
    }
 
@@ -256,8 +356,6 @@ namespace MachO {
 
    template <Bits bits>
    void Instruction<bits>::Build(BuildEnv<bits>& env) {
-      parse_handle_relbr();
-      
       SectionBlob<bits>::Build(env);
       if (imm) {
          BuildEnv immenv(env.archive, env.loc - imm->size());
@@ -336,6 +434,8 @@ namespace MachO {
 
       if constexpr (bits == Bits::M32) {
             const auto reg0 = xed_decoded_inst_get_reg(&xedd, XED_OPERAND_REG0);
+            const bool clobber_flags = (live_flags == 0);
+            ScratchRegs scratch(live_regs);
 #if 0
             const auto reg1 = xed_decoded_inst_get_reg(&xedd, XED_OPERAND_REG1);
             const auto base_reg = xed_decoded_inst_get_base_reg(&xedd, 0);
@@ -345,19 +445,41 @@ namespace MachO {
             /* iform rules */
             switch (xed_decoded_inst_get_iform_enum(&xedd)) {
             case XED_IFORM_PUSH_GPRv_50: // push r32
-               return push_r32(reg0);
+               return push_r32(reg0, clobber_flags);
 
             case XED_IFORM_POP_GPRv_58:
-               return pop_r32(reg0);
+               return pop_r32(reg0, clobber_flags);
                
             case XED_IFORM_CALL_NEAR_GPRv: // call r32
                {
-                  auto jmp_inst = new Instruction<Bits::M64>
-                     (opcode::jmp_r64(opcode::r32_to_r64(reg0)));
-                  return call_op(jmp_inst);
+                  const auto r64 = opcode::r32_to_r64(reg0);
+                  if (env.rsb_calls && reg0 != XED_REG_ESP) {
+                     return rsb_call_op(env, nullptr, r64, [&] () {
+                        return new Instruction<Bits::M64>(opcode::jmp_r64(r64));
+                     });
+                  }
+                  scratch.reserve(reg0);
+                  auto jmp_inst = new Instruction<Bits::M64>(opcode::jmp_r64(r64));
+                  return call_op(jmp_inst, clobber_flags, scratch.r32());
                }
 
             case XED_IFORM_CALL_NEAR_MEMv:
+               if (env.rsb_calls && memdisp == nullptr && instbuf.at(0) == 0xff) {
+                  /* i386 | call [mem]
+                   * -----|------------------
+                   * X86  | mov <scratch>,[mem]
+                   *      | call thunk(<scratch>)
+                   * NOTE: The thunk itself clobbers r11.
+                   */
+                  scratch.reserve(XED_REG_R11D);
+                  const auto tmp = scratch.r32();
+                  const auto tmp64 = opcode::r32_to_r64(tmp);
+                  auto insts = rsb_call_op(env, nullptr, tmp64, [&] () {
+                     return new Instruction<Bits::M64>(opcode::jmp_r64(tmp64));
+                  });
+                  insts.push_front(new Instruction<Bits::M64>(mov_r32_from_mem_op(instbuf, tmp)));
+                  return insts;
+               }
                {
                   auto jmp = instbuf;
                   assert((jmp.at(1) & 0x30) == 0x20);
@@ -365,15 +487,44 @@ namespace MachO {
                   auto jmp_inst = new Instruction<Bits::M64>(jmp);
                   env.resolve(brdisp, &jmp_inst->brdisp);
                   env.resolve(memdisp, &jmp_inst->memdisp);
-                  return call_op(jmp_inst);
+                  for (unsigned i = 0; i < xed_decoded_inst_number_of_memory_operands(&xedd); ++i) {
+                     scratch.reserve(xed_decoded_inst_get_base_reg(&xedd, i));
+                     scratch.reserve(xed_decoded_inst_get_index_reg(&xedd, i));
+                  }
+                  return call_op(jmp_inst, clobber_flags, scratch.r32());
                }
 
             case XED_IFORM_CALL_NEAR_RELBRz:
+               if (env.direct_stub_calls) {
+                  if (const auto symptr = stub_pointee(brdisp)) {
+                     /* i386 | call <stub>
+                      * -----|---------------------------
+                      * X86  | _call [rip+<symbol pointer>]
+                      */
+                     auto make_jmp = [&] () {
+                        auto jmp_inst = new Instruction<Bits::M64>(opcode::jmp_mem_rip_disp32());
+                        jmp_inst->memidx = 0;
+                        env.resolve(symptr, &jmp_inst->memdisp);
+                        return jmp_inst;
+                     };
+                     if (env.rsb_calls) {
+                        return rsb_call_op(env, symptr, XED_REG_INVALID, make_jmp);
+                     }
+                     return call_op(make_jmp(), clobber_flags, scratch.r32());
+                  }
+               }
+               if (env.rsb_calls && memdisp == nullptr && brdisp != nullptr) {
+                  return rsb_call_op(env, brdisp, XED_REG_INVALID, [&] () {
+                     auto jmp_inst = new Instruction<Bits::M64>({0xe9, 0x00, 0x00, 0x00, 0x00});
+                     env.resolve(brdisp, &jmp_inst->brdisp);
+                     return jmp_inst;
+                  });
+               }
                {
                   auto jmp_inst = new Instruction<Bits::M64>({0xe9, 0x00, 0x00, 0x00, 0x00});
                   env.resolve(memdisp, &jmp_inst->memdisp);
                   env.resolve(brdisp, &jmp_inst->brdisp);
-                  return call_op(jmp_inst);
+                  return call_op(jmp_inst, clobber_flags, scratch.r32());
                }
                
             case XED_IFORM_CALL_NEAR_RELBRd:
@@ -381,13 +532,31 @@ namespace MachO {
                
             case XED_IFORM_RET_NEAR:
                {
+                  const auto tmp = scratch.r32();
+                  const auto tmp64 = opcode::r32_to_r64(tmp);
+                  if (env.rsb_calls) {
+                     /* i386 | ret
+                      * -----|-----------------------
+                      * X86  | lea rsp,[rsp-4]
+                      *      | mov <scratch>d,[rsp+4]
+                      *      | mov [rsp],<scratch>
+                      *      | ret
+                      * Widens the 32-bit return address in place, so the real `ret' pairs with
+                      * the `call' emitted by rsb_call_op().
+                      */
+                     return {new Instruction<Bits::M64>(opcode::lea_rsp_mem_rsp_disp(-4)),
+                             new Instruction<Bits::M64>(opcode::mov_r32_mem_rsp_disp(tmp, 4)),
+                             new Instruction<Bits::M64>(opcode::mov_mem_rsp_r64(tmp64)),
+                             new Instruction<Bits::M64>(opcode::ret())};
+                  }
+                  
                   /* i386 | ret
                    * -----|-----
-                   * X86  | _pop32 r11d
-                   *      | jmp r11d
+                   * X86  | _pop32 <scratch>
+                   *      | jmp <scratch>
                    */
-                  auto insts = pop_r32(XED_REG_R11D);
-                  auto jmp_inst = new Instruction<opposite<bits>>(opcode::jmp_r64(XED_REG_R11));
+                  auto insts = pop_r32(tmp, clobber_flags);
+                  auto jmp_inst = new Instruction<opposite<bits>>(opcode::jmp_r64(tmp64));
                   insts.push_back(jmp_inst);
                   return insts;
                }
@@ -410,28 +579,27 @@ namespace MachO {
 
             case XED_IFORM_PUSH_MEMv:
                {
-                  opcode_t mov_buf = instbuf;
-                  uint8_t mov_byte = mov_buf.at(1);
-                  mov_buf.front() = 0x8b;
-                  mov_buf.insert(mov_buf.begin(), 0x44);
-                  assert(mov_byte & (1 << 5));
-                  mov_byte ^= 1 << 5;
-                  assert((mov_byte & (1 << 3)) == 0);
-                  mov_byte ^= 1 << 3;
-                  mov_buf.at(2) = mov_byte;
+                  /* i386 | push [mem]
+                   * -----|--------------------
+                   * X86  | mov <scratch>,[mem]
+                   *      | _push <scratch>
+                   */
+                  const auto tmp = scratch.r32();
                   typename SectionBlob<Bits::M32>::SectionBlobs insts;
-                  auto mov_inst = new Instruction<opposite<bits>>(mov_buf);
+                  auto mov_inst = new Instruction<opposite<bits>>(mov_r32_from_mem_op(instbuf, tmp));
                   insts.push_back(mov_inst);
-                  insts.splice(insts.end(), push_r32(XED_REG_R11D));
+                  insts.splice(insts.end(), push_r32(tmp, clobber_flags));
                   return insts;
                }
 
             case XED_IFORM_PUSH_IMMb:
             case XED_IFORM_PUSH_IMMz:
                if (xed_decoded_inst_get_immediate_is_signed(&xedd)) {
-                  return push_imm(xed_decoded_inst_get_signed_immediate(&xedd));
+                  return push_imm(xed_decoded_inst_get_signed_immediate(&xedd),
+                                  clobber_flags);
                } else {
-                  return push_imm(xed_decoded_inst_get_unsigned_immediate(&xedd));
+                  return push_imm(xed_decoded_inst_get_unsigned_immediate(&xedd),
+                                  clobber_flags);
                }
                
             default: break;
@@ -490,6 +658,36 @@ namespace MachO {
       decode(xedd, instbuf);
    }
 
+   template <Bits bits>
+   bool Instruction<bits>::short_branch() const {
+      return xed_decoded_inst_get_branch_displacement_width_bits(&xedd) == 8;
+   }
+
+   template <Bits bits>
+   bool Instruction<bits>::relax() {
+      if (!this->active || !short_branch()) {
+         return false;
+      }
+
+      /* without a resolved target the original rel8 displacement cannot be trusted */
+      if (brdisp != nullptr) {
+         const ssize_t disp = brdisp->loc.vmaddr - (ssize_t) (this->loc.vmaddr + size());
+         if (disp >= INT8_MIN && disp <= INT8_MAX) {
+            return false;
+         }
+      }
+
+      widen();
+      return true;
+   }
+
+   template <Bits bits>
+   void Instruction<bits>::widen() {
+      if (short_branch()) {
+         parse_handle_relbr();
+      }
+   }
+
    /* NOTE: Requires that instruction has already been decode()'ed. */
    template <Bits bits>
    void Instruction<bits>::parse_handle_relbr() {
@@ -535,7 +733,9 @@ namespace MachO {
          instbuf = {0xe9, relbru, 0x00, 0x00, 0x00};
          break;
          
-      default: abort();
+      default:
+         throw error("%s: branch at vmaddr 0x%zx (iform %s) has no rel32 form", __FUNCTION__,
+                     this->loc.vmaddr, xed_iform_enum_t2str(xed_decoded_inst_get_iform_enum(&xedd)));
       }
 
       /* re-decode after modifications to buffer */
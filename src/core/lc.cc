@@ -113,6 +113,7 @@ namespace MachO {
    EntryPoint<bits>::EntryPoint(const Image& img, std::size_t offset, ParseEnv<bits>& env):
       LoadCommand<bits>(img, offset, env), entry_point(img.at<entry_point_command>(offset))
    {
+      env.code_seeds.push_back(entry_point.entryoff);
       // env.offset_resolver.resolve(entry_point.entryoff, &entry);
    }
 
@@ -54,6 +54,7 @@ namespace MachO {
          // it += leb128_decode(&img.at<uint8_t>(it), img.size() - it, uleb);
          if (uleb != 0 || refaddr == segment->loc().offset) {
             refaddr += uleb;
+            env.code_seeds.push_back(refaddr);
             std::optional<std::size_t> vmaddr = env.archive.try_offset_to_vmaddr(refaddr);
             if (vmaddr) {
                entries.push_back(env.add_placeholder(*vmaddr));
@@ -10,6 +10,8 @@ extern "C" {
 #include "error.hh"
 
 namespace MachO {
+
+   ParseOptions parse_options;
    
    void init() {
       xed_tables_init();
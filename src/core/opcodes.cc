@@ -1,3 +1,7 @@
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+
 #include "opcodes.hh"
 #include "section_blob.hh"
 
@@ -18,6 +22,34 @@ namespace MachO::opcode {
       void encode_int(opcode_t& opcode, T val) {
          encode_int(std::back_inserter(opcode), val);
       }
+
+      /* register number of a 16-, 32- or 64-bit GPR */
+      unsigned reg_num(xed_reg_enum_t reg) {
+         if (reg >= XED_REG_AX && reg <= XED_REG_R15W) {
+            return reg - XED_REG_AX;
+         } else if (reg >= XED_REG_EAX && reg <= XED_REG_R15D) {
+            return reg - XED_REG_EAX;
+         } else if (reg >= XED_REG_RAX && reg <= XED_REG_R15) {
+            return reg - XED_REG_RAX;
+         }
+         throw std::invalid_argument("not a general purpose register");
+      }
+
+      /* append ModRM, SIB and displacement bytes for [rsp + disp] */
+      void encode_mem_rsp_disp(opcode_t& opcode, unsigned reg, int32_t disp) {
+         if (disp == 0) {
+            opcode.push_back(0x04 | ((reg % 8) << 3));
+            opcode.push_back(0x24);
+         } else if (disp >= INT8_MIN && disp <= INT8_MAX) {
+            opcode.push_back(0x44 | ((reg % 8) << 3));
+            opcode.push_back(0x24);
+            encode_int(opcode, (int8_t) disp);
+         } else {
+            opcode.push_back(0x84 | ((reg % 8) << 3));
+            opcode.push_back(0x24);
+            encode_int(opcode, disp);
+         }
+      }
       
    }
    
@@ -80,6 +112,32 @@ namespace MachO::opcode {
       return opcode;
    }
 
+   opcode_t nop(std::size_t max_len) {
+      static const opcode_t nops[] =
+         {{0x90},
+          {0x66, 0x90},
+          {0x0f, 0x1f, 0x00},
+          {0x0f, 0x1f, 0x40, 0x00},
+          {0x0f, 0x1f, 0x44, 0x00, 0x00},
+          {0x66, 0x0f, 0x1f, 0x44, 0x00, 0x00},
+          {0x0f, 0x1f, 0x80, 0x00, 0x00, 0x00, 0x00},
+          {0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+          {0x66, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+         };
+      constexpr std::size_t nnops = sizeof(nops) / sizeof(*nops);
+      if (max_len == 0) {
+         throw std::invalid_argument("nop must be at least 1 byte");
+      }
+      return nops[std::min(max_len, nnops) - 1];
+   }
+
+   opcode_t mov_mem_rsp_r64(xed_reg_enum_t r64) {
+      assert(r64 >= XED_REG_RAX && r64 <= XED_REG_R15);
+      const uint8_t byte = 0x04 | (((r64 - XED_REG_RAX) % 8) << 3);
+      const uint8_t rex = (r64 >= XED_REG_R8) ? 0x4c : 0x48;
+      return {rex, 0x89, byte, 0x24};
+   }
+
    opcode_t jmp_r64(xed_reg_enum_t r64) {
       assert(r64 >= XED_REG_RAX && r64 <= XED_REG_R15);
       const uint8_t byte = 0xe0 | ((r64 - XED_REG_RAX) % 8);
@@ -91,9 +149,13 @@ namespace MachO::opcode {
    }
 
    opcode_t lea_r32_mem_rip_disp32(xed_reg_enum_t r32) {
-      assert(r32 >= XED_REG_EAX && r32 <= XED_REG_EDI);
-      const uint8_t byte = 0x5 | ((r32 - XED_REG_EAX) << 3);
-      return {0x8d, byte, 0x00, 0x00, 0x00, 0x00};
+      assert(r32 >= XED_REG_EAX && r32 <= XED_REG_R15D);
+      const uint8_t byte = 0x5 | (((r32 - XED_REG_EAX) % 8) << 3);
+      opcode_t opcode = {0x8d, byte, 0x00, 0x00, 0x00, 0x00};
+      if (r32 >= XED_REG_R8D) {
+         opcode.insert(opcode.begin(), 0x44);
+      }
+      return opcode;
    }
 
    opcode_t mov_r32_imm32(xed_reg_enum_t r32) {
@@ -108,4 +170,90 @@ namespace MachO::opcode {
       return {0x44, 0x8b, byte};
    }
 
+   opcode_t lea_rsp_mem_rsp_disp(int32_t disp) {
+      opcode_t opcode = {0x48, 0x8d};
+      encode_mem_rsp_disp(opcode, reg_num(XED_REG_RSP), disp);
+      return opcode;
+   }
+
+   opcode_t add_rsp_imm(int32_t imm) {
+      assert(imm != INT32_MIN);
+      const bool sub = imm < 0;
+      const int32_t absimm = sub ? -imm : imm;
+      const uint8_t modrm = sub ? 0xec : 0xc4;
+      if (absimm <= INT8_MAX) {
+         return {0x48, 0x83, modrm, (uint8_t) absimm};
+      } else {
+         opcode_t opcode = {0x48, 0x81, modrm};
+         encode_int(opcode, absimm);
+         return opcode;
+      }
+   }
+
+   opcode_t mov_mem_rsp_disp_reg(int32_t disp, xed_reg_enum_t reg) {
+      const unsigned num = reg_num(reg);
+      opcode_t opcode;
+      if (reg >= XED_REG_AX && reg <= XED_REG_R15W) {
+         opcode.push_back(0x66);
+      }
+      if (num >= 8) {
+         opcode.push_back(0x44);
+      }
+      opcode.push_back(0x89);
+      encode_mem_rsp_disp(opcode, num, disp);
+      return opcode;
+   }
+
+   opcode_t mov_mem_rsp_disp_imm32(int32_t disp, uint32_t imm) {
+      opcode_t opcode = {0xc7};
+      encode_mem_rsp_disp(opcode, 0, disp);
+      encode_int(opcode, imm);
+      return opcode;
+   }
+
+   opcode_t mov_mem_rsp_disp_simm32_64(int32_t disp, uint32_t imm) {
+      opcode_t opcode = {0x48, 0xc7};
+      encode_mem_rsp_disp(opcode, 0, disp);
+      encode_int(opcode, imm);
+      return opcode;
+   }
+
+   opcode_t mov_r32_mem_rsp_disp(xed_reg_enum_t r32, int32_t disp) {
+      assert(r32 >= XED_REG_EAX && r32 <= XED_REG_R15D);
+      const unsigned num = reg_num(r32);
+      opcode_t opcode;
+      if (num >= 8) {
+         opcode.push_back(0x44);
+      }
+      opcode.push_back(0x8b);
+      encode_mem_rsp_disp(opcode, num, disp);
+      return opcode;
+   }
+
+   opcode_t mov_r32_r32(xed_reg_enum_t dst, xed_reg_enum_t src) {
+      assert(dst >= XED_REG_EAX && dst <= XED_REG_R15D);
+      assert(src >= XED_REG_EAX && src <= XED_REG_R15D);
+      const unsigned dstnum = reg_num(dst);
+      const unsigned srcnum = reg_num(src);
+      opcode_t opcode;
+      if (dstnum >= 8 || srcnum >= 8) {
+         opcode.push_back(0x40 | ((srcnum >= 8) << 2) | (dstnum >= 8));
+      }
+      opcode.push_back(0x89);
+      opcode.push_back(0xc0 | ((srcnum % 8) << 3) | (dstnum % 8));
+      return opcode;
+   }
+
+   opcode_t mov_r32_imm32(xed_reg_enum_t r32, uint32_t imm) {
+      assert(r32 >= XED_REG_EAX && r32 <= XED_REG_R15D);
+      const unsigned num = reg_num(r32);
+      opcode_t opcode;
+      if (num >= 8) {
+         opcode.push_back(0x41);
+      }
+      opcode.push_back(0xb8 | (num % 8));
+      encode_int(opcode, imm);
+      return opcode;
+   }
+
 }
@@ -1,5 +1,8 @@
 #include "parse.hh"
+#include "archive.hh"
+#include "section.hh"
 #include "section_blob.hh"
+#include "trace.hh"
 
 namespace MachO {
 
@@ -69,8 +72,35 @@ namespace MachO {
       }
    }
 
+   template <Bits bits>
+   void ParseEnv<bits>::split_data(Section<bits>& section, std::size_t vmaddr) {
+      if (DataRange<bits> *range = section.split_data(vmaddr)) {
+         vmaddr_resolver.add(range->loc.vmaddr, range);
+         offset_resolver.add(range->loc.offset, range);
+      }
+   }
+
    template <Bits bits>
    void ParseEnv<bits>::do_resolve() {
+      Trace::Span span("ParseEnv::do_resolve");
+
+      /* references into the middle of a data range get a blob of their own */
+      for (Section<bits> *section : archive.sections()) {
+         if (section->data_ranges.empty()) {
+            continue;
+         }
+         for (const auto& todo : vmaddr_resolver.todo) {
+            if (section->contains_vmaddr(todo.first)) {
+               split_data(*section, todo.first);
+            }
+         }
+         for (const auto& todo : offset_resolver.todo) {
+            if (section->contains_offset(todo.first)) {
+               split_data(*section, todo.first - section->sect.offset + section->sect.addr);
+            }
+         }
+      }
+      
       offset_resolver.do_resolve();
       vmaddr_resolver.do_resolve();
    }
@@ -0,0 +1,420 @@
+#include <optional>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <mach-o/loader.h>
+
+extern "C" {
+#include <xed/xed-interface.h>
+}
+
+#include "peephole.hh"
+#include "archive.hh"
+#include "section.hh"
+#include "section_blob.hh"
+#include "instruction.hh"
+#include "opcodes.hh"
+
+namespace MachO {
+
+   namespace {
+
+      /* Stack operation, with addresses relative to the stack pointer at the start of the run. */
+      struct StackOp {
+         enum class Kind {ADJUST, STORE_REG, STORE_IMM, LOAD, MOV_REG, MOV_IMM, NOP} kind;
+         int64_t addr = 0;      /*!< ADJUST: delta; loads/stores: address */
+         unsigned size = 0;     /*!< access size in bytes */
+         xed_reg_enum_t reg = XED_REG_INVALID; /*!< source of stores, destination otherwise */
+         xed_reg_enum_t src = XED_REG_INVALID; /*!< MOV_REG source */
+         uint32_t imm = 0;
+         bool clobbers_flags = false;
+         bool dead = false;
+
+         StackOp(Kind kind): kind(kind) {}
+
+         bool is_store() const { return kind == Kind::STORE_REG || kind == Kind::STORE_IMM; }
+         bool overlaps(const StackOp& other) const {
+            return addr < other.addr + other.size && other.addr < addr + size;
+         }
+         bool covers(const StackOp& other) const {
+            return addr <= other.addr && other.addr + other.size <= addr + size;
+         }
+         /* register written by this operation, if any */
+         xed_reg_enum_t def() const {
+            switch (kind) {
+            case Kind::LOAD:
+            case Kind::MOV_REG:
+            case Kind::MOV_IMM:
+               return xed_get_largest_enclosing_register(reg);
+            default:
+               return XED_REG_INVALID;
+            }
+         }
+      };
+
+      bool is_rsp_slot(const xed_decoded_inst_t& xedd) {
+         return xed_decoded_inst_get_base_reg(&xedd, 0) == XED_REG_RSP &&
+            xed_decoded_inst_get_index_reg(&xedd, 0) == XED_REG_INVALID;
+      }
+
+      bool is_gpr(xed_reg_enum_t reg, unsigned width) {
+         switch (width) {
+         case 16: return reg >= XED_REG_AX && reg <= XED_REG_R15W && reg != XED_REG_SP;
+         case 32: return reg >= XED_REG_EAX && reg <= XED_REG_R15D && reg != XED_REG_ESP;
+         default: return false;
+         }
+      }
+
+      /**
+       * Decompose instruction into stack operations.
+       * @param delta stack pointer offset before the instruction
+       * @return empty if instruction can't be part of a run
+       */
+      std::vector<StackOp> classify(const Instruction<Bits::M64> *inst, int64_t delta) {
+         using Kind = StackOp::Kind;
+         
+         if (!inst->active || inst->memdisp || inst->brdisp || inst->imm || inst->reloc) {
+            return {};
+         }
+         
+         const xed_decoded_inst_t& xedd = inst->xedd;
+         const xed_reg_enum_t reg0 = xed_decoded_inst_get_reg(&xedd, XED_OPERAND_REG0);
+         const unsigned width = xed_decoded_inst_get_operand_width(&xedd);
+         const int64_t disp = xed_decoded_inst_get_memory_displacement(&xedd, 0);
+
+         switch (xed_decoded_inst_get_iform_enum(&xedd)) {
+         case XED_IFORM_PUSH_GPRv_50:
+            if (width == 16 && is_gpr(reg0, 16)) {
+               StackOp adj(Kind::ADJUST);
+               adj.addr = -2;
+               StackOp store(Kind::STORE_REG);
+               store.addr = delta - 2;
+               store.size = 2;
+               store.reg = reg0;
+               return {adj, store};
+            }
+            break;
+
+         case XED_IFORM_LEA_GPRv_AGEN:
+            if (reg0 == XED_REG_RSP && is_rsp_slot(xedd)) {
+               StackOp adj(Kind::ADJUST);
+               adj.addr = disp;
+               return {adj};
+            } else if (width == 32 && disp == 0 &&
+                       xed_decoded_inst_get_index_reg(&xedd, 0) == XED_REG_INVALID &&
+                       xed_decoded_inst_get_base_reg(&xedd, 0) ==
+                       xed_get_largest_enclosing_register(reg0) &&
+                       reg0 >= XED_REG_EAX && reg0 <= XED_REG_EDI && reg0 != XED_REG_ESP) {
+               /* lea r32, [r64] only clears the (already clear) upper half of a guest register */
+               return {StackOp(Kind::NOP)};
+            }
+            break;
+
+         case XED_IFORM_ADD_GPRv_IMMb:
+         case XED_IFORM_ADD_GPRv_IMMz:
+         case XED_IFORM_SUB_GPRv_IMMb:
+         case XED_IFORM_SUB_GPRv_IMMz:
+            if (reg0 == XED_REG_RSP) {
+               const xed_iclass_enum_t iclass = xed_decoded_inst_get_iclass(&xedd);
+               const int64_t imm = xed_decoded_inst_get_signed_immediate(&xedd);
+               StackOp adj(Kind::ADJUST);
+               adj.addr = iclass == XED_ICLASS_ADD ? imm : -imm;
+               adj.clobbers_flags = true;
+               return {adj};
+            }
+            break;
+
+         case XED_IFORM_MOV_MEMv_GPRv:
+            if (is_rsp_slot(xedd) && (width == 16 || width == 32) && is_gpr(reg0, width)) {
+               StackOp store(Kind::STORE_REG);
+               store.addr = delta + disp;
+               store.size = width / 8;
+               store.reg = reg0;
+               return {store};
+            }
+            break;
+
+         case XED_IFORM_MOV_MEMv_IMMz:
+            if (is_rsp_slot(xedd) && width == 32) {
+               StackOp store(Kind::STORE_IMM);
+               store.addr = delta + disp;
+               store.size = 4;
+               store.imm = xed_decoded_inst_get_unsigned_immediate(&xedd);
+               return {store};
+            }
+            break;
+
+         case XED_IFORM_MOV_GPRv_MEMv:
+            if (is_rsp_slot(xedd) && width == 32 && is_gpr(reg0, 32)) {
+               StackOp load(Kind::LOAD);
+               load.addr = delta + disp;
+               load.size = 4;
+               load.reg = reg0;
+               return {load};
+            }
+            break;
+
+         default:
+            break;
+         }
+
+         return {};
+      }
+
+      /* Forward stored values to later loads of the same slot. */
+      void forward_loads(std::vector<StackOp>& ops) {
+         using Kind = StackOp::Kind;
+         for (auto load = ops.begin(); load != ops.end(); ++load) {
+            if (load->kind != Kind::LOAD) {
+               continue;
+            }
+
+            /* find most recent write to overlapping bytes */
+            auto store = std::make_reverse_iterator(load);
+            while (store != ops.rend() && !(store->is_store() && store->overlaps(*load))) {
+               ++store;
+            }
+            if (store == ops.rend() || store->addr != load->addr || store->size != load->size) {
+               continue;
+            }
+
+            if (store->kind == Kind::STORE_IMM) {
+               load->kind = Kind::MOV_IMM;
+               load->imm = store->imm;
+               continue;
+            }
+
+            /* source register must not have been redefined in between */
+            const xed_reg_enum_t src = xed_get_largest_enclosing_register(store->reg);
+            const bool redefined = std::any_of(store.base(), load, [&] (const StackOp& op) {
+               return op.def() == src;
+            });
+            if (!redefined) {
+               load->kind = Kind::MOV_REG;
+               load->src = store->reg;
+            }
+         }
+      }
+
+      /* Mark stores that are overwritten or popped off before being read. */
+      void eliminate_dead_stores(std::vector<StackOp>& ops, int64_t final_delta) {
+         using Kind = StackOp::Kind;
+         for (auto store = ops.begin(); store != ops.end(); ++store) {
+            if (!store->is_store()) {
+               continue;
+            }
+
+            bool read = false;
+            bool overwritten = false;
+            for (auto it = std::next(store); it != ops.end() && !read && !overwritten; ++it) {
+               if (it->kind == Kind::LOAD && it->overlaps(*store)) {
+                  read = true;
+               } else if (it->is_store() && !it->dead && it->covers(*store)) {
+                  overwritten = true;
+               }
+            }
+
+            if (!read && (overwritten || store->addr + store->size <= final_delta)) {
+               store->dead = true;
+            }
+         }
+      }
+
+      /**
+       * Generate optimized sequence for run of stack operations.
+       * @param final_delta stack pointer offset at end of run
+       * @return nothing if stack adjustments are out of range
+       */
+      std::optional<std::vector<opcode_t>> generate(std::vector<StackOp>& ops,
+                                                    int64_t final_delta) {
+         using Kind = StackOp::Kind;
+
+         forward_loads(ops);
+         eliminate_dead_stores(ops, final_delta);
+
+         /* only clobber flags if every original adjustment did */
+         bool clobber_flags = true;
+         bool any_adjust = false;
+         int64_t min_addr = 0;
+         for (const StackOp& op : ops) {
+            if (op.kind == Kind::ADJUST) {
+               any_adjust = true;
+               clobber_flags &= op.clobbers_flags;
+            } else if ((op.is_store() && !op.dead) || op.kind == Kind::LOAD) {
+               min_addr = std::min(min_addr, op.addr);
+            }
+         }
+         clobber_flags &= any_adjust;
+
+         /* move stack pointer down before any accesses and up after them */
+         const int64_t pre = final_delta <= min_addr ? final_delta : min_addr;
+         const int64_t post = final_delta - pre;
+         /* INT32_MIN is excluded since add_rsp_imm() encodes a negative delta as sub of -delta */
+         const auto in_range = [] (int64_t delta) {
+            return delta > INT32_MIN && delta <= INT32_MAX;
+         };
+         if (!in_range(pre) || !in_range(post)) {
+            return std::nullopt;
+         }
+         
+         const auto adjust = [&] (int32_t delta) {
+            return clobber_flags ? opcode::add_rsp_imm(delta) :
+               opcode::lea_rsp_mem_rsp_disp(delta);
+         };
+
+         std::vector<opcode_t> opcodes;
+         if (pre) {
+            opcodes.push_back(adjust(pre));
+         }
+         for (auto it = ops.begin(); it != ops.end(); ++it) {
+            const StackOp& op = *it;
+            const int32_t disp = op.addr - pre;
+            switch (op.kind) {
+            case Kind::STORE_REG:
+               if (!op.dead) {
+                  opcodes.push_back(opcode::mov_mem_rsp_disp_reg(disp, op.reg));
+               }
+               break;
+            case Kind::STORE_IMM:
+               if (!op.dead) {
+                  /* merge with adjacent 4-byte store if the pair is a sign-extended imm32 */
+                  auto next = std::find_if(std::next(it), ops.end(), [] (const StackOp& other) {
+                     return !(other.kind == Kind::ADJUST || other.kind == Kind::NOP || other.dead);
+                  });
+                  if (next != ops.end() && next->kind == Kind::STORE_IMM &&
+                      std::abs(next->addr - op.addr) == 4) {
+                     const StackOp& lo = op.addr < next->addr ? op : *next;
+                     const StackOp& hi = op.addr < next->addr ? *next : op;
+                     if (hi.imm == ((int32_t) lo.imm < 0 ? UINT32_MAX : 0)) {
+                        opcodes.push_back(opcode::mov_mem_rsp_disp_simm32_64(lo.addr - pre,
+                                                                             lo.imm));
+                        next->dead = true;
+                        break;
+                     }
+                  }
+                  opcodes.push_back(opcode::mov_mem_rsp_disp_imm32(disp, op.imm));
+               }
+               break;
+            case Kind::LOAD:
+               opcodes.push_back(opcode::mov_r32_mem_rsp_disp(op.reg, disp));
+               break;
+            case Kind::MOV_REG:
+               opcodes.push_back(opcode::mov_r32_r32(op.reg, op.src));
+               break;
+            case Kind::MOV_IMM:
+               opcodes.push_back(opcode::mov_r32_imm32(op.reg, op.imm));
+               break;
+            case Kind::ADJUST:
+            case Kind::NOP:
+               break;
+            }
+         }
+         if (post) {
+            opcodes.push_back(adjust(post));
+         }
+
+         return opcodes;
+      }
+
+      std::size_t total_size(const std::vector<opcode_t>& opcodes) {
+         std::size_t size = 0;
+         for (const opcode_t& opcode : opcodes) {
+            size += opcode.size();
+         }
+         return size;
+      }
+
+      /**
+       * Optimize run [begin, end) of instructions.
+       * @return number of instructions saved
+       */
+      std::size_t optimize_run(Section<Bits::M64>& section,
+                               Section<Bits::M64>::Content::iterator begin,
+                               Section<Bits::M64>::Content::iterator end,
+                               std::vector<StackOp>& ops, int64_t final_delta) {
+         const std::size_t old_count = std::distance(begin, end);
+         std::size_t old_size = 0;
+         for (auto it = begin; it != end; ++it) {
+            old_size += (*it)->size();
+         }
+
+         const auto new_opcodes = generate(ops, final_delta);
+         if (!new_opcodes) {
+            return 0;
+         }
+         const std::vector<opcode_t>& opcodes = *new_opcodes;
+         if (opcodes.size() > old_count ||
+             (opcodes.size() == old_count && total_size(opcodes) >= old_size)) {
+            return 0;
+         }
+
+         /* deactivate old instructions and insert replacement after them, so that any
+          * references to the old instructions land at the start of the replacement */
+         const SectionBlob<Bits::M64> *first = *begin;
+         for (auto it = begin; it != end; ++it) {
+            (*it)->active = false;
+         }
+         for (const opcode_t& opcode : opcodes) {
+            auto inst = new Instruction<Bits::M64>(opcode);
+            inst->segment = first->segment;
+            inst->section = first->section;
+            section.content.insert(end, inst);
+         }
+
+         return old_count - opcodes.size();
+      }
+      
+   }
+
+   std::size_t peephole(Section<Bits::M64>& section) {
+      using Content = Section<Bits::M64>::Content;
+      std::size_t saved = 0;
+
+      Content::iterator run_begin = section.content.end();
+      std::vector<StackOp> ops;
+      int64_t delta = 0;
+      
+      const auto finish_run = [&] (Content::iterator run_end) {
+         if (run_begin != section.content.end()) {
+            saved += optimize_run(section, run_begin, run_end, ops, delta);
+         }
+         run_begin = section.content.end();
+         ops.clear();
+         delta = 0;
+      };
+
+      for (auto it = section.content.begin(); it != section.content.end(); ++it) {
+         auto inst = dynamic_cast<Instruction<Bits::M64> *>(*it);
+         const std::vector<StackOp> inst_ops =
+            inst ? classify(inst, delta) : std::vector<StackOp>();
+         if (inst_ops.empty()) {
+            finish_run(it);
+            continue;
+         }
+
+         if (run_begin == section.content.end()) {
+            run_begin = it;
+         }
+         for (const StackOp& op : inst_ops) {
+            if (op.kind == StackOp::Kind::ADJUST) {
+               delta += op.addr;
+            }
+            ops.push_back(op);
+         }
+      }
+      finish_run(section.content.end());
+
+      return saved;
+   }
+
+   std::size_t peephole(Archive<Bits::M64>& archive) {
+      std::size_t saved = 0;
+      for (Section<Bits::M64> *section : archive.sections()) {
+         if (section->name() == SECT_TEXT) {
+            saved += peephole(*section);
+         }
+      }
+      return saved;
+   }
+
+}
@@ -0,0 +1,129 @@
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include <mach-o/loader.h>
+
+#include "abiconv/printf-plan.hh"
+
+#include "printf_plans.hh"
+#include "archive.hh"
+#include "segment.hh"
+#include "section.hh"
+#include "section_blob.hh"
+#include "instruction.hh"
+
+namespace MachO {
+
+   namespace {
+      template <Bits bits>
+      struct Plan {
+         const SectionBlob<bits> *format; /*!< first byte of format string */
+         std::vector<uint8_t> ops;
+      };
+
+      template <Bits bits>
+      void push_back_u32(typename Section<bits>::Content& content, uint32_t value,
+                         const SectionBlob<bits> *pointee = nullptr) {
+         auto imm = Immediate<bits>::Create(value);
+         imm->pointee = pointee;
+         content.push_back(imm);
+      }
+   }
+
+   template <Bits bits>
+   std::size_t emit_printf_plans(Archive<bits>& archive) {
+      Segment<bits> *text = archive.segment(SEG_TEXT);
+      if (text == nullptr || text->section(PRINTF_PLAN_SECTNAME) != nullptr) {
+         return 0;
+      }
+      
+      /* strings referenced by code */
+      std::unordered_set<const SectionBlob<bits> *> refs;
+      for (Section<bits> *section : archive.sections()) {
+         for (const SectionBlob<bits> *blob : section->content) {
+            if (const auto inst = dynamic_cast<const Instruction<bits> *>(blob)) {
+               if (!inst->active) {
+                  continue;
+               }
+               if (inst->imm && inst->imm->pointee) {
+                  refs.insert(inst->imm->pointee);
+               }
+               if (inst->memdisp) {
+                  refs.insert(inst->memdisp);
+               }
+            }
+         }
+      }
+
+      /* compile referenced strings, in address order */
+      std::vector<Plan<bits>> plans;
+      for (Section<bits> *section : archive.sections()) {
+         if ((section->sect.flags & SECTION_TYPE) != S_CSTRING_LITERALS) {
+            continue;
+         }
+         
+         bool referenced = false; /* whether a marker before the current blob is referenced */
+         auto& content = section->content;
+         for (auto it = content.begin(); it != content.end(); ++it) {
+            referenced = referenced || refs.count(*it);
+            const auto start = dynamic_cast<const DataBlob<bits> *>(*it);
+            if (start == nullptr) {
+               continue;
+            }
+            if (!referenced) {
+               continue;
+            }
+            referenced = false;
+
+            std::string format;
+            for (auto str_it = it; str_it != content.end(); ++str_it) {
+               if (const auto byte = dynamic_cast<const DataBlob<bits> *>(*str_it)) {
+                  if (byte->data == '\0') {
+                     break;
+                  }
+                  format.push_back(byte->data);
+               }
+            }
+            if (format.find('%') == std::string::npos) {
+               continue;
+            }
+
+            std::vector<uint8_t> ops(PRINTF_PLAN_MAX_OPS);
+            const int nops = printf_plan::compile(format.c_str(), ops.data());
+            if (nops >= 0) {
+               ops.resize(nops);
+               plans.push_back({start, std::move(ops)});
+            }
+         }
+      }
+
+      if (plans.empty()) {
+         return 0;
+      }
+
+      /* lay out section: count, table, plans */
+      Section<bits> *section = Section<bits>::Create(SEG_TEXT, PRINTF_PLAN_SECTNAME, S_REGULAR, 2);
+      section->segment = text;
+      auto& content = section->content;
+      push_back_u32<bits>(content, plans.size());
+      uint32_t offset = sizeof(uint32_t) + plans.size() * sizeof(printf_plan_entry);
+      for (const auto& plan : plans) {
+         push_back_u32<bits>(content, 0, plan.format);
+         push_back_u32<bits>(content, offset);
+         offset += 1 + plan.ops.size();
+      }
+      for (const auto& plan : plans) {
+         content.push_back(DataBlob<bits>::Create(plan.ops.size()));
+         for (uint8_t op : plan.ops) {
+            content.push_back(DataBlob<bits>::Create(op));
+         }
+      }
+      text->sections.push_back(section);
+      
+      return plans.size();
+   }
+
+   template std::size_t emit_printf_plans(Archive<Bits::M32>&);
+   template std::size_t emit_printf_plans(Archive<Bits::M64>&);
+
+}
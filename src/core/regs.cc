@@ -0,0 +1,128 @@
+#include <stdexcept>
+
+#include "regs.hh"
+#include "archive.hh"
+#include "cfg.hh"
+#include "section.hh"
+#include "instruction.hh"
+
+namespace MachO {
+
+   namespace {
+      const uint32_t guest_regs = 0xff; /*!< eax-edi */
+      
+      /* System call and interrupt gates read the call number and arguments from registers that
+       * xed doesn't list as operands (e.g. eax for int 0x80, ecx/edx for sysenter), so they are
+       * treated as reading every guest register. */
+      bool traps(const xed_decoded_inst_t& xedd) {
+         switch (xed_decoded_inst_get_category(&xedd)) {
+         case XED_CATEGORY_INTERRUPT:
+         case XED_CATEGORY_SYSCALL:
+            return true;
+         default:
+            break;
+         }
+         switch (xed_decoded_inst_get_iclass(&xedd)) {
+         case XED_ICLASS_SYSENTER:
+         case XED_ICLASS_SYSCALL:
+            return true;
+         default:
+            return false;
+         }
+      }
+   }
+
+   uint32_t gpr_mask(xed_reg_enum_t reg) {
+      if (xed_reg_class(reg) != XED_REG_CLASS_GPR) {
+         return 0;
+      }
+      const xed_reg_enum_t reg64 = xed_get_largest_enclosing_register(reg);
+      if (reg64 < XED_REG_RAX || reg64 > XED_REG_R15) {
+         return 0;
+      }
+      return 1U << (reg64 - XED_REG_RAX);
+   }
+
+   template <Bits bits>
+   void analyze_reg_liveness(Archive<bits>& archive, bool abi) {
+      const uint32_t all = guest_regs;
+      const uint32_t ret_live = abi ? all & ~gpr_mask(XED_REG_ECX) : all;
+
+      const auto transfer = [&] (const Instruction<bits>& inst) {
+         const xed_decoded_inst_t& xedd = inst.xedd;
+         const xed_inst_t *xedi = xed_decoded_inst_inst(&xedd);
+         Transfer t;
+
+         const unsigned noperands = xed_decoded_inst_noperands(&xedd);
+         for (unsigned i = 0; i < noperands; ++i) {
+            const xed_operand_enum_t name = xed_operand_name(xed_inst_operand(xedi, i));
+            if (xed_operand_is_memory_addressing_register(name)) {
+               t.gen |= gpr_mask(xed_decoded_inst_get_reg(&xedd, name));
+            } else if (xed_operand_is_register(name)) {
+               const xed_reg_enum_t reg = xed_decoded_inst_get_reg(&xedd, name);
+               const xed_operand_action_enum_t action = xed_decoded_inst_operand_action(&xedd, i);
+               if (xed_operand_action_read(action)) {
+                  t.gen |= gpr_mask(reg);
+               }
+               if (xed_operand_action_written(action)) {
+                  if (xed_operand_action_conditional_write(action) ||
+                      xed_get_register_width_bits(reg) < 32) {
+                     t.gen |= gpr_mask(reg); /* partial write merges old value */
+                  } else {
+                     t.kill |= gpr_mask(reg);
+                  }
+               }
+            }
+         }
+         for (unsigned i = 0; i < xed_decoded_inst_number_of_memory_operands(&xedd); ++i) {
+            t.gen |= gpr_mask(xed_decoded_inst_get_base_reg(&xedd, i));
+            t.gen |= gpr_mask(xed_decoded_inst_get_index_reg(&xedd, i));
+         }
+         if (traps(xedd)) {
+            t.gen = all;
+         }
+         t.gen &= all;
+         t.kill &= all;
+
+         switch (xed_decoded_inst_get_category(&xedd)) {
+         case XED_CATEGORY_RET:
+            t.out = ret_live;
+            break;
+         case XED_CATEGORY_CALL:
+            t.out = all;
+            break;
+         default:
+            break;
+         }
+
+         return t;
+      };
+
+      for (Section<bits> *section : archive.sections()) {
+         backward_dataflow<bits>(CFG<bits>(section), all, transfer,
+                                 [] (Instruction<bits>& inst, uint32_t live) {
+                                    inst.live_regs = live;
+                                 });
+      }
+   }
+
+   ScratchRegs::ScratchRegs(uint32_t live):
+      busy((live & guest_regs) | gpr_mask(XED_REG_ESP)) {}
+
+   xed_reg_enum_t ScratchRegs::r32() {
+      static const xed_reg_enum_t order[] =
+         {XED_REG_EAX, XED_REG_ECX, XED_REG_EDX, XED_REG_EBX, XED_REG_ESI, XED_REG_EDI,
+          XED_REG_EBP, XED_REG_R11D, XED_REG_R10D, XED_REG_R9D, XED_REG_R8D};
+      for (xed_reg_enum_t reg : order) {
+         if ((busy & gpr_mask(reg)) == 0) {
+            reserve(reg);
+            return reg;
+         }
+      }
+      throw std::logic_error("out of scratch registers");
+   }
+
+   template void analyze_reg_liveness(Archive<Bits::M32>& archive, bool abi);
+   template void analyze_reg_liveness(Archive<Bits::M64>& archive, bool abi);
+   
+}
@@ -0,0 +1,269 @@
+#include <algorithm>
+#include <list>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+#include <mach-o/loader.h>
+
+extern "C" {
+#include <xed/xed-interface.h>
+}
+
+#include "reorder.hh"
+#include "archive.hh"
+#include "section.hh"
+#include "section_blob.hh"
+#include "instruction.hh"
+#include "linkedit.hh"
+#include "data_in_code.hh"
+#include "util.hh"
+
+namespace MachO {
+
+   Profile Profile::Parse(std::istream& is) {
+      Profile profile;
+      std::string line;
+      for (unsigned lineno = 1; std::getline(is, line); ++lineno) {
+         line = line.substr(0, line.find('#'));
+         std::istringstream ss(line);
+         std::vector<std::string> fields;
+         for (std::string field; ss >> field; ) {
+            fields.push_back(field);
+         }
+
+         try {
+            switch (fields.size()) {
+            case 0:
+               break;
+            case 2:
+               profile.counts[std::stoull(fields[0], nullptr, 0)] +=
+                  std::stoull(fields[1], nullptr, 0);
+               break;
+            case 3:
+               profile.edges.push_back({std::stoull(fields[0], nullptr, 0),
+                                        std::stoull(fields[1], nullptr, 0),
+                                        std::stoull(fields[2], nullptr, 0)});
+               break;
+            default:
+               throw error("profile line %u: expected 2 or 3 fields, got %zu", lineno,
+                           fields.size());
+            }
+         } catch (const std::logic_error&) {
+            throw error("profile line %u: invalid number", lineno);
+         }
+      }
+      return profile;
+   }
+
+   namespace {
+
+      /* Blobs that don't start a new piece of code: zero-size markers and alignment padding. */
+      template <Bits bits>
+      bool is_marker(const SectionBlob<bits> *blob) {
+         return !blob->active || blob->size() == 0 ||
+            dynamic_cast<const Padding<bits> *>(blob) != nullptr;
+      }
+
+      /* Whether execution may continue past the last blob of _blobs_. */
+      template <Bits bits>
+      bool falls_through(const typename Section<bits>::Content& blobs) {
+         for (auto it = blobs.rbegin(); it != blobs.rend(); ++it) {
+            if (is_marker(*it)) {
+               continue;
+            }
+            const auto inst = dynamic_cast<const Instruction<bits> *>(*it);
+            if (inst == nullptr) {
+               return false; /* data */
+            }
+            switch (xed_decoded_inst_get_category(&inst->xedd)) {
+            case XED_CATEGORY_UNCOND_BR:
+            case XED_CATEGORY_RET:
+               return false;
+            default:
+               return true;
+            }
+         }
+         return false;
+      }
+      
+   }
+
+   template <Bits bits>
+   std::size_t reorder_functions(Archive<bits>& archive, const Profile& profile) {
+      using Content = typename Section<bits>::Content;
+
+      Section<bits> *text = archive.section(SECT_TEXT);
+      FunctionStarts<bits> *starts = nullptr;
+      for (LoadCommand<bits> *lc : archive.load_commands) {
+         if (auto fs = dynamic_cast<FunctionStarts<bits> *>(lc)) {
+            starts = fs;
+         }
+      }
+      if (text == nullptr || starts == nullptr) {
+         throw error("%s: archive lacks __text section or function starts", __FUNCTION__);
+      }
+      Content& content = text->content;
+
+      /* split __text in front of each run of markers containing a function start */
+      const std::unordered_set<const SectionBlob<bits> *> entries(starts->entries.begin(),
+                                                                  starts->entries.end());
+      std::vector<typename Content::iterator> bounds = {content.begin()};
+      auto run = content.begin();
+      for (auto it = content.begin(); it != content.end(); ++it) {
+         if (entries.count(*it) && run != bounds.back()) {
+            bounds.push_back(run);
+         }
+         if (!is_marker(*it)) {
+            run = std::next(it);
+         }
+      }
+      if (content.empty() || bounds.size() < 2) {
+         return 0;
+      }
+      
+      const std::size_t nchunks = bounds.size();
+      std::vector<Content> chunks(nchunks);
+      std::vector<std::size_t> chunk_addrs(nchunks);
+      for (std::size_t i = 0; i < nchunks; ++i) {
+         chunk_addrs[i] = (*bounds[i])->loc.vmaddr;
+      }
+      for (std::size_t i = nchunks; i-- > 0; ) {
+         chunks[i].splice(chunks[i].end(), content, bounds[i], content.end());
+      }
+      const std::size_t text_end = text->sect.addr + text->sect.size;
+      auto chunk_of = [&] (std::size_t vmaddr) -> std::optional<std::size_t> {
+         if (vmaddr < chunk_addrs.front() || vmaddr >= text_end) {
+            return std::nullopt;
+         }
+         return std::upper_bound(chunk_addrs.begin(), chunk_addrs.end(), vmaddr) -
+            chunk_addrs.begin() - 1;
+      };
+
+      /* weigh functions */
+      std::vector<uint64_t> weights(nchunks, 0);
+      for (const auto& count : profile.counts) {
+         if (const auto chunk = chunk_of(count.first)) {
+            weights[*chunk] += count.second;
+         }
+      }
+      std::vector<Profile::Edge> edges;
+      for (const auto& edge : profile.edges) {
+         const auto caller = chunk_of(edge.caller);
+         const auto callee = chunk_of(edge.callee);
+         if (caller && callee) {
+            weights[*caller] += edge.count;
+            weights[*callee] += edge.count;
+            if (*caller != *callee) {
+               edges.push_back({*caller, *callee, edge.count});
+            }
+         }
+      }
+
+      /* cluster along the heaviest edges, placing the callee's cluster after the caller's; the
+       * first chunk of __text is pinned in place */
+      std::vector<std::size_t> cluster_of(nchunks);
+      std::vector<std::list<std::size_t>> clusters(nchunks);
+      for (std::size_t i = 0; i < nchunks; ++i) {
+         cluster_of[i] = i;
+         clusters[i] = {i};
+      }
+      std::stable_sort(edges.begin(), edges.end(), [] (const auto& a, const auto& b) {
+         return a.count > b.count;
+      });
+      for (const auto& edge : edges) {
+         const std::size_t a = cluster_of[edge.caller];
+         const std::size_t b = cluster_of[edge.callee];
+         if (a == b || a == cluster_of[0] || b == cluster_of[0]) {
+            continue;
+         }
+         for (std::size_t chunk : clusters[b]) {
+            cluster_of[chunk] = a;
+         }
+         clusters[a].splice(clusters[a].end(), clusters[b]);
+      }
+
+      /* hot clusters by descending weight, then cold functions in original order */
+      std::vector<std::pair<uint64_t, std::size_t>> hot;
+      for (std::size_t i = 1; i < nchunks; ++i) {
+         if (!clusters[i].empty()) {
+            uint64_t weight = 0;
+            for (std::size_t chunk : clusters[i]) {
+               weight += weights[chunk];
+            }
+            if (weight > 0) {
+               hot.emplace_back(weight, i);
+            }
+         }
+      }
+      std::stable_sort(hot.begin(), hot.end(), [] (const auto& a, const auto& b) {
+         return a.first > b.first;
+      });
+      std::vector<std::size_t> order(clusters[0].begin(), clusters[0].end());
+      std::vector<bool> placed(nchunks, false);
+      for (const auto& cluster : hot) {
+         order.insert(order.end(), clusters[cluster.second].begin(),
+                      clusters[cluster.second].end());
+      }
+      for (std::size_t chunk : order) {
+         placed[chunk] = true;
+      }
+      for (std::size_t i = 0; i < nchunks; ++i) {
+         if (!placed[i]) {
+            order.push_back(i);
+         }
+      }
+
+      /* reassemble, adding a jump wherever a function lost its fall-through successor; splicing
+       * empties each chunk, so jump targets are taken beforehand */
+      std::vector<SectionBlob<bits> *> firsts;
+      firsts.reserve(nchunks);
+      for (const auto& chunk : chunks) {
+         firsts.push_back(chunk.empty() ? nullptr : chunk.front());
+      }
+      std::size_t moved = 0;
+      for (std::size_t pos = 0; pos < nchunks; ++pos) {
+         const std::size_t chunk = order[pos];
+         const std::size_t succ = chunk + 1;
+         if (succ < nchunks && (pos + 1 == nchunks || order[pos + 1] != succ) &&
+             firsts[succ] != nullptr && falls_through<bits>(chunks[chunk])) {
+            auto jmp = new Instruction<bits>(opcode_t {0xe9, 0x00, 0x00, 0x00, 0x00});
+            jmp->brdisp = firsts[succ];
+            jmp->section = text;
+            jmp->segment = text->segment;
+            jmp->iter = chunks[chunk].insert(chunks[chunk].end(), jmp);
+         }
+         if (chunk != pos) {
+            ++moved;
+         }
+         content.splice(content.end(), chunks[chunk]);
+      }
+
+      /* function starts and data-in-code entries must be sorted by address */
+      std::unordered_map<const SectionBlob<bits> *, std::size_t> position;
+      for (const SectionBlob<bits> *blob : content) {
+         position.emplace(blob, position.size());
+      }
+      auto position_of = [&] (const SectionBlob<bits> *blob) {
+         const auto it = position.find(blob);
+         return it == position.end() ? position.size() : it->second;
+      };
+      starts->entries.sort([&] (const auto a, const auto b) {
+         return position_of(a) < position_of(b);
+      });
+      for (LoadCommand<bits> *lc : archive.load_commands) {
+         if (auto dic = dynamic_cast<DataInCode<bits> *>(lc)) {
+            std::stable_sort(dic->content.begin(), dic->content.end(),
+                             [&] (const auto a, const auto b) {
+                                return position_of(a->start) < position_of(b->start);
+                             });
+         }
+      }
+
+      return moved;
+   }
+
+   template std::size_t reorder_functions(Archive<Bits::M32>&, const Profile&);
+   template std::size_t reorder_functions(Archive<Bits::M64>&, const Profile&);
+
+}
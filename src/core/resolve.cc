@@ -2,11 +2,20 @@
 #include "parse.hh"
 #include "section_blob.hh"
 #include "dyldinfo.hh"
+#include "stats.hh"
 
 namespace MachO {
 
       template <typename T, typename U, bool lazy>
       Resolver<T, U, lazy>::~Resolver() {
+         if (stats && report) {
+            std::size_t unresolved = 0;
+            for (const auto& todo_pair : todo) {
+               unresolved += todo_pair.second.size();
+            }
+            stats->resolver(name, found.size(), peak_todo, unresolved);
+         }
+
 #if 1
          if (!todo.empty()) {
             std::cerr << "Resolver: " << name << std::endl;
@@ -1,7 +1,15 @@
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <set>
 #include <sstream>
 #include <string>
-#include <iterator>
+#include <thread>
 #include <unordered_set>
+#include <vector>
 
 #include "section.hh"
 #include "segment.hh"
@@ -11,6 +19,8 @@
 #include "section_blob.hh" // LazySymbolPointer
 #include "instruction.hh"
 #include "stub_helper.hh"
+#include "trace.hh"
+#include "macho.hh"
 
 namespace MachO {
 
@@ -65,7 +75,18 @@ namespace MachO {
    
    template <Bits bits>
    void Section<bits>::Parse1(const Image& img, ParseEnv<bits>& env) {
+      Trace::Span span("Section::Parse1");
+      if (span) {
+         span.arg("segment", std::string(sect.segname, strnlen(sect.segname, sizeof(sect.segname))));
+         span.arg("section", name());
+      }
       env.current_section = this;
+
+      if (parser == TextParser && name() == SECT_TEXT && parse_options.recursive_descent &&
+          Parse1_recursive(img, env)) {
+         env.current_section = nullptr;
+         return;
+      }
       
       const std::size_t begin = sect.offset;
       const std::size_t end = begin + sect.size;
@@ -81,6 +102,163 @@ namespace MachO {
       env.current_section = nullptr;
    }
    
+   template <Bits bits>
+   bool Section<bits>::Parse1_recursive(const Image& img, ParseEnv<bits>& env) {
+      const std::size_t begin = sect.offset;
+      const std::size_t end = begin + sect.size;
+      const auto in_section = [&] (std::size_t offset) { return offset >= begin && offset < end; };
+      const auto vmaddr_to_offset = [&] (std::size_t vmaddr) {
+         return vmaddr - sect.addr + begin;
+      };
+
+      std::vector<std::size_t> worklist;
+      for (std::size_t seed : env.code_seeds) {
+         if (in_section(seed)) {
+            worklist.push_back(seed);
+         }
+      }
+      if (worklist.empty()) {
+         return false;
+      }
+
+      /* discover instructions; decoding here has no side effects, so paths that run into
+       * undecodable bytes can simply be abandoned */
+      std::map<std::size_t, std::size_t> insts; /* offset -> length */
+      std::set<std::size_t> slots; /* offsets of jump table entries */
+      const std::size_t ptr_size = sizeof(ptr_t<bits>);
+      const auto in_table = [&] (std::size_t offset) {
+         const auto next = slots.upper_bound(offset);
+         return next != slots.begin() && *std::prev(next) + ptr_size > offset;
+      };
+      const auto overlaps = [&] (std::size_t offset) {
+         auto next = insts.upper_bound(offset);
+         if (next != insts.begin()) {
+            auto prev = std::prev(next);
+            if (prev->first + prev->second > offset) {
+               return true;
+            }
+         }
+         return false;
+      };
+      
+      while (!worklist.empty()) {
+         std::size_t offset = worklist.back();
+         worklist.pop_back();
+
+         while (in_section(offset) && !overlaps(offset) && !env.data_in_code.contains(offset) &&
+                !in_table(offset)) {
+            xed_decoded_inst_t xedd;
+            xed_decoded_inst_zero_set_mode(&xedd, &Instruction<bits>::dstate());
+            xed_decoded_inst_set_input_chip(&xedd, XED_CHIP_INVALID);
+            if (xed_decode(&xedd, &img.at<uint8_t>(offset), end - offset) != XED_ERROR_NONE) {
+               break;
+            }
+            const std::size_t len = xed_decoded_inst_get_length(&xedd);
+            if (overlaps(offset + len - 1) || in_table(offset + len - 1) ||
+                insts.lower_bound(offset + 1) !=
+                insts.lower_bound(offset + len)) {
+               break;
+            }
+            insts.emplace(offset, len);
+
+            /* relative branch and call targets */
+            const xed_operand_values_t *operands = xed_decoded_inst_operands_const(&xedd);
+            if (xed_operand_values_has_branch_displacement(operands)) {
+               worklist.push_back(offset + len + xed_decoded_inst_get_branch_displacement(&xedd));
+            }
+
+            /* jump tables: jmp [table + index*4]; entries become Immediates, which hold 32-bit
+             * pointers, so only i386 tables are followed */
+            if (ptr_size == sizeof(uint32_t) &&
+                xed_decoded_inst_get_iform_enum(&xedd) == XED_IFORM_JMP_MEMv &&
+                xed_decoded_inst_get_base_reg(&xedd, 0) == XED_REG_INVALID &&
+                xed_decoded_inst_get_index_reg(&xedd, 0) != XED_REG_INVALID &&
+                xed_decoded_inst_get_scale(&xedd, 0) == ptr_size) {
+               const std::size_t table = vmaddr_to_offset(static_cast<ptr_t<bits>>
+                                                          (xed_decoded_inst_get_memory_displacement
+                                                           (&xedd, 0)));
+               for (std::size_t slot = table; in_section(slot) && slot + ptr_size <= end &&
+                       !overlaps(slot) && !overlaps(slot + ptr_size - 1); slot += ptr_size) {
+                  const std::size_t target = vmaddr_to_offset(img.at<ptr_t<bits>>(slot));
+                  if (!in_section(target) || (target >= table && target < slot + ptr_size)) {
+                     break;
+                  }
+                  slots.insert(slot);
+                  worklist.push_back(target);
+               }
+            }
+
+            switch (xed_decoded_inst_get_category(&xedd)) {
+            case XED_CATEGORY_UNCOND_BR:
+            case XED_CATEGORY_RET:
+               offset = end;
+               break;
+            default:
+               switch (xed_decoded_inst_get_iclass(&xedd)) {
+               case XED_ICLASS_HLT:
+               case XED_ICLASS_UD2:
+                  offset = end;
+                  break;
+               default:
+                  offset += len;
+                  break;
+               }
+               break;
+            }
+         }
+      }
+
+      /* materialize in address order. Jump table entries point at their targets, like the branch
+       * displacements of instructions. Each run of undiscovered bytes becomes one data range,
+       * which is split wherever something turns out to refer into it.
+       */
+      std::size_t vmaddr = sect.addr;
+      for (std::size_t it = begin; it != end; ) {
+         SectionBlob<bits> *elem;
+         if (insts.count(it)) {
+            elem = Instruction<bits>::Parse(img, Location(it, vmaddr), env);
+         } else if (slots.count(it)) {
+            auto slot = Immediate<bits>::Parse(img, Location(it, vmaddr), env, false);
+            slot->pointee = env.add_placeholder(slot->value);
+            elem = slot;
+         } else {
+            const auto next_inst = insts.upper_bound(it);
+            const auto next_slot = slots.upper_bound(it);
+            const std::size_t run_end =
+               std::min(next_inst == insts.end() ? end : next_inst->first,
+                        next_slot == slots.end() ? end : *next_slot);
+            auto range = DataRange<bits>::Parse(img, Location(it, vmaddr), env, run_end - it);
+            data_ranges.emplace(vmaddr, range);
+            elem = range;
+         }
+         elem->iter = content.insert(content.end(), elem);
+         it += elem->size();
+         vmaddr += elem->size();
+      }
+
+      return true;
+   }
+   
+   template <Bits bits>
+   DataRange<bits> *Section<bits>::split_data(std::size_t vmaddr) {
+      const auto next = data_ranges.upper_bound(vmaddr);
+      if (next == data_ranges.begin()) {
+         return nullptr;
+      }
+      DataRange<bits> *range = std::prev(next)->second;
+      const std::size_t at = vmaddr - range->loc.vmaddr;
+      if (at == 0) {
+         return range;
+      } else if (at >= range->size()) {
+         return nullptr;
+      }
+
+      DataRange<bits> *tail = range->split(at);
+      tail->iter = content.insert(std::next(range->iter), tail);
+      data_ranges.emplace(vmaddr, tail);
+      return tail;
+   }
+
    template <Bits bits>
    std::string Section<bits>::name() const {
       return std::string(sect.sectname, strnlen(sect.sectname, sizeof(sect.sectname)));
@@ -96,6 +274,7 @@ namespace MachO {
       }
 
       sect.size = env.loc.offset - loc().offset;
+      dirty = false;
 
       Location relloc;
       sect.nreloc = relocs.size();
@@ -106,7 +285,11 @@ namespace MachO {
    template <Bits bits>
    void Section<bits>::Emit(Image& img, std::size_t offset) const {
       img.at<section_t<bits>>(offset) = sect;
+      Emit_content(img);
+   }
 
+   template <Bits bits>
+   void Section<bits>::Emit_content(Image& img) const {
       std::size_t sect_offset = sect.offset;
       
       for (const SectionBlob<bits> *elem : content) {
@@ -131,25 +314,99 @@ namespace MachO {
       auto it = content.begin();
       std::advance(it, loc.index);
       content.insert(it, elem);
+      dirty = true;
       // content.insert(content.begin() + loc.index, elem);
    }
 
+   namespace {
+      template <Bits bits, typename It>
+      void transform_content(It begin, It end, TransformEnv<bits>& env,
+                             typename Section<opposite<bits>>::Content& content) {
+         for (It it = begin; it != end; ++it) {
+            const SectionBlob<bits> *elem = *it;
+            auto new_blobs = elem->Transform(env);
+            if (!elem->active) {
+               for (auto new_blob : new_blobs) {
+                  new_blob->active = false;
+               }
+            }
+            if (!new_blobs.empty()) {
+               env.add(elem, new_blobs.front());
+            }
+            content.splice(content.end(), new_blobs);
+         }
+      }
+
+      /* blobs per chunk below which content isn't worth splitting */
+      constexpr std::size_t min_chunk_size = 4096;
+   }
+
    template <Bits bits>
    Section<bits>::Section(const Section<opposite<bits>>& other, TransformEnv<opposite<bits>>& env):
       /* relocs(other.relocs.Transform(env)), */ id(other.id)
    {
+      Trace::Span span("Section::Transform");
       env.add(&other, this);
       env(other.sect, sect);
       env.resolve(other.segment, &segment);
+      if (span) {
+         span.arg("section", name());
+      }
 
-      /* transform content */
-      for (const auto elem : other.content) {
-         auto new_blobs = elem->Transform(env);
-         if (!new_blobs.empty()) {
-            env.add(elem, new_blobs.front());
+      /* transform content; large sections are split into chunks transformed concurrently in
+       * shards of _env_, which are merged back in order so the result matches a serial run */
+      const std::size_t nblobs = other.content.size();
+      const unsigned jobs = env.jobs ? env.jobs : std::max(1U, std::thread::hardware_concurrency());
+      const std::size_t nchunks = std::min<std::size_t>(jobs, nblobs / min_chunk_size);
+      if (nchunks <= 1) {
+         transform_content(other.content.begin(), other.content.end(), env, content);
+      } else {
+         using OtherIt = typename Section<opposite<bits>>::Content::const_iterator;
+         std::vector<std::pair<OtherIt, OtherIt>> chunks;
+         OtherIt chunk_begin = other.content.begin();
+         for (std::size_t i = 0; i < nchunks; ++i) {
+            const std::size_t size = nblobs / nchunks + (i < nblobs % nchunks);
+            OtherIt chunk_end = std::next(chunk_begin, size);
+            chunks.emplace_back(chunk_begin, chunk_end);
+            chunk_begin = chunk_end;
+         }
+
+         std::vector<std::unique_ptr<TransformEnv<opposite<bits>>>> shards;
+         std::vector<Content> outputs(nchunks);
+         std::vector<std::exception_ptr> errors(nchunks);
+         for (std::size_t i = 0; i < nchunks; ++i) {
+            shards.push_back(std::make_unique<TransformEnv<opposite<bits>>>(env));
+         }
+         std::vector<std::thread> threads;
+         for (std::size_t i = 0; i < nchunks; ++i) {
+            threads.emplace_back([&, i] () {
+               Trace::Span shard_span("Section::Transform shard");
+               if (shard_span) {
+                  shard_span.arg("section", name());
+                  shard_span.arg("chunk", std::to_string(i));
+               }
+               try {
+                  transform_content(chunks[i].first, chunks[i].second, *shards[i], outputs[i]);
+               } catch (...) {
+                  errors[i] = std::current_exception();
+               }
+            });
+         }
+         for (std::thread& thread : threads) {
+            thread.join();
+         }
+         for (const std::exception_ptr& err : errors) {
+            if (err) {
+               std::rethrow_exception(err);
+            }
+         }
+
+         for (std::size_t i = 0; i < nchunks; ++i) {
+            env.merge(*shards[i]);
+            content.splice(content.end(), outputs[i]);
          }
-         content.splice(content.end(), new_blobs);
       }
+      content.splice(content.end(), env.trailer);
 
       /* update alignment */
       const std::unordered_set<std::string> wordsize_align =
@@ -198,6 +455,7 @@ namespace MachO {
          {
             /* find first section blob that has an address greater than or equal to this
              * placeholder */
+            env.split_data(*this, placeholder_it->first);
             content_it = std::lower_bound(content_it, content.end(), placeholder_it->first,
                                           [] (const SectionBlob<bits> *blob, std::size_t vmaddr) {
                                              return blob->loc.vmaddr < vmaddr;
@@ -212,8 +470,9 @@ namespace MachO {
             
             placeholder_it->second->segment = env.current_segment;
             placeholder_it->second->section = this;
+            placeholder_it->second->loc.offset = (*content_it)->loc.offset;
             
-            content.insert(content_it, placeholder_it->second);
+            placeholder_it->second->iter = content.insert(content_it, placeholder_it->second);
          }
    }
 
@@ -246,11 +505,61 @@ namespace MachO {
             break;
          }
          content.insert(it, blob);
+         dirty = true;
       } else {
          throw std::invalid_argument("location not in section");
       }
    }
 
+   template <Bits bits>
+   void Section<bits>::insert(const std::vector<Insertion<bits>>& blobs) {
+      /* key by vmaddr; the stable sort keeps insertions at the same location in order */
+      std::vector<std::pair<std::size_t, const Insertion<bits> *>> keyed;
+      keyed.reserve(blobs.size());
+      for (const Insertion<bits>& insertion : blobs) {
+         std::size_t vmaddr;
+         if (insertion.loc.offset) {
+            if (!contains_offset(insertion.loc.offset)) {
+               throw std::invalid_argument("location not in section");
+            }
+            vmaddr = insertion.loc.offset - sect.offset + sect.addr;
+         } else if (insertion.loc.vmaddr) {
+            if (!contains_vmaddr(insertion.loc.vmaddr)) {
+               throw std::invalid_argument("location not in section");
+            }
+            vmaddr = insertion.loc.vmaddr;
+         } else {
+            throw std::invalid_argument("location offset and vmaddr are both 0");
+         }
+         keyed.emplace_back(vmaddr, &insertion);
+      }
+      std::stable_sort(keyed.begin(), keyed.end(),
+                       [] (const auto& a, const auto& b) { return a.first < b.first; });
+
+      /* _it_ is the first original blob past the current location and _last_ the one before it,
+       * so blobs inserted earlier in the walk are never mistaken for anchors */
+      auto it = content.begin();
+      auto last = content.end();
+      for (const auto& [vmaddr, insertion] : keyed) {
+         for (; it != content.end() && (*it)->loc.vmaddr <= vmaddr; ++it) {
+            last = it;
+         }
+         insertion->blob->section = this;
+         dirty = true;
+         switch (insertion->rel) {
+         case Relation::BEFORE:
+            if (last == content.end()) {
+               throw std::invalid_argument("no blob at location");
+            }
+            content.insert(last, insertion->blob);
+            break;
+         case Relation::AFTER:
+            content.insert(it, insertion->blob);
+            break;
+         }
+      }
+   }
+
    template <Bits bits>
    Section<bits>::Section(const Image& img, std::size_t offset, ParseEnv<bits>& env, Parser parser):
       sect(img.at<section_t<bits>>(offset)), segment(env.current_segment), parser(parser)
@@ -265,6 +574,16 @@ namespace MachO {
       }
    }
 
+   template <Bits bits>
+   Section<bits>::Section(const std::string& segname, const std::string& sectname, uint32_t flags,
+                          uint32_t align): sect(), id(0), parser(nullptr)
+   {
+      strncpy(sect.segname, segname.c_str(), sizeof(sect.segname));
+      strncpy(sect.sectname, sectname.c_str(), sizeof(sect.sectname));
+      sect.flags = flags;
+      sect.align = align;
+   }
+
    template <Bits bits>
    RelocationInfo<bits>::RelocationInfo(const Image& img, std::size_t offset, ParseEnv<bits>& env,
                                         const Location& baseloc):
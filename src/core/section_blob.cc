@@ -7,6 +7,7 @@
 #include "build.hh"
 #include "parse.hh"
 #include "transform.hh"
+#include "opcodes.hh"
 
 namespace MachO {
 
@@ -46,11 +47,50 @@ namespace MachO {
       env.allocate(active ? size() : 0, loc);
    }
 
+   template <Bits bits>
+   void Padding<bits>::Build(BuildEnv<bits>& env) {
+      const std::size_t mask = (std::size_t(1) << align) - 1;
+      const std::size_t pad = -env.loc.vmaddr & mask;
+      size_ = (pad <= max_size) ? pad : 0;
+      SectionBlob<bits>::Build(env);
+   }
+
+   template <Bits bits>
+   void Padding<bits>::Emit(Image& img, std::size_t offset) const {
+      for (std::size_t left = size_; left > 0; ) {
+         const opcode_t nop = opcode::nop(left);
+         img.copy(offset, &*nop.begin(), nop.size());
+         offset += nop.size();
+         left -= nop.size();
+      }
+   }
+
    template <Bits bits>
    void DataBlob<bits>::Emit(Image& img, std::size_t offset) const {
       img.at<uint8_t>(offset) = data;
    }
 
+   template <Bits bits>
+   DataRange<bits>::DataRange(const Image& img, const Location& loc, ParseEnv<bits>& env,
+                              std::size_t size):
+      SectionBlob<bits>(loc, env), data(&img.at<uint8_t>(loc.offset),
+                                        &img.at<uint8_t>(loc.offset) + size) {}
+
+   template <Bits bits>
+   void DataRange<bits>::Emit(Image& img, std::size_t offset) const {
+      img.copy(offset, data.begin(), data.size());
+   }
+
+   template <Bits bits>
+   DataRange<bits> *DataRange<bits>::split(std::size_t at) {
+      auto tail = new DataRange(std::vector<uint8_t>(data.begin() + at, data.end()));
+      tail->segment = this->segment;
+      tail->section = this->section;
+      tail->loc = Location(this->loc.offset + at, this->loc.vmaddr + at);
+      data.resize(at);
+      return tail;
+   }
+
    template <Bits bits>
    void SymbolPointer<bits>::Emit(Image& img, std::size_t offset) const {
       img.at<ptr_t>(offset) = raw_data();
@@ -58,7 +98,8 @@ namespace MachO {
 
    template <Bits bits>
    SectionBlob<bits>::SectionBlob(const SectionBlob<opposite<bits>>& other,
-                                  TransformEnv<opposite<bits>>& env): segment(nullptr) {
+                                  TransformEnv<opposite<bits>>& env):
+      active(other.active), segment(nullptr) {
       env.add(&other, this);
       env.resolve(other.segment, &segment);
    }
@@ -139,6 +180,11 @@ namespace MachO {
 
    template class DataBlob<Bits::M32>;
    template class DataBlob<Bits::M64>;
+   template class DataRange<Bits::M32>;
+   template class DataRange<Bits::M64>;
+
+   template class Padding<Bits::M32>;
+   template class Padding<Bits::M64>;
 
    template class Immediate<Bits::M32>;
    template class Immediate<Bits::M64>;
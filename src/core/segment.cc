@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <cstdint>
+#include <initializer_list>
 #include <sstream>
 
 #include "segment.hh"
@@ -10,10 +13,26 @@
 #include "linkedit.hh"
 #include "data_in_code.hh"
 #include "symtab.hh"
+#include "trace.hh"
 
 
 namespace MachO {
 
+   namespace {
+      /* smallest range covering the non-empty tables among (offset, size) pairs */
+      FileRange extent(std::initializer_list<std::pair<std::size_t, std::size_t>> tables) {
+         std::size_t begin = SIZE_MAX;
+         std::size_t end = 0;
+         for (const auto& [offset, size] : tables) {
+            if (size > 0) {
+               begin = std::min(begin, offset);
+               end = std::max(end, offset + size);
+            }
+         }
+         return begin < end ? FileRange {begin, end - begin} : FileRange {0, 0};
+      }
+   }
+
    template <Bits bits>
    Segment<bits> *Segment<bits>::Parse(const Image& img, std::size_t offset, ParseEnv<bits>& env) {
       const char *segname = img.at<segment_command_t<bits>>(offset).segname;
@@ -110,6 +129,7 @@ namespace MachO {
 
    template <Bits bits>
    void Segment_LINKEDIT<bits>::Build(BuildEnv<bits>& env) {
+      Trace::Span span("Segment_LINKEDIT::Build");
       this->segment_command.cmdsize = sizeof(segment_command_t<bits>);
       this->segment_command.nsects = 0;
       this->segment_command.fileoff = env.loc.offset = align_up(env.loc.offset, PAGESIZE);
@@ -119,30 +139,51 @@ namespace MachO {
 
       /* LC_DYLD_INFO[_ONLY] */
       auto dyld_info = env.archive->template subcommand<DyldInfo>();
-      if (dyld_info) { dyld_info->Build_LINKEDIT(env); }
+      if (dyld_info) {
+         Trace::Span span("DyldInfo::Build_LINKEDIT");
+         dyld_info->Build_LINKEDIT(env);
+      }
 
       /* LC_FUNCTION_STARTS */
       auto function_starts = env.archive->template subcommand<FunctionStarts>();
-      if (function_starts) { function_starts->Build_LINKEDIT(env); }
+      if (function_starts) {
+         Trace::Span span("FunctionStarts::Build_LINKEDIT");
+         function_starts->Build_LINKEDIT(env);
+      }
 
       /* LC_DATA_IN_CODE */
       auto data_in_code = env.archive->template subcommand<DataInCode>();
-      if (data_in_code) { data_in_code->Build_LINKEDIT(env); }
+      if (data_in_code) {
+         Trace::Span span("DataInCode::Build_LINKEDIT");
+         data_in_code->Build_LINKEDIT(env);
+      }
 
       /* LC_SYMTAB: symbol table */
       auto symtab = env.archive->template subcommand<Symtab>();
-      if (symtab) { symtab->Build_LINKEDIT_symtab(env); }
+      if (symtab) {
+         Trace::Span span("Symtab::Build_LINKEDIT_symtab");
+         symtab->Build_LINKEDIT_symtab(env);
+      }
 
       /* LC_DYSYMTAB */
       auto dysymtab = env.archive->template subcommand<Dysymtab>();
-      if (dysymtab) { dysymtab->Build_LINKEDIT(env); }
+      if (dysymtab) {
+         Trace::Span span("Dysymtab::Build_LINKEDIT");
+         dysymtab->Build_LINKEDIT(env);
+      }
 
       /* LC_SYMTAB: string table */
-      if (symtab) { symtab->Build_LINKEDIT_strtab(env); }
+      if (symtab) {
+         Trace::Span span("Symtab::Build_LINKEDIT_strtab");
+         symtab->Build_LINKEDIT_strtab(env);
+      }
 
       /* LC_CODE_SIGNATURE */
       auto code_signature = env.archive->template subcommand<CodeSignature>();
-      if (code_signature) { code_signature->Build_LINKEDIT(env); }
+      if (code_signature) {
+         Trace::Span span("CodeSignature::Build_LINKEDIT");
+         code_signature->Build_LINKEDIT(env);
+      }
 
       
       for (LinkeditCommand<bits> *linkedit : linkedits) {
@@ -156,6 +197,75 @@ namespace MachO {
                                                            PAGESIZE);
    }
 
+   template <Bits bits>
+   void Segment_LINKEDIT<bits>::Relayout(BuildEnv<bits>& env,
+                                         std::unordered_set<const LoadCommand<bits> *>& commands,
+                                         std::vector<FileRange>& stale) {
+      Trace::Span span("Segment_LINKEDIT::Relayout");
+      env.loc = this->loc();
+
+      const auto step = [&] (LinkeditCommand<bits> *command, bool addresses, FileRange old,
+                             auto build) {
+         if (!addresses && env.loc.offset == old.offset) {
+            env.loc.offset += old.size;
+            return;
+         }
+         build();
+         commands.insert(command);
+         stale.push_back(old);
+      };
+
+      if (auto dyld_info = env.archive->template subcommand<DyldInfo>()) {
+         const dyld_info_command& cmd = dyld_info->dyld_info;
+         step(dyld_info, true,
+              extent({{cmd.rebase_off, cmd.rebase_size}, {cmd.bind_off, cmd.bind_size},
+                      {cmd.weak_bind_off, cmd.weak_bind_size},
+                      {cmd.lazy_bind_off, cmd.lazy_bind_size}, {cmd.export_off, cmd.export_size}}),
+              [&] { dyld_info->Build_LINKEDIT(env); });
+      }
+
+      if (auto function_starts = env.archive->template subcommand<FunctionStarts>()) {
+         const linkedit_data_command& cmd = function_starts->linkedit;
+         step(function_starts, true, extent({{cmd.dataoff, cmd.datasize}}),
+              [&] { function_starts->Build_LINKEDIT(env); });
+      }
+
+      if (auto data_in_code = env.archive->template subcommand<DataInCode>()) {
+         const linkedit_data_command& cmd = data_in_code->linkedit;
+         step(data_in_code, true, extent({{cmd.dataoff, cmd.datasize}}),
+              [&] { data_in_code->Build_LINKEDIT(env); });
+      }
+
+      auto symtab = env.archive->template subcommand<Symtab>();
+      if (symtab) {
+         const symtab_command& cmd = symtab->symtab;
+         step(symtab, true, extent({{cmd.symoff, cmd.nsyms * Nlist<bits>::size()}}),
+              [&] { symtab->Build_LINKEDIT_symtab(env); });
+      }
+
+      if (auto dysymtab = env.archive->template subcommand<Dysymtab>()) {
+         const dysymtab_command& cmd = dysymtab->dysymtab;
+         step(dysymtab, false, extent({{cmd.indirectsymoff, cmd.nindirectsyms * sizeof(uint32_t)}}),
+              [&] { dysymtab->Build_LINKEDIT(env); });
+      }
+
+      if (symtab) {
+         const symtab_command& cmd = symtab->symtab;
+         step(symtab, false, extent({{cmd.stroff, cmd.strsize}}),
+              [&] { symtab->Build_LINKEDIT_strtab(env); });
+      }
+
+      if (auto code_signature = env.archive->template subcommand<CodeSignature>()) {
+         const linkedit_data_command& cmd = code_signature->linkedit;
+         step(code_signature, false, extent({{cmd.dataoff, cmd.datasize}}),
+              [&] { code_signature->Build_LINKEDIT(env); });
+      }
+
+      this->segment_command.filesize = env.loc.offset - this->segment_command.fileoff;
+      this->segment_command.vmsize = align_up<std::size_t>(this->segment_command.filesize,
+                                                           PAGESIZE);
+   }
+
    template <Bits bits>
    void Segment<bits>::Build_PAGEZERO(BuildEnv<bits>& env) {
       segment_command.vmaddr = 0;
@@ -177,6 +287,21 @@ namespace MachO {
       // fprintf(stderr, "[EMIT] segment={name=%s,fileoff=0x%zx,filesize=0x%zx,vmaddr=0x%zx,vmsize=0x%zx}\n", segment_command.segname, (std::size_t) segment_command.fileoff, (size_t) segment_command.filesize, (size_t) segment_command.vmaddr, (size_t) segment_command.vmsize);
    }
 
+   template <Bits bits>
+   void Segment<bits>::Emit(Image& img, std::size_t offset,
+                            const std::unordered_set<const Section<bits> *>& dirty) const {
+      img.at<segment_command_t<bits>>(offset) = segment_command;
+      offset += sizeof(segment_command_t<bits>);
+      
+      for (const Section<bits> *sect : sections) {
+         img.at<section_t<bits>>(offset) = sect->sect;
+         if (dirty.count(sect)) {
+            sect->Emit_content(img);
+         }
+         offset += sect->size();
+      }
+   }
+
    template <Bits bits>
    Segment<bits>::Segment(const Segment<opposite<bits>>& other, TransformEnv<opposite<bits>>& env):
       LoadCommand<bits>(other, env), id(0)
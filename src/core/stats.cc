@@ -0,0 +1,268 @@
+#include <cstdlib>
+#include <cxxabi.h>
+#include <iomanip>
+#include <memory>
+
+#include "stats.hh"
+#include "archive.hh"
+#include "segment.hh"
+#include "section.hh"
+#include "section_blob.hh"
+#include "instruction.hh"
+#include "stub_helper.hh"
+#include "dyldinfo.hh"
+#include "rebase_info.hh"
+#include "export_info.hh"
+#include "symtab.hh"
+#include "linkedit.hh"
+#include "data_in_code.hh"
+#include "util.hh"
+
+namespace MachO {
+
+   Stats *stats = nullptr;
+
+   namespace {
+
+      /* size of the most derived of _Ts_ that _node_ is, listed most derived first */
+      template <typename Base, typename T, typename... Ts>
+      std::size_t object_size(const Base *node) {
+         if (dynamic_cast<const T *>(node)) {
+            return sizeof(T);
+         }
+         if constexpr (sizeof...(Ts) > 0) {
+            return object_size<Base, Ts...>(node);
+         } else {
+            return sizeof(Base);
+         }
+      }
+
+      template <Bits bits>
+      class Counter {
+      public:
+         Counter(Stats::Censuses& censuses): censuses(censuses) {}
+
+         void add(const std::string& type, std::size_t bytes) {
+            Stats::Census& census = censuses[type];
+            ++census.count;
+            census.bytes += bytes;
+         }
+
+         void add(const LoadCommand<bits> *lc) {
+            add(Stats::type_name(*lc),
+                object_size<LoadCommand<bits>, Segment_LINKEDIT<bits>, Segment<bits>,
+                DyldInfo<bits>, Symtab<bits>, Dysymtab<bits>, FunctionStarts<bits>,
+                DataInCode<bits>, CodeSignature<bits>, DylibCommand<bits>>(lc));
+
+            if (auto segment = dynamic_cast<const Segment<bits> *>(lc)) {
+               for (const Section<bits> *section : segment->sections) {
+                  add(section);
+               }
+            } else if (auto dyld_info = dynamic_cast<const DyldInfo<bits> *>(lc)) {
+               add(dyld_info);
+            } else if (auto symtab = dynamic_cast<const Symtab<bits> *>(lc)) {
+               for (const Nlist<bits> *sym : symtab->syms) {
+                  add("Nlist", sizeof(*sym));
+               }
+               for (const String<bits> *str : symtab->strs) {
+                  add("String", sizeof(*str) + str->str.capacity());
+               }
+            } else if (auto dice = dynamic_cast<const DataInCode<bits> *>(lc)) {
+               for (const DataInCodeEntry<bits> *entry : dice->content) {
+                  add("DataInCodeEntry", sizeof(*entry));
+               }
+            }
+         }
+
+      private:
+         Stats::Censuses& censuses;
+
+         void add(const Section<bits> *section) {
+            add("Section", sizeof(*section));
+            for (const SectionBlob<bits> *blob : section->content) {
+               if (auto inst = dynamic_cast<const Instruction<bits> *>(blob)) {
+                  add(Stats::type_name(*inst), sizeof(*inst) + inst->instbuf.capacity());
+                  if (inst->imm) {
+                     add(Stats::type_name(*inst->imm), sizeof(*inst->imm));
+                  }
+               } else {
+                  add(Stats::type_name(*blob),
+                      object_size<SectionBlob<bits>, DataBlob<bits>, DataRange<bits>, ZeroBlob<bits>,
+                      LazySymbolPointer<bits>, SymbolPointer<bits>, Immediate<bits>,
+                      Placeholder<bits>, Padding<bits>, RelocBlob<bits>,
+                      StubHelperBlob<bits>>(blob));
+               }
+            }
+         }
+
+         void add(const DyldInfo<bits> *dyld_info) {
+            if (dyld_info->rebase == nullptr || dyld_info->bind == nullptr ||
+                dyld_info->lazy_bind == nullptr || dyld_info->export_info == nullptr) {
+               return;
+            }
+            for (const RebaseNode<bits> *node : dyld_info->rebase->rebasees) {
+               add("RebaseNode", sizeof(*node));
+            }
+            for (const BindNode<bits, false> *node : dyld_info->bind->bindees) {
+               add("BindNode", sizeof(*node) + node->sym.capacity());
+            }
+            for (const LazyBindNode<bits> *node : dyld_info->lazy_bind->bindees) {
+               add("LazyBindNode", sizeof(*node) + node->sym.capacity());
+            }
+            for (const auto& [name, node] : dyld_info->export_info->trie) {
+               add(Stats::type_name(*node),
+                   object_size<ExportNode<bits>, RegularExportNode<bits>, ReexportNode<bits>,
+                   StubExportNode<bits>>(node) + name.capacity());
+            }
+         }
+      };
+
+   }
+
+   void Stats::Timer::stop(const char *name) {
+      if (enabled && stats) {
+         const auto now = clock::now();
+         stats->time(name, std::chrono::duration<double>(now - start).count());
+         start = now;
+      }
+   }
+
+   template <Bits bits>
+   void Stats::Timer::stop(const char *name, const LoadCommand<bits> *lc) {
+      if (enabled && stats) {
+         const auto now = clock::now();
+         std::string label = std::string(name) + " " + type_name(*lc);
+         if (auto segment = dynamic_cast<const Segment<bits> *>(lc)) {
+            label += "(" + segment->name() + ")";
+         }
+         stats->time(label, std::chrono::duration<double>(now - start).count());
+         start = clock::now(); /* don't bill the label to the next step */
+      }
+   }
+
+   void Stats::time(const std::string& name, double seconds) {
+      std::lock_guard<std::mutex> lock(mutex);
+      const auto it = timing_index.emplace(name, timings.size());
+      if (it.second) {
+         timings.emplace_back(name, 0);
+      }
+      timings[it.first->second].second += seconds;
+   }
+
+   void Stats::resolver(const std::string& name, std::size_t found, std::size_t todo,
+                        std::size_t unresolved) {
+      std::lock_guard<std::mutex> lock(mutex);
+      resolvers.push_back({name, found, todo, unresolved});
+   }
+
+   template <Bits bits>
+   void Stats::census(const std::string& label, const Archive<bits>& archive) {
+      Censuses census;
+      Counter<bits> counter(census);
+      for (const LoadCommand<bits> *lc : archive.load_commands) {
+         counter.add(lc);
+      }
+
+      std::lock_guard<std::mutex> lock(mutex);
+      censuses.emplace_back(label, std::move(census));
+   }
+
+   std::string Stats::demangle(const char *name) {
+      int status;
+      std::unique_ptr<char, decltype(&free)> demangled(abi::__cxa_demangle(name, nullptr, nullptr,
+                                                                           &status), &free);
+      std::string s = status == 0 ? demangled.get() : name;
+      const auto args = s.find('<');
+      if (args != std::string::npos) {
+         s.erase(args);
+      }
+      const auto ns = s.rfind("::");
+      if (ns != std::string::npos) {
+         s.erase(0, ns + 2);
+      }
+      return s;
+   }
+
+   void Stats::print(std::ostream& os) const {
+      const auto flags = os.flags();
+      os << std::dec;
+
+      os << "timings (ms):" << std::endl;
+      for (const auto& [name, seconds] : timings) {
+         os << "  " << std::left << std::setw(48) << name << std::right << std::fixed
+            << std::setprecision(3) << std::setw(12) << seconds * 1000 << std::endl;
+      }
+
+      for (const auto& [label, census] : censuses) {
+         os << "nodes (" << label << "):" << std::endl;
+         os << "  " << std::left << std::setw(24) << "type" << std::right << std::setw(12)
+            << "count" << std::setw(14) << "bytes" << std::endl;
+         Census total;
+         for (const auto& [type, entry] : census) {
+            os << "  " << std::left << std::setw(24) << type << std::right << std::setw(12)
+               << entry.count << std::setw(14) << entry.bytes << std::endl;
+            total.count += entry.count;
+            total.bytes += entry.bytes;
+         }
+         os << "  " << std::left << std::setw(24) << "total" << std::right << std::setw(12)
+            << total.count << std::setw(14) << total.bytes << std::endl;
+      }
+
+      if (!resolvers.empty()) {
+         os << "resolvers:" << std::endl;
+         os << "  " << std::left << std::setw(40) << "name" << std::right << std::setw(10)
+            << "found" << std::setw(10) << "todo" << std::setw(12) << "unresolved" << std::endl;
+         for (const Resolver& resolver : resolvers) {
+            os << "  " << std::left << std::setw(40) << resolver.name << std::right
+               << std::setw(10) << resolver.found << std::setw(10) << resolver.todo
+               << std::setw(12) << resolver.unresolved << std::endl;
+         }
+      }
+
+      os.flags(flags);
+   }
+
+   void Stats::print_json(std::ostream& os) const {
+      const auto flags = os.flags();
+      os << std::dec;
+
+      os << "{\"timings\": {";
+      const char *sep = "";
+      for (const auto& [name, seconds] : timings) {
+         os << sep << json_string(name) << ": " << seconds;
+         sep = ", ";
+      }
+
+      os << "}, \"nodes\": {";
+      sep = "";
+      for (const auto& [label, census] : censuses) {
+         os << sep << json_string(label) << ": {";
+         const char *type_sep = "";
+         for (const auto& [type, entry] : census) {
+            os << type_sep << json_string(type) << ": {\"count\": " << entry.count
+               << ", \"bytes\": " << entry.bytes << "}";
+            type_sep = ", ";
+         }
+         os << "}";
+         sep = ", ";
+      }
+
+      os << "}, \"resolvers\": [";
+      sep = "";
+      for (const Resolver& resolver : resolvers) {
+         os << sep << "{\"name\": " << json_string(resolver.name) << ", \"found\": "
+            << resolver.found << ", \"todo\": " << resolver.todo << ", \"unresolved\": "
+            << resolver.unresolved << "}";
+         sep = ", ";
+      }
+      os << "]}" << std::endl;
+
+      os.flags(flags);
+   }
+
+   template void Stats::Timer::stop(const char *, const LoadCommand<Bits::M32> *);
+   template void Stats::Timer::stop(const char *, const LoadCommand<Bits::M64> *);
+   template void Stats::census(const std::string&, const Archive<Bits::M32>&);
+   template void Stats::census(const std::string&, const Archive<Bits::M64>&);
+
+}
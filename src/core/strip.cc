@@ -0,0 +1,356 @@
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <set>
+#include <unordered_set>
+#include <mach-o/loader.h>
+
+extern "C" {
+#include <xed/xed-interface.h>
+}
+
+#include "strip.hh"
+#include "archive.hh"
+#include "section.hh"
+#include "section_blob.hh"
+#include "instruction.hh"
+#include "lc.hh"
+#include "linkedit.hh"
+#include "data_in_code.hh"
+#include "dyldinfo.hh"
+#include "export_info.hh"
+#include "symtab.hh"
+#include "util.hh"
+
+namespace MachO {
+
+   namespace {
+
+      template <Bits bits>
+      struct Atom {
+         using Iterator = typename Section<bits>::Content::iterator;
+
+         Iterator begin;
+         Iterator end;
+         std::size_t vmbegin;
+         std::size_t vmend;
+         Atom *next = nullptr; /*!< following atom in the same section */
+         bool strippable;
+         bool reached = false;
+      };
+
+      bool falls_through(const xed_decoded_inst_t& xedd) {
+         switch (xed_decoded_inst_get_category(&xedd)) {
+         case XED_CATEGORY_UNCOND_BR:
+         case XED_CATEGORY_RET:
+            return false;
+         default:
+            break;
+         }
+         switch (xed_decoded_inst_get_iclass(&xedd)) {
+         case XED_ICLASS_HLT:
+         case XED_ICLASS_UD2:
+            return false;
+         default:
+            return true;
+         }
+      }
+
+      template <Bits bits>
+      class Stripper {
+      public:
+         Stripper(Archive<bits>& archive): archive(archive) {}
+
+         std::size_t run(const std::vector<std::string>& keep);
+
+      private:
+         using Content = typename Section<bits>::Content;
+
+         Archive<bits>& archive;
+         std::vector<std::unique_ptr<Atom<bits>>> atoms;
+         std::map<std::size_t, Atom<bits> *> by_vmaddr; /*!< key: vmbegin */
+         std::vector<Atom<bits> *> worklist;
+
+         void split(Section<bits> *section, const std::set<std::size_t>& cuts);
+         Atom<bits> *find(std::size_t vmaddr) const;
+         void mark(std::size_t vmaddr);
+         void mark(const SectionBlob<bits> *blob) { if (blob) { mark(blob->loc.vmaddr); } }
+         void scan(Atom<bits> *atom);
+         void scan_inst(const Instruction<bits> *inst);
+         void scan_data(const Atom<bits> *atom);
+      };
+
+      template <Bits bits>
+      void Stripper<bits>::split(Section<bits> *section, const std::set<std::size_t>& cuts) {
+         Content& content = section->content;
+         if (content.empty()) {
+            return;
+         }
+
+         const std::unordered_set<std::string> strippable_sects =
+            {SECT_TEXT, SECT_CONST, SECT_CSTRING, SECT_DATA, SECT_BSS, SECT_COMMON};
+         const bool strippable = strippable_sects.count(section->name()) != 0;
+         const bool cstrings = (section->sect.flags & SECTION_TYPE) == S_CSTRING_LITERALS;
+         const std::size_t sect_end = section->sect.addr + section->sect.size;
+
+         Atom<bits> *prev = nullptr;
+         const auto close = [&] (auto begin, auto end, std::size_t vmbegin, std::size_t vmend) {
+            atoms.push_back(std::make_unique<Atom<bits>>());
+            Atom<bits> *atom = atoms.back().get();
+            atom->begin = begin;
+            atom->end = end;
+            atom->vmbegin = vmbegin;
+            atom->vmend = vmend;
+            atom->strippable = strippable;
+            if (prev) {
+               prev->next = atom;
+            }
+            prev = atom;
+            by_vmaddr[vmbegin] = atom; /* non-empty atoms replace empty ones at the same address */
+         };
+
+         auto atom_begin = content.begin();
+         std::size_t vmbegin = section->sect.addr;
+         auto next_cut = cuts.upper_bound(vmbegin);
+         bool after_string = false;
+         for (auto it = content.begin(); it != content.end(); ++it) {
+            const std::size_t vmaddr = (*it)->loc.vmaddr;
+            if (strippable && it != atom_begin &&
+                ((next_cut != cuts.end() && vmaddr >= *next_cut) || after_string)) {
+               close(atom_begin, it, vmbegin, vmaddr);
+               atom_begin = it;
+               vmbegin = vmaddr;
+               next_cut = cuts.upper_bound(vmbegin);
+               after_string = false;
+            }
+
+            if (cstrings) {
+               const auto byte = dynamic_cast<const DataBlob<bits> *>(*it);
+               after_string = after_string || (byte && byte->data == '\0');
+            }
+         }
+         close(atom_begin, content.end(), vmbegin, std::max(vmbegin, sect_end));
+      }
+
+      template <Bits bits>
+      Atom<bits> *Stripper<bits>::find(std::size_t vmaddr) const {
+         auto it = by_vmaddr.upper_bound(vmaddr);
+         if (it == by_vmaddr.begin()) {
+            return nullptr;
+         }
+         Atom<bits> *atom = std::prev(it)->second;
+         /* a pointer to the end of a section refers to its last atom */
+         if (vmaddr < atom->vmend || (vmaddr == atom->vmend && atom->next == nullptr)) {
+            return atom;
+         }
+         return nullptr;
+      }
+
+      template <Bits bits>
+      void Stripper<bits>::mark(std::size_t vmaddr) {
+         Atom<bits> *atom = find(vmaddr);
+         if (atom && !atom->reached) {
+            atom->reached = true;
+            worklist.push_back(atom);
+         }
+      }
+
+      template <Bits bits>
+      void Stripper<bits>::scan_inst(const Instruction<bits> *inst) {
+         mark(inst->brdisp);
+         mark(inst->memdisp);
+         if (inst->imm) {
+            mark(inst->imm->pointee);
+         }
+
+         /* absolute addresses that weren't recognized as pointers, e.g. jump table bases */
+         const xed_decoded_inst_t *xedd = &inst->xedd;
+         for (unsigned i = 0; i < xed_decoded_inst_number_of_memory_operands(xedd); ++i) {
+            const xed_reg_enum_t base = xed_decoded_inst_get_base_reg(xedd, i);
+            if (base != XED_REG_EIP && base != XED_REG_RIP &&
+                xed_decoded_inst_get_memory_displacement_width(xedd, i) == sizeof(uint32_t)) {
+               mark(static_cast<uint32_t>(xed_decoded_inst_get_memory_displacement(xedd, i)));
+            }
+         }
+         if (xed_decoded_inst_get_immediate_width(xedd) == sizeof(uint32_t)) {
+            mark(static_cast<uint32_t>(xed_decoded_inst_get_unsigned_immediate(xedd)));
+         }
+      }
+
+      template <Bits bits>
+      void Stripper<bits>::scan_data(const Atom<bits> *atom) {
+         /* every aligned pointer-sized run of data bytes may be an address */
+         std::size_t value = 0;
+         std::size_t nbytes = 0;
+         const auto feed = [&] (std::size_t vmaddr, uint8_t byte) {
+            const std::size_t index = vmaddr % sizeof(ptr_t<bits>);
+            if (index != nbytes) {
+               nbytes = 0;
+               if (index != 0) {
+                  return;
+               }
+            }
+            if (nbytes == 0) {
+               value = 0;
+            }
+            value |= static_cast<std::size_t>(byte) << (8 * nbytes);
+            if (++nbytes == sizeof(ptr_t<bits>)) {
+               mark(value);
+               nbytes = 0;
+            }
+         };
+         
+         for (auto it = atom->begin; it != atom->end; ++it) {
+            if (const auto byte = dynamic_cast<const DataBlob<bits> *>(*it)) {
+               feed(byte->loc.vmaddr, byte->data);
+            } else if (const auto range = dynamic_cast<const DataRange<bits> *>(*it)) {
+               for (std::size_t i = 0; i < range->data.size(); ++i) {
+                  feed(range->loc.vmaddr + i, range->data[i]);
+               }
+            } else if ((*it)->size() > 0) {
+               nbytes = 0;
+            }
+         }
+      }
+
+      template <Bits bits>
+      void Stripper<bits>::scan(Atom<bits> *atom) {
+         const Instruction<bits> *last = nullptr;
+         for (auto it = atom->begin; it != atom->end; ++it) {
+            const SectionBlob<bits> *blob = *it;
+            if (const auto inst = dynamic_cast<const Instruction<bits> *>(blob)) {
+               scan_inst(inst);
+               last = inst;
+            } else if (const auto imm = dynamic_cast<const Immediate<bits> *>(blob)) {
+               mark(imm->pointee);
+               last = nullptr;
+            } else if (const auto lazy = dynamic_cast<const LazySymbolPointer<bits> *>(blob)) {
+               mark(lazy->pointee);
+               last = nullptr;
+            } else if (blob->size() > 0) {
+               last = nullptr;
+            }
+         }
+         scan_data(atom);
+
+         if (last && falls_through(last->xedd) && atom->next && !atom->next->reached) {
+            atom->next->reached = true;
+            worklist.push_back(atom->next);
+         }
+      }
+
+      template <Bits bits>
+      std::size_t Stripper<bits>::run(const std::vector<std::string>& keep) {
+         const auto function_starts = archive.template subcommands<FunctionStarts>();
+         Symtab<bits> *symtab = archive.template subcommand<Symtab>();
+
+         /* atoms */
+         std::set<std::size_t> cuts;
+         for (const FunctionStarts<bits> *fs : function_starts) {
+            for (const Placeholder<bits> *entry : fs->entries) {
+               cuts.insert(entry->loc.vmaddr);
+            }
+         }
+         if (symtab) {
+            for (const Nlist<bits> *sym : symtab->syms) {
+               if (sym->type() == Nlist<bits>::Type::SECT && sym->value) {
+                  cuts.insert(sym->value->loc.vmaddr);
+               }
+            }
+         }
+         for (Section<bits> *section : archive.sections()) {
+            split(section, cuts);
+         }
+
+         /* roots */
+         for (const auto& atom : atoms) {
+            if (!atom->strippable) {
+               atom->reached = true;
+               worklist.push_back(atom.get());
+            }
+         }
+         if (const EntryPoint<bits> *entry = archive.template subcommand<EntryPoint>()) {
+            mark(entry->entry);
+         }
+         if (DyldInfo<bits> *dyld_info = archive.template subcommand<DyldInfo>()) {
+            for (const auto& [name, node] : dyld_info->export_info->trie) {
+               if (const auto regular = dynamic_cast<const RegularExportNode<bits> *>(node)) {
+                  mark(regular->value);
+               }
+            }
+         }
+         for (const std::string& name : keep) {
+            bool found = false;
+            if (symtab) {
+               for (const Nlist<bits> *sym : symtab->syms) {
+                  if (sym->string && sym->string->str == name && sym->value) {
+                     mark(sym->value);
+                     found = true;
+                  }
+               }
+            }
+            if (!found) {
+               throw error("dead_strip: symbol `%s' not defined", name.c_str());
+            }
+         }
+
+         /* mark */
+         while (!worklist.empty()) {
+            Atom<bits> *atom = worklist.back();
+            worklist.pop_back();
+            scan(atom);
+         }
+
+         /* sweep; placeholders stay active so that references into stripped atoms still build */
+         std::size_t stripped = 0;
+         for (const auto& atom : atoms) {
+            if (atom->reached) {
+               continue;
+            }
+            for (auto it = atom->begin; it != atom->end; ++it) {
+               SectionBlob<bits> *blob = *it;
+               if (!blob->active || blob->size() == 0) {
+                  continue;
+               }
+               blob->active = false;
+               stripped += blob->size();
+               if (auto inst = dynamic_cast<Instruction<bits> *>(blob)) {
+                  if (inst->imm) {
+                     inst->imm->active = false;
+                  }
+               }
+            }
+         }
+
+         for (FunctionStarts<bits> *fs : function_starts) {
+            fs->entries.remove_if([&] (const Placeholder<bits> *entry) {
+               const Atom<bits> *atom = find(entry->loc.vmaddr);
+               return atom && !atom->reached;
+            });
+         }
+         for (DataInCode<bits> *dice : archive.template subcommands<DataInCode>()) {
+            auto& content = dice->content;
+            content.erase(std::remove_if(content.begin(), content.end(),
+                                         [] (DataInCodeEntry<bits> *entry) {
+                                            if (entry->start && !entry->start->active) {
+                                               delete entry;
+                                               return true;
+                                            }
+                                            return false;
+                                         }), content.end());
+         }
+
+         return stripped;
+      }
+
+   }
+
+   template <Bits bits>
+   std::size_t dead_strip(Archive<bits>& archive, const std::vector<std::string>& keep) {
+      return Stripper<bits>(archive).run(keep);
+   }
+
+   template std::size_t dead_strip(Archive<Bits::M32>&, const std::vector<std::string>&);
+   template std::size_t dead_strip(Archive<Bits::M64>&, const std::vector<std::string>&);
+
+}
@@ -0,0 +1,62 @@
+#include <unistd.h>
+
+#include "trace.hh"
+#include "util.hh"
+
+namespace MachO {
+
+   Trace *trace = nullptr;
+
+   Trace::Trace(): origin(clock::now()) {
+      tids.emplace(std::this_thread::get_id(), 1);
+   }
+
+   void Trace::complete(const char *name, clock::time_point start, clock::time_point end,
+                        Args args) {
+      std::lock_guard<std::mutex> lock(mutex);
+      const unsigned tid = tids.emplace(std::this_thread::get_id(), tids.size() + 1).first->second;
+      events.push_back({name, tid, start, end, std::move(args)});
+   }
+
+   void Trace::write(std::ostream& os) const {
+      const auto flags = os.flags();
+      const auto precision = os.precision();
+      os << std::dec << std::fixed;
+      os.precision(3);
+
+      const pid_t pid = getpid();
+      const auto micros = [&] (clock::duration d) {
+         return std::chrono::duration<double, std::micro>(d).count();
+      };
+
+      os << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [" << std::endl;
+      const char *sep = "";
+      for (const auto& [id, tid] : tids) {
+         const std::string thread = tid == 1 ? "main" : "worker " + std::to_string(tid - 1);
+         os << sep << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << pid
+            << ", \"tid\": " << tid << ", \"args\": {\"name\": " << json_string(thread) << "}}";
+         sep = ",\n";
+      }
+      for (const Event& event : events) {
+         os << sep << "{\"name\": " << json_string(event.name) << ", \"cat\": \"macho\", "
+            << "\"ph\": \"X\", \"pid\": " << pid << ", \"tid\": " << event.tid << ", \"ts\": "
+            << micros(event.start - origin) << ", \"dur\": " << micros(event.end - event.start);
+         if (!event.args.empty()) {
+            os << ", \"args\": {";
+            const char *arg_sep = "";
+            for (const auto& [key, value] : event.args) {
+               os << arg_sep << json_string(key) << ": " << json_string(value);
+               arg_sep = ", ";
+            }
+            os << "}";
+         }
+         os << "}";
+         sep = ",\n";
+      }
+      os << std::endl << "]}" << std::endl;
+
+      os.precision(precision);
+      os.flags(flags);
+   }
+
+}
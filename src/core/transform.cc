@@ -1,4 +1,11 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <iostream>
+#include <typeinfo>
+
 #include "transform.hh"
+#include "stats.hh"
 
 namespace MachO {
 
@@ -62,6 +69,107 @@ namespace MachO {
          s2.reserved2 = s1.reserved2;
       }
 
+   template <Bits b1, Bits b2>
+   std::size_t TransformEnv<b1, b2>::next_id() {
+      static std::atomic<std::size_t> counter(0);
+      return ++counter;
+   }
+
+   template <Bits b1, Bits b2>
+   void TransformEnv<b1, b2>::add_node(const Node *key, Node *pointee) {
+      if (parent) {
+         resolver.add(key, pointee);
+         return;
+      }
+
+      Node::Translation& slot = key->translation;
+      if (slot.env != id) {
+         slot = Node::Translation();
+         slot.env = id;
+      }
+      assert(!slot.found || slot.node == pointee);
+      if (slot.found) {
+         return;
+      }
+      slot.node = pointee;
+      slot.found = true;
+      ++filled;
+
+      if (slot.pending) {
+         const auto it = pending.find(key);
+         for (const Node **pointer : it->second) {
+            *pointer = pointee;
+         }
+         pending.erase(it);
+         slot.pending = false;
+      }
+   }
+
+   template <Bits b1, Bits b2>
+   void TransformEnv<b1, b2>::resolve_node(const Node *key, const Node **pointer) {
+      /* slots are only written by the root environment, never while shards run */
+      Node::Translation& slot = key->translation;
+      if (slot.env == id && slot.found) {
+         *pointer = slot.node;
+         return;
+      }
+
+      if (parent) {
+         resolver.resolve(key, pointer);
+         return;
+      }
+
+      if (slot.env != id) {
+         slot = Node::Translation();
+         slot.env = id;
+      }
+      pending[key].push_back(pointer);
+      slot.pending = true;
+      peak_pending = std::max(peak_pending, pending.size());
+   }
+
+   template <Bits b1, Bits b2>
+   TransformEnv<b1, b2>::~TransformEnv() {
+      if (stats && !parent) {
+         std::size_t unresolved = 0;
+         for (const auto& [key, pointers] : pending) {
+            unresolved += pointers.size();
+         }
+         stats->resolver(resolver.name, filled, peak_pending + shard_pending, unresolved);
+      }
+
+      if (!pending.empty()) {
+         std::cerr << "TransformEnv: " << pending.size() << " unresolved nodes" << std::endl;
+         for (const auto& [key, pointers] : pending) {
+            std::cerr << "  " << typeid(*key).name() << " " << key << " ("
+                      << pointers.size() << " references)" << std::endl;
+         }
+      }
+   }
+
+   template <Bits b1, Bits b2>
+   void TransformEnv<b1, b2>::merge(TransformEnv& shard) {
+      shard_pending += shard.resolver.peak_todo;
+      for (const auto& [key, pointee] : shard.resolver.found) {
+         add_node(key, pointee);
+      }
+      for (const auto& [key, nodes] : shard.resolver.todo) {
+         for (const auto& node : nodes) {
+            resolve_node(key, node.first);
+         }
+      }
+      shard.resolver.todo.clear();
+
+      for (const CallThunkKey& key : shard.thunk_uses) {
+         const auto it = unplaced_thunks.find(key);
+         if (it != unplaced_thunks.end()) {
+            trailer.splice(trailer.end(), it->second);
+            unplaced_thunks.erase(it);
+         }
+      }
+      trailer.splice(trailer.end(), shard.trailer);
+   }
+
    template class TransformEnv<Bits::M32, Bits::M64>;
    template class TransformEnv<Bits::M64, Bits::M32>;
    
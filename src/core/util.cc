@@ -1,4 +1,6 @@
 #include <exception>
+#include <iomanip>
+#include <sstream>
 
 #include <sys/errno.h>
 #include <string.h>
@@ -9,5 +11,25 @@
 
 namespace MachO {
 
+   std::string json_string(const std::string& s) {
+      std::stringstream ss;
+      ss << '"';
+      for (const char c : s) {
+         switch (c) {
+         case '"':  ss << "\\\""; break;
+         case '\\': ss << "\\\\"; break;
+         default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+               ss << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int) c
+                  << std::dec;
+            } else {
+               ss << c;
+            }
+         }
+      }
+      ss << '"';
+      return ss.str();
+   }
+
 }
 
@@ -5,6 +5,7 @@
 
 #include "command.hh"
 #include "core/image.hh"
+#include "core/stats.hh"
 
 int Command::handle(int argc, char *argv[]) {
    int optstat = parseopts(argc, argv);
@@ -32,7 +33,16 @@ void Command::usage(std::ostream& os) const {
 int Command::parseopts(int argc, char *argv[]) {
    int optchar;
    int longindex = -1;
-   const auto longopts_vec = this->longopts();
+   auto longopts_vec = this->longopts();
+   const auto common_longopts_vec = this->common_longopts();
+   if (!common_longopts_vec.empty()) {
+      if (!longopts_vec.empty() && longopts_vec.back().name == nullptr) {
+         longopts_vec.pop_back();
+      }
+      longopts_vec.insert(longopts_vec.end(), common_longopts_vec.begin(),
+                          common_longopts_vec.end());
+      longopts_vec.push_back({0});
+   }
    const struct option *longopts = longopts_vec.data();
    
    try {
@@ -49,7 +59,7 @@ int Command::parseopts(int argc, char *argv[]) {
             log(ss.str());
             return -1;
          } else {
-            int optstat = opthandler(optchar);
+            int optstat = optchar >= COMMON_OPT ? common_opthandler(optchar) : opthandler(optchar);
             if (optstat <= 0) {
                return optstat;
             }
@@ -142,3 +152,37 @@ int Operation::parse(char *option) {
 
    return 1;
 }
+
+int InOutCommand::common_opthandler(int optchar) {
+   switch (optchar) {
+   case STATS:
+      if (optarg == nullptr || std::string(optarg) == "text") {
+         stats_format = StatsFormat::TEXT;
+      } else if (std::string(optarg) == "json") {
+         stats_format = StatsFormat::JSON;
+      } else {
+         throw std::string("stats format must be `text' or `json'");
+      }
+      stats = std::make_unique<MachO::Stats>();
+      MachO::stats = stats.get();
+      return 1;
+   default: abort();
+   }
+}
+
+int InOutCommand::handle(int argc, char *argv[]) {
+   const int status = Command::handle(argc, argv);
+   MachO::stats = nullptr;
+
+   switch (stats_format) {
+   case StatsFormat::NONE:
+      break;
+   case StatsFormat::TEXT:
+      stats->print(std::cerr);
+      break;
+   case StatsFormat::JSON:
+      stats->print_json(std::cerr);
+      break;
+   }
+   return status;
+}
@@ -5,6 +5,7 @@
  */
 
 #include <cstdio>
+#include <cstdlib>
 #include <fcntl.h>
 #include <unistd.h>
 #include <unordered_set>
@@ -14,10 +15,13 @@
 #include <getopt.h>
 #include <sstream>
 #include <libgen.h>
+#include <fstream>
+#include <memory>
 
 #include "core/macho.hh"
 #include "core/archive.hh"
 #include "core/instruction.hh"
+#include "core/trace.hh"
 #include "tweak.hh"
 
 #include "command.hh"
@@ -31,15 +35,22 @@
 #include "transform.hh"
 #include "print.hh"
 #include "rebasify.hh"
+#include "reorder.hh"
+#include "stats.hh"
 
 const char *progname = nullptr;
 static const char *usagestr =
-   "usage: %1$s subcommand [options...] [args...]\n"                    \
+   "usage: %1$s [-r] [--trace <path>] subcommand [options...] [args...]\n"               \
    "       %1$s -h\n"                                                   \
    "\n"                                                                 \
+   "Options:\n"                                                         \
+   "  -r               disassemble __text by recursive descent from known code addresses\n" \
+   "  --trace <path>   write a Chrome trace-event JSON of the run to path (or set MACHO_TRACE)\n" \
+   "\n"                                                                 \
    "Commands:\n"                                                     \
    "  %1$s help                                  print help dialog\n"   \
    "  %1$s noop [-h] inpath [outpath='a.out']    read in mach-o and write back out\n" \
+   "  %1$s stats [-h] [-j] path                  print node counts and parse timings\n" \
    ;
 
 static void usage(FILE *f = stderr) {
@@ -49,12 +60,18 @@ static void usage(FILE *f = stderr) {
 int main(int argc, char *argv[]) {
    progname = argv[0];
 
-   const char *main_optstr = "hi";
+   /* stop at the subcommand, whose options are its own */
+   const char *main_optstr = "+hir";
+   const option main_longopts[] = {
+      {"help", no_argument, nullptr, 'h'},
+      {"trace", required_argument, nullptr, 'T'},
+      {0}};
    bool inplace;
+   const char *trace_path = getenv("MACHO_TRACE");
 
    /* read main options */
    int optchar;
-   while ((optchar = getopt(argc, argv, main_optstr)) >= 0) {
+   while ((optchar = getopt_long(argc, argv, main_optstr, main_longopts, nullptr)) >= 0) {
       switch (optchar) {
       case 'h':
          usage(stdout);
@@ -63,6 +80,14 @@ int main(int argc, char *argv[]) {
       case 'i':
          inplace = true;
          break;
+
+      case 'r':
+         MachO::parse_options.recursive_descent = true;
+         break;
+
+      case 'T':
+         trace_path = optarg;
+         break;
          
       default:
          usage(stderr);
@@ -91,6 +116,8 @@ int main(int argc, char *argv[]) {
        {"transform", std::make_shared<TransformCommand>()},
        {"print", std::make_shared<PrintCommand>()},
        {"rebasify", std::make_shared<Rebasify>()},
+       {"reorder", std::make_shared<ReorderCommand>()},
+       {"stats", std::make_shared<StatsCommand>()},
       };
 
    auto it = subcommands.find(subcommand);
@@ -100,10 +127,24 @@ int main(int argc, char *argv[]) {
       return 1;
    } else {
       std::shared_ptr<Command> cmd = it->second;
-      if (cmd->handle(argc, argv) < 0) {
-         return 1;
+      std::unique_ptr<MachO::Trace> tracer;
+      if (trace_path != nullptr && *trace_path != '\0') {
+         tracer = std::make_unique<MachO::Trace>();
+         MachO::trace = tracer.get();
+      }
+
+      const int status = cmd->handle(argc, argv) < 0 ? 1 : 0;
+
+      if (tracer) {
+         MachO::trace = nullptr;
+         std::ofstream f(trace_path);
+         if (!f) {
+            fprintf(stderr, "%s: failed to open trace `%s'\n", progname, trace_path);
+            return 1;
+         }
+         tracer->write(f);
       }
-      return 0;
+      return status;
    }
 
    return 0;
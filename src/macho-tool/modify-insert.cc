@@ -1,3 +1,5 @@
+#include <cstring>
+
 #include "modify-insert.hh"
 #include "core/archive.hh"
 #include "core/instruction.hh"
@@ -15,12 +17,27 @@ void ModifyCommand::Insert::Instruction::operator()(MachO::MachO *macho) {
 
 template <MachO::Bits b>
 void ModifyCommand::Insert::Instruction::workT(MachO::Archive<b> *archive) {
-   /* read bytes */
-   char *buf = new char[*bytes];
-   assert(fread(buf, 1, *bytes, stdin) == *bytes);
-   archive->insert(new MachO::Instruction<b>(buf, buf + *bytes), loc, relation);
+   read();
+   archive->insert(new MachO::Instruction<b>(data.begin(), data.end()), loc, relation);
+}
+
+void ModifyCommand::Insert::Instruction::read() {
+   if (data.empty()) {
+      data.resize(*bytes);
+      if (fread(data.data(), 1, data.size(), stdin) != data.size()) {
+         throw std::string("insert: failed to read instruction bytes from stdin");
+      }
+   }
+}
+
+template <MachO::Bits b>
+MachO::Insertion<b> ModifyCommand::Insert::Instruction::insertion() const {
+   return {new MachO::Instruction<b>(data.begin(), data.end()), loc, relation};
 }
 
+template MachO::Insertion<MachO::Bits::M32> ModifyCommand::Insert::Instruction::insertion() const;
+template MachO::Insertion<MachO::Bits::M64> ModifyCommand::Insert::Instruction::insertion() const;
+
 int ModifyCommand::Insert::Instruction::subopthandler(int index, char *value) {
    switch (index) {
    case 0: // vmaddr
@@ -38,6 +55,15 @@ int ModifyCommand::Insert::Instruction::subopthandler(int index, char *value) {
    case 4: // bytes
       bytes = std::stoul(value, nullptr, 0);
       break;
+   case 5: // hex
+      if (value == nullptr || std::strlen(value) % 2 != 0) {
+         throw std::string("expected an even number of hex digits");
+      }
+      data.clear();
+      for (const char *it = value; *it; it += 2) {
+         data.push_back(stout<uint8_t>(std::string(it, 2), nullptr, 16));
+      }
+      break;
    default: abort();
    }
    return 1;
@@ -45,8 +71,11 @@ int ModifyCommand::Insert::Instruction::subopthandler(int index, char *value) {
 
 
 void ModifyCommand::Insert::Instruction::validate() const {
-   if (!bytes) {
-      throw std::string("specify instruction size with `bytes'");
+   if (!bytes && data.empty()) {
+      throw std::string("specify instruction size with `bytes' or instruction with `hex'");
+   }
+   if (bytes && !data.empty() && *bytes != data.size()) {
+      throw std::string("`bytes' doesn't match the length of `hex'");
    }
 }
 
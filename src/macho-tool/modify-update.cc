@@ -1,3 +1,6 @@
+#include <fstream>
+#include <iostream>
+
 #include "modify-update.hh"
 #include "util.hh"
 #include "core/lc.hh"
@@ -18,6 +21,12 @@ Operation *ModifyCommand::Update::getop(int index) {
    case 3: // strip-bind
       return new StripBind;
 
+   case 4: // rename-bind
+      return new RenameBind;
+
+   case 5: // rebind
+      return new Rebind;
+
    default: abort();
    }
 }
@@ -165,17 +174,18 @@ void ModifyCommand::Update::BindNode::workT(MachO::Archive<b> *archive) {
       bindinfo = dyldinfo->bind;
    }
 
-   auto bindee_it = bindinfo->find(*old_sym);
-   if (bindee_it == bindinfo->end()) {
+   const auto bindees = bindinfo->find(*old_sym);
+   if (bindees.empty()) {
       throw MachO::error("bind node for symbol `%s' not found", old_sym->c_str());
    }
-   auto bindee = *bindee_it;
-   
-   if (new_type) { bindee->type = *new_type; }
-   if (new_addend) { bindee->addend = *new_addend; }
-   if (new_dylib_ord) { bindee->dylib = load_dylibs[*new_dylib_ord - 1]; }
-   if (new_sym) { bindee->sym = *new_sym; }
-   if (new_flags) { bindee->flags = *new_flags; }
+
+   for (auto bindee : bindees) {
+      if (new_type) { bindee->type = *new_type; }
+      if (new_addend) { bindee->addend = *new_addend; }
+      if (new_dylib_ord) { bindee->dylib = load_dylibs.at(*new_dylib_ord - 1); }
+      if (new_sym) { bindinfo->rename(bindee, *new_sym); }
+      if (new_flags) { bindee->flags = *new_flags; }
+   }
 }
 
 int ModifyCommand::Update::StripBind::subopthandler(int index, char *value) {
@@ -183,6 +193,9 @@ int ModifyCommand::Update::StripBind::subopthandler(int index, char *value) {
    case 0: // suffix
       suffixes.emplace_back(value);
       return 1;
+   case 1: // prefix
+      prefix = value;
+      return 1;
    default: abort();
    }
 }
@@ -228,17 +241,181 @@ void ModifyCommand::Update::StripBind::workT(MachO::Archive<b> *archive) {
 
 template <MachO::Bits b, bool lazy>
 void ModifyCommand::Update::StripBind::workT(MachO::BindInfo<b, lazy> *bind_info) {
-   for (auto bindee : bind_info->bindees) {
-      strip(bindee->sym);
-   }
+   bind_info->rename_if([&] (const auto& bindee) { return strip(bindee.sym); });
 }
 
 
-void ModifyCommand::Update::StripBind::strip(std::string& s) const {
+std::optional<std::string> ModifyCommand::Update::StripBind::strip(const std::string& s) const {
+   if (prefix && s.compare(0, prefix->size(), *prefix) != 0) {
+      return std::nullopt;
+   }
+
+   std::string stripped = s;
    for (const std::string& suffix : suffixes) {
-      const auto index = s.find(suffix);
+      const auto index = stripped.find(suffix);
       if (index != std::string::npos) {
-         s.erase(index, suffix.size());
+         stripped.erase(index, suffix.size());
+      }
+   }
+   return stripped;
+}
+
+int ModifyCommand::Update::RenameBind::subopthandler(int index, char *value) {
+   switch (index) {
+   case 0: // suffix
+      suffix = value;
+      return 1;
+   case 1: // replace
+      replacement = value ? value : "";
+      return 1;
+   case 2: // lazy
+      lazy = true;
+      return 1;
+   case 3: // nonlazy
+      lazy = false;
+      return 1;
+   default: abort();
+   }
+}
+
+void ModifyCommand::Update::RenameBind::validate() const {
+   if (!suffix || suffix->empty()) {
+      throw std::string("must specify symbol suffix to rename with `suffix=<suffix>'");
+   }
+}
+
+void ModifyCommand::Update::RenameBind::operator()(MachO::MachO *macho) {
+   switch (macho->bits()) {
+   case MachO::Bits::M32:
+      workT<MachO::Bits::M32>(dynamic_cast<MachO::Archive<MachO::Bits::M32> *>(macho));
+      break;
+   case MachO::Bits::M64:
+      workT<MachO::Bits::M64>(dynamic_cast<MachO::Archive<MachO::Bits::M64> *>(macho));
+      break;
+   default: abort();
+   }
+}
+
+template <MachO::Bits b>
+void ModifyCommand::Update::RenameBind::workT(MachO::Archive<b> *archive) {
+   auto dyld_info = archive->template subcommand<MachO::DyldInfo>();
+   if (dyld_info == nullptr) {
+      throw std::string("missing dyld info");
+   }
+
+   if (!lazy || !*lazy) { workT(dyld_info->bind); }
+   if (!lazy || *lazy) { workT(dyld_info->lazy_bind); }
+}
+
+template <MachO::Bits b, bool l>
+void ModifyCommand::Update::RenameBind::workT(MachO::BindInfo<b, l> *bind_info) {
+   bind_info->rename_if([&] (const auto& bindee) -> std::optional<std::string> {
+      const std::string& sym = bindee.sym;
+      if (sym.size() < suffix->size() ||
+          sym.compare(sym.size() - suffix->size(), suffix->size(), *suffix) != 0) {
+         return std::nullopt;
+      }
+      return sym.substr(0, sym.size() - suffix->size()) + replacement;
+   });
+}
+
+int ModifyCommand::Update::Rebind::subopthandler(int index, char *value) {
+   switch (index) {
+   case 0: // sym
+      syms.emplace(value);
+      return 1;
+   case 1: // syms
+      read_syms(value);
+      return 1;
+   case 2: // new_dylib
+   case 3:
+      new_dylib_ord = stout<unsigned>(value, nullptr, 0);
+      return 1;
+   case 4: // prefix
+      prefix = value ? value : "";
+      return 1;
+   case 5: // lazy
+      if (value) {
+         throw std::string("`lazy' flag takes no arguments");
+      }
+      lazy = true;
+      return 1;
+   default: abort();
+   }
+}
+
+void ModifyCommand::Update::Rebind::read_syms(const char *path) {
+   std::ifstream file;
+   std::istream *is = &std::cin;
+   if (std::string(path) != "-") {
+      file.open(path);
+      if (!file) {
+         throw std::string("rebind: failed to open symbol list");
+      }
+      is = &file;
+   }
+
+   std::string sym;
+   while (std::getline(*is, sym)) {
+      if (!sym.empty()) {
+         syms.insert(sym);
+      }
+   }
+}
+
+void ModifyCommand::Update::Rebind::validate() const {
+   if (!new_dylib_ord) {
+      throw std::string("must specify new dylib ordinal with `new_dylib=<ord>'");
+   }
+}
+
+void ModifyCommand::Update::Rebind::operator()(MachO::MachO *macho) {
+   switch (macho->bits()) {
+   case MachO::Bits::M32:
+      {
+         auto archive = dynamic_cast<MachO::Archive<MachO::Bits::M32> *>(macho);
+         if (lazy) {
+            workT<MachO::Bits::M32, true>(archive);
+         } else {
+            workT<MachO::Bits::M32, false>(archive);
+         }
+         break;
       }
+   case MachO::Bits::M64:
+      {
+         auto archive = dynamic_cast<MachO::Archive<MachO::Bits::M64> *>(macho);
+         if (lazy) {
+            workT<MachO::Bits::M64, true>(archive);
+         } else {
+            workT<MachO::Bits::M64, false>(archive);
+         }
+         break;
+      }
+   default: abort();
    }
 }
+
+template <MachO::Bits b, bool l>
+void ModifyCommand::Update::Rebind::workT(MachO::Archive<b> *archive) {
+   auto load_dylibs = archive->template subcommands<MachO::DylibCommand, LC_LOAD_DYLIB>();
+
+   auto dyldinfo = archive->template subcommand<MachO::DyldInfo>();
+   if (dyldinfo == nullptr) {
+      throw MachO::error("LC_DYLDINFO command missing");
+   }
+
+   MachO::BindInfo<b, l> *bindinfo;
+   if constexpr (l) {
+      bindinfo = dyldinfo->lazy_bind;
+   } else {
+      bindinfo = dyldinfo->bind;
+   }
+
+   for (const std::string& sym : syms) {
+      if (bindinfo->find(sym).empty()) {
+         throw MachO::error("bind node for symbol `%s' not found", sym.c_str());
+      }
+   }
+
+   bindinfo->rebind(syms, load_dylibs.at(*new_dylib_ord - 1), prefix);
+}
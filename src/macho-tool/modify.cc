@@ -1,31 +1,174 @@
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+
 #include "modify.hh"
 #include "core/macho.hh"
 #include "core/archive.hh"
+#include "core/image.hh"
 #include "core/instruction.hh"
 #include "modify-insert.hh"
 #include "modify-delete.hh"
 #include "modify-start.hh"
 #include "modify-update.hh"
 
+namespace {
+
+   /* Instruction insertions and deletions, applied together so that each section is walked once
+    * however many sites are edited. */
+   struct Edits {
+      std::vector<ModifyCommand::Insert::Instruction *> inserts;
+      std::vector<ModifyCommand::Delete::Instruction *> deletes;
+
+      /** Take _op_ if it's an instruction edit. */
+      bool add(Functor *op) {
+         auto sub = dynamic_cast<Subcommand *>(op);
+         if (sub == nullptr) {
+            return false;
+         }
+         if (auto insert = dynamic_cast<ModifyCommand::Insert::Instruction *>(sub->op.get())) {
+            /* stdin is read in command-line order */
+            insert->read();
+            inserts.push_back(insert);
+            return true;
+         }
+         if (auto del = dynamic_cast<ModifyCommand::Delete::Instruction *>(sub->op.get())) {
+            deletes.push_back(del);
+            return true;
+         }
+         return false;
+      }
+
+      template <MachO::Bits b>
+      void apply(MachO::Archive<b> *archive) const {
+         std::vector<std::size_t> vmaddrs;
+         for (const auto del : deletes) {
+            vmaddrs.push_back(del->kind == ModifyCommand::Delete::Instruction::LocationKind::OFFSET ?
+                              archive->offset_to_vmaddr(del->loc) : del->loc);
+         }
+         std::sort(vmaddrs.begin(), vmaddrs.end());
+         vmaddrs.erase(std::unique(vmaddrs.begin(), vmaddrs.end()), vmaddrs.end());
+
+         std::size_t deleted = 0;
+         for (MachO::Section<b> *section : archive->sections()) {
+            const std::size_t end = section->sect.addr + section->sect.size;
+            auto next = std::lower_bound(vmaddrs.begin(), vmaddrs.end(),
+                                         (std::size_t) section->sect.addr);
+            for (auto it = section->content.begin();
+                 it != section->content.end() && next != vmaddrs.end() && *next < end; ++it) {
+               if (*next < (*it)->loc.vmaddr) {
+                  break;
+               }
+               auto inst = dynamic_cast<MachO::Instruction<b> *>(*it);
+               if (inst && inst->loc.vmaddr == *next) {
+                  inst->active = false;
+                  section->dirty = true;
+                  ++deleted;
+                  ++next;
+               }
+            }
+            if (next != vmaddrs.end() && *next < end) {
+               std::stringstream ss;
+               ss << "no instruction at vmaddr 0x" << std::hex << *next;
+               throw ss.str();
+            }
+         }
+         if (deleted != vmaddrs.size()) {
+            throw std::string("instruction to delete not in any section");
+         }
+
+         std::vector<MachO::Insertion<b>> insertions;
+         insertions.reserve(inserts.size());
+         for (const auto insert : inserts) {
+            insertions.push_back(insert->insertion<b>());
+         }
+         archive->insert(insertions);
+      }
+
+      bool empty() const { return inserts.empty() && deletes.empty(); }
+
+      void operator()(MachO::MachO *macho) const {
+         if (empty()) {
+            return;
+         }
+         switch (macho->bits()) {
+         case MachO::Bits::M32:
+            return apply(dynamic_cast<MachO::Archive<MachO::Bits::M32> *>(macho));
+         case MachO::Bits::M64:
+            return apply(dynamic_cast<MachO::Archive<MachO::Bits::M64> *>(macho));
+         default: abort();
+         }
+      }
+   };
+
+   /* Start _out_ as a copy of _in_ and write only what Archive::Relayout() changed. */
+   template <MachO::Bits b>
+   bool relayout(MachO::Archive<b> *archive, const MachO::Image& in, MachO::Image& out) {
+      const auto dirty = archive->Relayout();
+      if (!dirty) {
+         return false;
+      }
+      out.copy(0, &in.at<uint8_t>(0), in.size());
+      archive->Emit(out, *dirty);
+      out.truncate(dirty->size);
+      return true;
+   }
+
+   bool relayout(MachO::MachO *macho, const MachO::Image& in, MachO::Image& out) {
+      if (auto archive = dynamic_cast<MachO::Archive<MachO::Bits::M32> *>(macho)) {
+         return relayout(archive, in, out);
+      } else if (auto archive = dynamic_cast<MachO::Archive<MachO::Bits::M64> *>(macho)) {
+         return relayout(archive, in, out);
+      } else {
+         return false;
+      }
+   }
+
+}
+
 int ModifyCommand::work() {
    MachO::MachO *macho = MachO::MachO::Parse(*in_img);
-   
+
+   /* other operations don't touch section content, so instruction edits can be deferred */
+   Edits edits;
+   bool only_edits = true;
    for (auto& op : operations) {
-      (*op)(macho);
+      if (!edits.add(op.get())) {
+         (*op)(macho);
+         only_edits = false;
+      }
+   }
+   edits(macho);
+
+   /* instruction edits leave the rest of the input's layout alone, so only what they moved needs
+    * to be laid out and written again */
+   if (only_edits && !edits.empty() && relayout(macho, *in_img, *out_img)) {
+      return 0;
    }
-   
+
    macho->Build();
    macho->Emit(*out_img);
    return 0;
 }
 
 int ModifyCommand::opthandler(int optchar) {
-   Functor *f;
-   
    switch (optchar) {
    case 'h':
       usage(std::cout);
-      return 0;         
+      return 0;
+   case 'f':
+      read_script(optarg);
+      return 1;
+   default:
+      return add_operation(optchar, optarg);
+   }
+}
+
+int ModifyCommand::add_operation(int optchar, char *arg) {
+   Functor *f;
+
+   switch (optchar) {
    case 'i':
       f = new Insert;
       break;
@@ -43,5 +186,42 @@ int ModifyCommand::opthandler(int optchar) {
    }
 
    operations.emplace_back(f);
-   return f->parse(optarg);
+   return f->parse(arg);
+}
+
+void ModifyCommand::read_script(const char *path) {
+   const std::unordered_map<std::string, int> verbs =
+      {{"insert", 'i'}, {"delete", 'd'}, {"start", 's'}, {"update", 'u'}};
+
+   std::ifstream file;
+   std::istream *is = &std::cin;
+   if (std::string(path) != "-") {
+      file.open(path);
+      if (!file) {
+         throw std::string("failed to open edit script `") + path + "'";
+      }
+      is = &file;
+   }
+
+   std::string line;
+   for (unsigned lineno = 1; std::getline(*is, line); ++lineno) {
+      std::istringstream ss(line);
+      std::string verb, arg;
+      if (!(ss >> verb) || verb[0] == '#') {
+         continue;
+      }
+      ss >> arg;
+
+      const auto it = verbs.find(verb);
+      try {
+         if (it == verbs.end()) {
+            throw std::string("unknown operation `") + verb + "'";
+         }
+         if (add_operation(it->second, arg.data()) <= 0) {
+            throw std::string("invalid operation");
+         }
+      } catch (const std::string& s) {
+         throw std::string(path) + ":" + std::to_string(lineno) + ": " + s;
+      }
+   }
 }
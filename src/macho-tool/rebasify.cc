@@ -1,5 +1,7 @@
+#include <deque>
 #include <iostream>
-#include <list>
+#include <unordered_map>
+#include <vector>
 
 #include "rebasify.hh"
 #include "core/macho.hh"
@@ -9,6 +11,8 @@
 #include "core/instruction.hh"
 #include "core/rebase_info.hh"
 #include "core/dyldinfo.hh"
+#include "core/regs.hh"
+#include "core/cfg.hh"
 
 int Rebasify::opthandler(int optchar) {
    switch (optchar) {
@@ -27,7 +31,7 @@ int Rebasify::opthandler(int optchar) {
 void Rebasify::state_info::reset() {
    state = 0;
    vmaddr = 0;
-   live_regs.clear();
+   live_regs = 0;
    frame_index = std::nullopt;
    // text_it = section->content.begin();
 }
@@ -53,27 +57,13 @@ int Rebasify::work() {
       return -1;
    }
 
-   #if 0
-   state_info state(archive32);
-   for (auto text_it = state.section->content.begin(); text_it != state.section->content.end();
-        ++text_it) {
-      auto text_inst = dynamic_cast<MachO::Instruction<MachO::Bits::M32> *>(*text_it);
-      if (text_inst) {
-         decode_info info(text_inst->xedd, text_it);
-         if (handle_inst(text_inst, state, info) < 0) { return -1; }
-      }
-   }
-   #else
    handle_insts(archive32);
-   #endif
       
    archive32->Build(0);
    archive32->Emit(*out_img);
    return 0;
 }
 
-#define MULTIPASS 1
-
 Rebasify::decode_info::decode_info(const xed_decoded_inst_t& xedd,
                                    typename MachO::Section<MachO::Bits::M32>::Content::iterator it):
    text_it(it),
@@ -85,107 +75,160 @@ Rebasify::decode_info::decode_info(const xed_decoded_inst_t& xedd,
    base_reg(xed_decoded_inst_get_base_reg(&xedd, 0)),
    memdisp(xed_decoded_inst_get_memory_displacement(&xedd, 0)) {}
 
+/* Forward dataflow over the basic blocks of each function in __text. The state at a block's
+ * entry is the meet of its predecessors' exit states; blocks that no edge reaches start from the
+ * state of the block before them (see handle_function()). Once the states are stable, a final
+ * pass over each block rewrites the PIC references exactly once.
+ */
 void Rebasify::handle_insts(MachO::Archive<MachO::Bits::M32> *archive) const {
-   std::list<state_info> states;
-#if MULTIPASS == 0
-   std::unordered_set<size_t> visited_vmaddrs;
-#else
-   std::unordered_map<size_t, std::list<state_info>> visited_vmaddrs; /* also captures state */
-#endif
-
-   /* initial state */
-   states.emplace_front(archive);
-
-   while (!states.empty()) {
-      state_info state = states.front();
-      states.pop_front();
-
-      /* check if state has already been visited or has reached end of section */
-#if MULTIPASS == 0
-      if (state.text_it == state.section->content.end() ||
-          visited_vmaddrs.find((**state.text_it).loc.vmaddr) != visited_vmaddrs.end()) {
-         continue;
-      }
-#else
-      if (state.text_it == state.section->content.end()) {
-         continue;
-      }
-      const auto visited_it = visited_vmaddrs.find((**state.text_it).loc.vmaddr);
-      if (visited_it != visited_vmaddrs.end()) {
-         auto& visited_states = visited_it->second;
-         if (std::find(visited_states.begin(), visited_states.end(), state) != visited_states.end())
-            {
-               continue;
-            }
-      }
-#endif
+   using CFG = MachO::CFG<MachO::Bits::M32>;
+   
+   auto text = archive->section(SECT_TEXT);
+   Iters iters;
+   for (auto it = text->content.begin(); it != text->content.end(); ++it) {
+      iters.emplace(*it, it);
+   }
 
-      if (verbose) {
-         fprintf(stderr, "[REBASIFY] 0x%zx\n", (**state.text_it).loc.vmaddr);
-      }
+   for (const auto& cfg : CFG::Functions(*archive)) {
+      handle_function(archive, *cfg, iters);
+   }
+}
 
-      MachO::Instruction<MachO::Bits::M32> *inst =
-         dynamic_cast<MachO::Instruction<MachO::Bits::M32> *>(*state.text_it);
-      
-      if (inst) {
-         /* add to visited list */
-         visited_vmaddrs[inst->loc.vmaddr].push_back(state);
-         
-         decode_info decode(inst->xedd, state.text_it);
-         
-         switch (decode.iclass) {
-         case XED_ICLASS_JB: 
-         case XED_ICLASS_JBE: 
-         case XED_ICLASS_JL: 
-         case XED_ICLASS_JLE: 
-         case XED_ICLASS_JNB: 
-         case XED_ICLASS_JNBE: 
-         case XED_ICLASS_JNL: 
-         case XED_ICLASS_JNLE: 
-         case XED_ICLASS_JNO: 
-         case XED_ICLASS_JNP: 
-         case XED_ICLASS_JNS: 
-         case XED_ICLASS_JNZ: 
-         case XED_ICLASS_JO: 
-         case XED_ICLASS_JP: 
-         case XED_ICLASS_JS: 
-         case XED_ICLASS_JZ:
-            /* split into two states */
-            states.emplace_front(state, inst->brdisp);
-            ++state.text_it;
+void Rebasify::handle_function(MachO::Archive<MachO::Bits::M32> *archive,
+                               MachO::CFG<MachO::Bits::M32>& cfg, const Iters& iters) const {
+   using Block = MachO::CFG<MachO::Bits::M32>::Block;
+   const std::size_t nblocks = cfg.blocks.size();
+
+   const auto transfer = [&] (Block& block, state_info& state, bool apply) {
+      /* iterate over a copy, since the final pass inserts into the block */
+      const auto insts = block.insts;
+      for (MachO::Instruction<MachO::Bits::M32> *inst : insts) {
+         if (verbose && apply) {
+            fprintf(stderr, "[REBASIFY] 0x%zx\n", inst->loc.vmaddr);
+         }
+         switch (xed_decoded_inst_get_category(&inst->xedd)) {
+         case XED_CATEGORY_COND_BR:
+         case XED_CATEGORY_UNCOND_BR:
             break;
-
-         case XED_ICLASS_JMP:
+         default:
             {
-               /* add next instruction to be processed last in case it's not reachable thru static
-                * analysis */
-               state_info state2 = state;
-               ++state2.text_it;
-               states.push_back(state2);
-
-               /* move state */
-               state = state_info(state, inst->brdisp);
+               const auto it = iters.at(inst);
+               const auto begin = cfg.section->content.begin();
+               const auto before = it == begin ? nullptr : *std::prev(it);
+               decode_info decode(inst->xedd, it);
+               handle_inst(inst, state, decode, apply);
+
+               /* record the rebased load handle_inst_thunk() put in front of _inst_ */
+               if (it != begin && *std::prev(it) != before) {
+                  cfg.insert(inst, dynamic_cast<MachO::Instruction<MachO::Bits::M32> *>
+                             (*std::prev(it)));
+               }
             }
             break;
-
-         default:
-            handle_inst(inst, state, decode);
-            ++state.text_it;
-            break;
          }
+      }
+   };
+
+   std::vector<std::optional<state_info>> in(nblocks);
+   std::vector<std::optional<state_info>> out(nblocks);
+   std::vector<bool> falls_in(nblocks, false); /* entered from the preceding block's state */
+   std::vector<bool> queued(nblocks, false);
+   std::deque<Block *> worklist;
+   const auto enqueue = [&] (Block *block) {
+      if (!queued[block->id]) {
+         queued[block->id] = true;
+         worklist.push_back(block);
+      }
+   };
+
+   /* meet of the computed incoming states; those not computed yet are top and don't narrow it */
+   const auto entry_state = [&] (const Block *block) {
+      std::optional<state_info> state;
+      const auto join = [&] (const std::optional<state_info>& other) {
+         if (!other) {
+            return;
+         }
+         if (state) {
+            state->meet(*other);
+         } else {
+            state = other;
+         }
+      };
+      for (const Block *pred : block->preds) {
+         join(out[pred->id]);
+      }
+      if (falls_in[block->id]) {
+         join(out[block->id - 1]);
+      }
+      return state;
+   };
+
+   const auto update = [&] (Block *block) {
+      const std::optional<state_info> state = entry_state(block);
+      if (state && (!in[block->id] || *in[block->id] != *state)) {
+         in[block->id] = state;
+         enqueue(block);
+      }
+   };
+   
+   const auto solve = [&] () {
+      while (!worklist.empty()) {
+         Block *block = worklist.front();
+         worklist.pop_front();
+         queued[block->id] = false;
+
+         state_info state = *in[block->id];
+         transfer(*block, state, false);
+         if (out[block->id] && *out[block->id] == state) {
+            continue;
+         }
+         out[block->id] = state;
+         
+         for (Block *succ : block->succs) {
+            update(succ);
+         }
+         if (block->id + 1 < nblocks && falls_in[block->id + 1]) {
+            update(cfg.blocks[block->id + 1].get());
+         }
+      }
+   };
 
+   /* The function's entry starts from the initial state. Blocks no edge reaches from it (switch
+    * cases entered through a jump table, code after a jmp, loops only reachable from themselves)
+    * continue from the exit state of the block before them, as the old state-list exploration
+    * did after a jmp. Resetting them instead would lose the PIC base at the join after a switch.
+    */
+   for (const auto& block : cfg.blocks) {
+      if (in[block->id]) {
+         continue;
+      }
+      if (block->id == 0) {
+         in[block->id] = state_info(archive);
       } else {
-         ++state.text_it;
+         falls_in[block->id] = true;
+         in[block->id] = entry_state(block.get());
+         if (!in[block->id]) {
+            in[block->id] = state_info(archive);
+         }
       }
+      enqueue(block.get());
+      solve();
+   }
 
-      states.push_front(state);
+   /* rewrite */
+   for (const auto& block : cfg.blocks) {
+      if (in[block->id]) {
+         state_info state = *in[block->id];
+         transfer(*block, state, true);
+      }
    }
 }
 
 int Rebasify::handle_inst(MachO::Instruction<MachO::Bits::M32> *inst, state_info& state,
-                           const decode_info& info) const {
+                           const decode_info& info, bool apply) const {
    const MachO::opcode_t call_0({0xe8, 0x00, 0x00, 0x00, 0x00});
    // const MachO::opcode_t pop({0x58});
+   const bool verbose = this->verbose && apply;
 
    if (inst->instbuf == call_0) {
       if (verbose) {
@@ -203,7 +246,7 @@ int Rebasify::handle_inst(MachO::Instruction<MachO::Bits::M32> *inst, state_info
       if (info.iform == XED_IFORM_POP_GPRv_58) {
          state.state = 2;
          xed_reg_enum_t live_reg = xed_decoded_inst_get_reg(&inst->xedd, XED_OPERAND_REG0);
-         state.live_regs.insert(live_reg);
+         state.set_live(live_reg);
          state.vmaddr = inst->loc.vmaddr;
          if (verbose) {
             fprintf(stderr, "[REBASIFY] 0x%zx thunk assigned to register %s\n",
@@ -214,40 +257,28 @@ int Rebasify::handle_inst(MachO::Instruction<MachO::Bits::M32> *inst, state_info
 
    case 2:
       if (info.iclass == XED_ICLASS_CALL_NEAR) {
-         for (auto live_reg_it = state.live_regs.begin(); live_reg_it != state.live_regs.end(); ) {
-            /* check if it's a preserved register */
-            switch (*live_reg_it) {
-            case XED_REG_EAX:
-            case XED_REG_ECX:
-            case XED_REG_EDX:
+         /* only ebx, esi and edi are preserved across calls */
+         for (xed_reg_enum_t reg : {XED_REG_EAX, XED_REG_ECX, XED_REG_EDX}) {
+            if (state.live(reg)) {
                if (verbose) {
                   fprintf(stderr, "[REBASIFY] 0x%zx register %s destroyed by call\n",
-                          inst->loc.vmaddr, xed_reg_enum_t2str(*live_reg_it));
+                          inst->loc.vmaddr, xed_reg_enum_t2str(reg));
                }
-               live_reg_it = state.live_regs.erase(live_reg_it);
-               break;
-            case XED_REG_EBX:
-            case XED_REG_EDI:
-            case XED_REG_ESI:
-               ++live_reg_it;
-               break;
-            default: abort();
+               state.kill(reg);
             }
          }
       } else {
          /* look for frame store */
          if ((info.iform == XED_IFORM_MOV_MEMv_OrAX || info.iform == XED_IFORM_MOV_MEMv_GPRv) &&
              info.base_reg == XED_REG_EBP) {
-            for (xed_reg_enum_t live_reg : state.live_regs) {
-               if (live_reg == info.reg0) {
-                  /* frame store */
-                  state.frame_index = info.memdisp;
-                  if (verbose) {
-                     fprintf(stderr, "[REBASIFY] 0x%zx frame store from %s to index %d\n",
-                             inst->loc.vmaddr, xed_reg_enum_t2str(live_reg), *state.frame_index);
-                  }
-                  return 0;
+            if (state.live(info.reg0)) {
+               /* frame store */
+               state.frame_index = info.memdisp;
+               if (verbose) {
+                  fprintf(stderr, "[REBASIFY] 0x%zx frame store from %s to index %d\n",
+                          inst->loc.vmaddr, xed_reg_enum_t2str(info.reg0), *state.frame_index);
                }
+               return 0;
             }
 
             if (state.frame_index && info.memdisp == *state.frame_index) {
@@ -263,7 +294,7 @@ int Rebasify::handle_inst(MachO::Instruction<MachO::Bits::M32> *inst, state_info
          /* look for frame load */
          if ((info.iform == XED_IFORM_MOV_GPRv_MEMv || info.iform == XED_IFORM_MOV_OrAX_MEMv) &&
              info.base_reg == XED_REG_EBP && info.memdisp == state.frame_index) {
-            state.live_regs.insert(info.reg0);
+            state.set_live(info.reg0);
             if (verbose) {
                fprintf(stderr, "[REBASIFY] 0x%zx frame load from index %d to %s\n",
                        inst->loc.vmaddr, *state.frame_index, xed_reg_enum_t2str(info.reg0));
@@ -272,9 +303,8 @@ int Rebasify::handle_inst(MachO::Instruction<MachO::Bits::M32> *inst, state_info
          }
          
          /* look for alias */
-         if (info.iform == XED_IFORM_MOV_GPRv_GPRv_89 &&
-             state.live_regs.find(info.reg1) != state.live_regs.end()) {
-            state.live_regs.insert(info.reg0);
+         if (info.iform == XED_IFORM_MOV_GPRv_GPRv_89 && state.live(info.reg1)) {
+            state.set_live(info.reg0);
             if (verbose) {
                fprintf(stderr, "[REBASIFY] 0x%zx alias %s\n", inst->loc.vmaddr,
                        xed_reg_enum_t2str(info.reg0));
@@ -283,7 +313,7 @@ int Rebasify::handle_inst(MachO::Instruction<MachO::Bits::M32> *inst, state_info
          }
          
          /* otherwise handle inst thunk */
-         handle_inst_thunk(inst, state, info);
+         return handle_inst_thunk(inst, state, info, apply);
       }
       return 0;
 
@@ -292,19 +322,18 @@ int Rebasify::handle_inst(MachO::Instruction<MachO::Bits::M32> *inst, state_info
 }
 
 int Rebasify::handle_inst_thunk(MachO::Instruction<MachO::Bits::M32> *inst, state_info& state,
-                                 const decode_info& info) const {
+                                 const decode_info& info, bool apply) const {
+   const bool verbose = this->verbose && apply;
+   
    /* custom rules with duplicate operands  */
-   for (auto live_reg_it = state.live_regs.begin(); live_reg_it != state.live_regs.end();
-        ++live_reg_it) {
-      if (info.reg0 == *live_reg_it && info.reg1 == *live_reg_it) {
-         switch (info.iclass) {
-         case XED_ICLASS_XOR:
-            state.live_regs.erase(live_reg_it);
-            return 0;
-            
-         default:
-            break;
-         }
+   if (info.reg0 == info.reg1 && state.live(info.reg0)) {
+      switch (info.iclass) {
+      case XED_ICLASS_XOR:
+         state.kill(info.reg0);
+         return 0;
+         
+      default:
+         break;
       }
    }
    
@@ -318,24 +347,35 @@ int Rebasify::handle_inst_thunk(MachO::Instruction<MachO::Bits::M32> *inst, stat
    default:
       {
          std::size_t target = state.vmaddr;
-         if (state.live_regs.find(info.base_reg) != state.live_regs.end()) {
+         if (state.live(info.base_reg)) {
             target += info.memdisp;
          }
 
-         typename state_info::LiveRegs::iterator live_reg_it;
-         if ((live_reg_it = state.live_regs.find(info.base_reg)) != state.live_regs.end() ||
-             (live_reg_it = state.live_regs.find(info.reg1))     != state.live_regs.end()) {
+         xed_reg_enum_t live_reg = XED_REG_INVALID;
+         if (state.live(info.base_reg)) {
+            live_reg = info.base_reg;
+         } else if (state.live(info.reg1)) {
+            live_reg = info.reg1;
+         }
+         
+         if (live_reg != XED_REG_INVALID && apply) {
             if (verbose) {
                fprintf(stderr, "[REBASIFY] 0x%zx ref dst=0x%zx\n", inst->loc.vmaddr,
                        target);
             }
             
             auto mov_inst = new MachO::Instruction<MachO::Bits::M32>
-               (MachO::opcode::mov_r32_imm32(*live_reg_it));
+               (MachO::opcode::mov_r32_imm32(live_reg));
             auto mov_inst_imm = MachO::Immediate<MachO::Bits::M32>::Create(target);
             mov_inst->segment = mov_inst_imm->segment = state.segment;
             mov_inst->section = mov_inst_imm->section = state.section;
 
+            /* the target may lie inside a run of unreached bytes */
+            for (auto section : state.archive->sections()) {
+               if (section->contains_vmaddr(target)) {
+                  section->split_data(target);
+               }
+            }
             if ((mov_inst_imm->pointee =
                  state.archive->template find_blob<MachO::SectionBlob>(target)) == nullptr) {
                log("unable to find destination blob in rebasify operation at vmaddr 0x%zx",
@@ -349,7 +389,7 @@ int Rebasify::handle_inst_thunk(MachO::Instruction<MachO::Bits::M32> *inst, stat
             state.section->content.insert(info.text_it, mov_inst);
                      
             /* adjust displacement if necessary */
-            if (info.base_reg == *live_reg_it) {
+            if (info.base_reg == live_reg) {
                const unsigned dispbits =
                   xed_decoded_inst_get_memory_displacement_width_bits(&inst->xedd, 0);
                if (dispbits != 0) {
@@ -378,17 +418,16 @@ int Rebasify::handle_inst_thunk(MachO::Instruction<MachO::Bits::M32> *inst, stat
    }
 
    /* check if eax is destroyed */
-   typename state_info::LiveRegs::iterator live_reg_it;
-   if ((live_reg_it = state.live_regs.find(info.reg0)) != state.live_regs.end()) {
+   if (state.live(info.reg0)) {
       switch (xed_decoded_inst_get_iclass(&inst->xedd)) {
       case XED_ICLASS_MOV:
       case XED_ICLASS_XOR:
       case XED_ICLASS_LEA:
          if (verbose) {
             fprintf(stderr, "[REBASIFY] 0x%zx register %s destroyed by instruction\n",
-                    inst->loc.vmaddr, xed_reg_enum_t2str(*live_reg_it));
+                    inst->loc.vmaddr, xed_reg_enum_t2str(info.reg0));
          }
-         state.live_regs.erase(live_reg_it);
+         state.kill(info.reg0);
          return 0;
 
       default:
@@ -400,25 +439,32 @@ int Rebasify::handle_inst_thunk(MachO::Instruction<MachO::Bits::M32> *inst, stat
 }
 
 Rebasify::state_info::state_info(MachO::Archive<MachO::Bits::M32> *archive):
-   archive(archive), segment(archive->segment(SEG_TEXT)), section(archive->section(SECT_TEXT)),
-   text_it(section->content.begin())
+   archive(archive), segment(archive->segment(SEG_TEXT)), section(archive->section(SECT_TEXT))
 {
    reset();
 }
 
-Rebasify::state_info::state_info(const state_info& other,
-                                 const MachO::SectionBlob<MachO::Bits::M32> *target):
-   state(other.state), vmaddr(other.vmaddr), live_regs(other.live_regs),
-   frame_index(other.frame_index), archive(other.archive), segment(other.segment),
-   section(other.section),
-   text_it(std::find(section->content.begin(), section->content.end(), target))
-{
-#if 0
-   // actually, it's ok if it's out of range
-   if (text_it == section->content.end()) {
-      throw std::invalid_argument("bad target blob");
+Rebasify::state_info::LiveRegs Rebasify::state_info::reg_bit(xed_reg_enum_t reg) {
+   if (xed_reg_class(reg) != XED_REG_CLASS_GPR ||
+       xed_get_largest_enclosing_register32(reg) != reg) {
+      return 0;
+   }
+   return MachO::gpr_mask(reg);
+}
+
+void Rebasify::state_info::meet(const state_info& other) {
+   if (*this == other) {
+      return;
+   }
+   
+   if (state == 2 && other.state == 2 && vmaddr == other.vmaddr) {
+      live_regs &= other.live_regs;
+      if (frame_index != other.frame_index) {
+         frame_index = std::nullopt;
+      }
+   } else {
+      reset();
    }
-#endif
 }
 
 bool Rebasify::state_info::operator==(const Rebasify::state_info& other) const {
@@ -0,0 +1,63 @@
+#include <iostream>
+#include <fstream>
+
+#include "reorder.hh"
+#include "core/archive.hh"
+#include "core/reorder.hh"
+
+int ReorderCommand::opthandler(int optchar) {
+   switch (optchar) {
+   case 'h': // help
+      usage(std::cout);
+      return 0;
+
+   case 'p': // profile
+      profile_path = optarg;
+      return 1;
+
+   case 'v': // verbose
+      verbose = true;
+      return 1;
+
+   default:
+      abort();
+   }
+}
+
+template <MachO::Bits b>
+int ReorderCommand::workT(MachO::MachO *macho) {
+   auto archive = dynamic_cast<MachO::Archive<b> *>(macho);
+   if (archive == nullptr) {
+      log("reorder requires an archive");
+      return -1;
+   }
+
+   std::ifstream is(profile_path);
+   if (!is) {
+      log("failed to open profile `%s'", profile_path);
+      return -1;
+   }
+   const auto profile = MachO::Profile::Parse(is);
+
+   const std::size_t moved = MachO::reorder_functions(*archive, profile);
+   if (verbose) {
+      log("moved %zu functions", moved);
+   }
+   
+   archive->Build(0);
+   archive->Emit(*out_img);
+   return 0;
+}
+
+int ReorderCommand::work() {
+   if (profile_path == nullptr) {
+      throw std::string("missing profile (-p)");
+   }
+   
+   MachO::MachO *macho = MachO::MachO::Parse(*in_img);
+
+   switch (macho->bits()) {
+   case MachO::Bits::M32: return workT<MachO::Bits::M32>(macho);
+   case MachO::Bits::M64: return workT<MachO::Bits::M64>(macho);
+   }
+}
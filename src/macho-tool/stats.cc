@@ -0,0 +1,40 @@
+#include <iostream>
+#include <fcntl.h>
+
+#include "stats.hh"
+#include "core/macho.hh"
+#include "core/stats.hh"
+
+int StatsCommand::opthandler(int optchar) {
+   switch (optchar) {
+   case 'h':
+      usage(std::cout);
+      return 0;
+
+   case 'j':
+      json = true;
+      return 1;
+
+   default: abort();
+   }
+}
+
+/* Parse and build the image, reporting what the library allocated and where the time went.
+ * Transform and emit are covered by `--stats' on the commands that perform them. */
+int StatsCommand::work() {
+   MachO::Stats stats;
+   {
+      MachO::Stats::Enable enable(&stats);
+      MachO::MachO *macho = MachO::MachO::Parse(*img);
+      macho->Build();
+   }
+
+   if (json) {
+      stats.print_json(std::cout);
+   } else {
+      stats.print(std::cout);
+   }
+   return 0;
+}
+
+StatsCommand::StatsCommand(): InplaceCommand("stats", O_RDONLY) {}
@@ -2,6 +2,29 @@
 
 #include "transform.hh"
 #include "core/archive.hh"
+#include "core/transform.hh"
+#include "core/flags.hh"
+#include "core/regs.hh"
+#include "core/peephole.hh"
+#include "core/printf_plans.hh"
+#include "core/strip.hh"
+
+namespace {
+
+   /* parse power-of-two byte alignment into its log2 */
+   unsigned parse_align(const char *arg) {
+      const unsigned long bytes = std::stoul(arg);
+      if (bytes == 0 || (bytes & (bytes - 1)) != 0) {
+         throw std::string("alignment must be a power of 2");
+      }
+      unsigned log2 = 0;
+      while ((1UL << log2) < bytes) {
+         ++log2;
+      }
+      return log2;
+   }
+
+}
 
 int TransformCommand::opthandler(int optchar) {
    switch (optchar) {
@@ -20,6 +43,58 @@ int TransformCommand::opthandler(int optchar) {
          throw std::string("bits must be 32 or 64");
       }
       return 1;
+
+   case 'd': // direct-calls
+      direct_stub_calls = true;
+      return 1;
+
+   case 'F': // strict-flags
+      abi_flags = false;
+      return 1;
+
+   case 'G': // strict-regs
+      abi_regs = false;
+      return 1;
+
+   case 'O': // peephole
+      peephole = true;
+      return 1;
+
+   case 'R': // rsb-calls
+      rsb_calls = true;
+      return 1;
+
+   case 'p': // printf-plans
+      printf_plans = true;
+      return 1;
+
+   case 's': // dead-strip
+      dead_strip = true;
+      return 1;
+
+   case 'k': // keep
+      keep_symbols.push_back(optarg);
+      return 1;
+
+   case 'v': // verbose
+      verbose = true;
+      return 1;
+
+   case 'j': // jobs
+      jobs = std::stoul(optarg);
+      return 1;
+
+   case 'a': // align-functions
+      alignment.function_align = parse_align(optarg);
+      return 1;
+
+   case 'l': // align-loops
+      alignment.loop_align = parse_align(optarg);
+      return 1;
+
+   case 'P': // max-padding
+      alignment.max_padding = std::stoul(optarg);
+      return 1;
       
    default:
       abort();
@@ -33,9 +108,40 @@ int TransformCommand::workT(MachO::MachO *macho) {
       log("transform requires archive of correct bits");
       return -1;
    }
+   if (dead_strip) {
+      const std::size_t nbytes = MachO::dead_strip(*archive, keep_symbols);
+      if (verbose) {
+         log("dead strip: %zu bytes", nbytes);
+      }
+   }
+   if (printf_plans) {
+      const std::size_t nplans = MachO::emit_printf_plans(*archive);
+      if (verbose) {
+         log("printf plans: %zu", nplans);
+      }
+   }
    archive->Build(0);
-   auto newarchive = archive->Transform();
+   MachO::analyze_flags_liveness(*archive, abi_flags);
+   MachO::analyze_reg_liveness(*archive, abi_regs);
+   MachO::TransformEnv<b> env;
+   env.direct_stub_calls = direct_stub_calls;
+   env.rsb_calls = rsb_calls;
+   env.jobs = jobs;
+   auto newarchive = archive->Transform(env);
+   if constexpr (b == MachO::Bits::M32) {
+      if (peephole) {
+         MachO::peephole(*newarchive);
+      }
+   }
+   const std::size_t npadding = MachO::align_code(*newarchive, alignment);
+   if (verbose && npadding > 0) {
+      log("alignment: %zu padding blobs", npadding);
+   }
    newarchive->Build(0);
+   if (verbose) {
+      log("branches: %zu short, %zu relaxed to rel32", newarchive->short_branches,
+          newarchive->relaxed_branches);
+   }
    newarchive->Emit(*out_img);
    return 0;
 }
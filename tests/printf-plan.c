@@ -0,0 +1,21 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+
+int main(int argc, char *argv[]) {
+   const size_t size = strlen(argv[0]) + 300;
+   const ptrdiff_t diff = -(ptrdiff_t) size;
+   printf("%zd %zu %zx\n", (ssize_t) diff, size, size);
+
+   /* mixed widths, so a mis-sized argument shifts every one after it */
+   printf("%hhd %hd %d %ld %lld %zu %c %s %u %.2f %lx %td\n", (signed char) -3, (short) -300,
+          argc, -70000L, -5000000000LL, size, 'x', "str", 4000000000U, 2.5, 0xdeadbeefUL, diff);
+   printf("%*d|%-*.*s|%5.1f\n", 6, argc, 8, 3, "abcdef", -1.25);
+
+   /* format built at runtime, so it has no precompiled plan */
+   char format[32];
+   strcpy(format, "%zd %s %lld\n");
+   printf(format, diff, "dynamic", 1LL << 40);
+   
+   return 0;
+}
@@ -0,0 +1,33 @@
+#include <stdio.h>
+
+/* The switch compiles to a jump table, so its cases are only reached through an indirect jmp.
+ * The static data referenced after it is addressed relative to the PIC base loaded before the
+ * switch, which rebasify must still rewrite.
+ */
+
+static int counts[8];
+static const char *names[] = {"zero", "one", "two", "three", "four", "five", "six", "seven"};
+
+static int classify(int i) {
+   int weight;
+   switch (i) {
+   case 0: weight = 3; break;
+   case 1: weight = 1; break;
+   case 2: weight = 4; break;
+   case 3: weight = 1; break;
+   case 4: weight = 5; break;
+   case 5: weight = 9; break;
+   case 6: weight = 2; break;
+   default: weight = 6; break;
+   }
+   counts[i & 7] += weight;
+   return counts[i & 7];
+}
+
+int main(int argc, char *argv[]) {
+   for (int i = 0; i < 16 + argc; ++i) {
+      const int count = classify(i % 9);
+      printf("%s %d\n", names[i & 7], count);
+   }
+   return 0;
+}